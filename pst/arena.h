@@ -0,0 +1,132 @@
+#pragma once
+
+#ifndef PST_ARENA_H__
+#define PST_ARENA_H__
+
+#include <cstddef> // size_t, max_align_t
+#include <new> // operator new
+#include <type_traits> // alignment_of, true_type
+
+namespace pst
+{
+  // A monotonic region of memory. Allocation bumps a pointer through chunks
+  // taken from operator new, deallocation does nothing, and all chunks are
+  // given back at once when the arena is destroyed.
+  //
+  // Meant for a family of versions that live and die together: build them
+  // with an arena_allocator on one arena, and drop the whole family by
+  // destroying the arena after the last tree referring to it. Not
+  // synchronized; an arena belongs to one thread at a time.
+  class arena
+  {
+  public:
+    explicit arena(std::size_t chunk_size = 64 * 1024)
+      : chunk_size(chunk_size), chunks(0), pos(0), end(0), allocated(0)
+    {}
+
+    ~arena() { release(); }
+
+    void* allocate(std::size_t size, std::size_t align)
+    {
+      char* p = align_up(pos, align);
+
+      if (!p || p > end || size > static_cast<std::size_t>(end - p)) {
+        add_chunk(size + align);
+        p = align_up(pos, align);
+      }
+
+      pos = p + size;
+      allocated += size;
+      return p;
+    }
+
+    // bytes handed out since construction, not counting alignment padding
+    std::size_t bytes_allocated() const { return allocated; }
+
+  private:
+    struct chunk
+    {
+      chunk* next;
+    };
+
+    static std::size_t const header_size =
+      (sizeof(chunk) + std::alignment_of<std::max_align_t>::value - 1) / std::alignment_of<std::max_align_t>::value * std::alignment_of<std::max_align_t>::value;
+
+    static char* align_up(char* p, std::size_t align)
+    {
+      std::size_t const misalign = reinterpret_cast<std::size_t>(p) % align;
+      return misalign ? p + (align - misalign) : p;
+    }
+
+    void add_chunk(std::size_t at_least)
+    {
+      std::size_t const size = header_size + (at_least > chunk_size ? at_least : chunk_size);
+      chunk* c = static_cast<chunk*>(::operator new(size));
+      c->next = chunks;
+      chunks = c;
+      pos = reinterpret_cast<char*>(c) + header_size;
+      end = reinterpret_cast<char*>(c) + size;
+    }
+
+    void release()
+    {
+      while (chunks) {
+        chunk* next = chunks->next;
+        ::operator delete(chunks);
+        chunks = next;
+      }
+    }
+
+    arena(arena const&);
+    arena& operator=(arena const&);
+
+    std::size_t const chunk_size;
+    chunk* chunks;
+    char* pos;
+    char* end;
+    std::size_t allocated;
+  };
+
+  // Stateful allocator drawing from an arena; copies and rebinds share it.
+  // Trees using it skip freeing nodes one at a time, and skip visiting them
+  // at all when their values are trivially destructible.
+  //
+  //   pst::arena a;
+  //   pst::tree::rb_tree<int, std::less<int>, pst::arena_allocator<int> > t(std::less<int>(), pst::arena_allocator<int>(a));
+  template <typename T>
+  struct arena_allocator
+  {
+    typedef T value_type;
+    typedef T* pointer;
+    typedef T const* const_pointer;
+    typedef T& reference;
+    typedef T const& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef std::true_type is_monotonic;
+
+    template <typename U> struct rebind { typedef arena_allocator<U> other; };
+
+    explicit arena_allocator(pst::arena& a) : a(&a) {}
+    template <typename U> arena_allocator(arena_allocator<U> const& other) : a(other.a) {}
+
+    T* allocate(std::size_t n)
+    {
+      return static_cast<T*>(a->allocate(n * sizeof(T), std::alignment_of<T>::value));
+    }
+
+    void deallocate(T*, std::size_t) {}
+
+    pst::arena& get_arena() const { return *a; }
+
+    friend bool operator==(arena_allocator const& lhs, arena_allocator const& rhs) { return lhs.a == rhs.a; }
+    friend bool operator!=(arena_allocator const& lhs, arena_allocator const& rhs) { return lhs.a != rhs.a; }
+
+  private:
+    template <typename U> friend struct arena_allocator;
+
+    pst::arena* a;
+  };
+}
+
+#endif // PST_ARENA_H__
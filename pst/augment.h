@@ -0,0 +1,235 @@
+#pragma once
+
+#ifndef PST_AUGMENT_H__
+#define PST_AUGMENT_H__
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <functional> // hash
+#include <limits>
+#include <tuple> // no summary
+#include <type_traits>
+#include <utility> // declval, pair
+#include "detail.h"
+
+namespace pst
+{
+  // Augmentation policies for rb_tree: a summary of its subtree kept in
+  // every node. A node's summary is computed from its key/value and the
+  // summaries of its children whenever the node is made, and redone by a
+  // transient for the nodes it changes in place; recoloring leaves it as
+  // it is. A policy provides
+  //
+  //   summary_type
+  //   static summary_type identity()                        of an empty tree
+  //   static summary_type summarize(left, keyval, right)
+  //
+  // and, if summaries count elements, static std::size_t count(summary),
+  // which gives rb_tree an O(1) size() and rank, select and count_range.
+  // When summarize is an in-order fold, as for monoid_augment,
+  // rb_tree::aggregate gives the summary of any key range.
+
+  // nothing kept, the default; takes no space in the nodes
+  struct no_augment
+  {
+    typedef std::tuple<> summary_type;
+
+    static summary_type identity() { return summary_type(); }
+
+    template <typename T>
+    static summary_type summarize(summary_type const&, T const&, summary_type const&) { return summary_type(); }
+  };
+
+  // the number of elements in the subtree
+  struct size_augment
+  {
+    typedef std::size_t summary_type;
+
+    static summary_type identity() { return 0; }
+
+    template <typename T>
+    static summary_type summarize(summary_type left, T const&, summary_type right) { return left + 1 + right; }
+
+    static std::size_t count(summary_type s) { return s; }
+  };
+
+  // Monoids for monoid_augment: an associative combine with an identity,
+  //
+  //   value_type
+  //   static value_type identity()
+  //   static value_type combine(a, b)
+  //
+  // combine need not commute, summaries are folded in key order.
+
+  template <typename T>
+  struct sum_monoid
+  {
+    typedef T value_type;
+    static T identity() { return T(); }
+    static T combine(T const& a, T const& b) { return a + b; }
+  };
+
+  template <typename T>
+  struct min_monoid
+  {
+    typedef T value_type;
+    static T identity() { return std::numeric_limits<T>::max(); }
+    static T combine(T const& a, T const& b) { return b < a ? b : a; }
+  };
+
+  template <typename T>
+  struct max_monoid
+  {
+    typedef T value_type;
+    static T identity() { return std::numeric_limits<T>::lowest(); }
+    static T combine(T const& a, T const& b) { return a < b ? b : a; }
+  };
+
+  // what a monoid_augment folds of each key/value: all of it ...
+  struct whole_value
+  {
+    template <typename T>
+    T const& operator()(T const& kv) const { return kv; }
+  };
+
+  // ... or, in a map, the mapped value
+  struct mapped_value
+  {
+    template <typename K, typename V>
+    V const& operator()(std::pair<K, V> const& kv) const { return kv.second; }
+  };
+
+  // The Monoid fold of Measure over the subtree, in key order; with it
+  // rb_tree::aggregate folds any key range in O(log n). For counts use
+  // size_augment, which also gives rank and select.
+  template <typename Monoid, typename Measure = whole_value>
+  struct monoid_augment
+  {
+    typedef typename Monoid::value_type summary_type;
+
+    static summary_type identity() { return Monoid::identity(); }
+
+    template <typename T>
+    static summary_type summarize(summary_type const& left, T const& kv, summary_type const& right) {
+      return Monoid::combine(Monoid::combine(left, Measure()(kv)), right);
+    }
+  };
+
+  // A hash of a sequence of values that depends on them and their order
+  // alone: the polynomial sum of h(v_i) B^(n-1-i) modulo the prime
+  // 2^61 - 1, kept with B^n so that the hashes of two sequences combine
+  // into that of the two in a row. Trees of the same values thus hash
+  // alike whatever their shape. B is fixed: unequal sequences collide
+  // with a chance of about n / 2^61 unless chosen to, so this is no
+  // defence against keys picked by an adversary.
+  struct content_hash
+  {
+    // of the empty sequence
+    content_hash() : hash(0), scale(1) {}
+
+    // of a single value with hash h
+    explicit content_hash(std::size_t h) : hash(reduce(mix(h))), scale(base) {}
+
+    std::uint64_t value() const { return hash ^ (scale << 3); }
+
+    // of a followed by b
+    static content_hash concat(content_hash const& a, content_hash const& b) {
+      return content_hash(reduce(mul(a.hash, b.scale) + b.hash), mul(a.scale, b.scale));
+    }
+
+    friend bool operator==(content_hash const& lhs, content_hash const& rhs) {
+      return lhs.hash == rhs.hash && lhs.scale == rhs.scale;
+    }
+
+    friend bool operator!=(content_hash const& lhs, content_hash const& rhs) {
+      return !(lhs == rhs);
+    }
+
+  private:
+    static std::uint64_t const prime = (std::uint64_t(1) << 61) - 1;
+    static std::uint64_t const base = 0x0e3779b97f4a7c15;
+
+    content_hash(std::uint64_t hash, std::uint64_t scale) : hash(hash), scale(scale) {}
+
+    // the bits of std::hash can be poor, identity for integers on some
+    // libraries; splitmix64's finalizer spreads them
+    static std::uint64_t mix(std::uint64_t h)
+    {
+      h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+      h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+      return h ^ (h >> 31);
+    }
+
+    static std::uint64_t reduce(std::uint64_t x)
+    {
+      x = (x & prime) + (x >> 61);
+      return x >= prime ? x - prime : x;
+    }
+
+    // a * b mod prime for a, b < prime, in 32-bit halves as there is no
+    // portable 128-bit product; 2^61 = 1 and 2^64 = 8 modulo prime
+    static std::uint64_t mul(std::uint64_t a, std::uint64_t b)
+    {
+      std::uint64_t const mask32 = 0xffffffff;
+      std::uint64_t const lo = (a & mask32) * (b & mask32);
+      std::uint64_t const mid = (a >> 32) * (b & mask32) + (a & mask32) * (b >> 32);
+      std::uint64_t const hi = (a >> 32) * (b >> 32);
+      std::uint64_t const sum = (lo & prime) + (lo >> 61) + (hi << 3) + (mid >> 29) + ((mid & ((std::uint64_t(1) << 29) - 1)) << 32);
+      return reduce(reduce(sum));
+    }
+
+    std::uint64_t hash;
+    std::uint64_t scale;
+  };
+
+  struct hash_monoid
+  {
+    typedef content_hash value_type;
+    static content_hash identity() { return content_hash(); }
+    static content_hash combine(content_hash const& a, content_hash const& b) { return content_hash::concat(a, b); }
+  };
+
+  // std::hash of a key/value, and of both parts of a map entry
+  struct value_hash
+  {
+    template <typename T>
+    std::size_t operator()(T const& v) const { return std::hash<T>()(v); }
+
+    template <typename K, typename V>
+    std::size_t operator()(std::pair<K, V> const& kv) const {
+      return std::hash<K>()(kv.first) * 31 + std::hash<V>()(kv.second);
+    }
+  };
+
+  // the content_hash of a single key/value
+  template <typename Hash>
+  struct hashed_value
+  {
+    template <typename T>
+    content_hash operator()(T const& kv) const { return content_hash(Hash()(kv)); }
+  };
+
+  // The content_hash of the subtree. Trees holding it hash by content in
+  // O(1) and tell most unequal contents apart in O(1), see
+  // rb_tree::equal_content, and
+  // rb_tree::aggregate hashes any key range in O(log n), which narrows
+  // down where two versions differ.
+  template <typename Hash = value_hash>
+  struct hash_augment : monoid_augment<hash_monoid, hashed_value<Hash>> {};
+
+  namespace detail
+  {
+    // whether the summaries of Augment are content hashes
+    template <typename Augment>
+    struct hashes_content : std::is_same<typename Augment::summary_type, content_hash> {};
+
+    // whether the summaries of Augment count elements
+    template <typename Augment, typename = void>
+    struct counts_elements : std::false_type {};
+
+    template <typename Augment>
+    struct counts_elements<Augment, typename always_void<decltype(Augment::count(std::declval<typename Augment::summary_type>()))>::type> : std::true_type {};
+  }
+}
+
+#endif // PST_AUGMENT_H__
@@ -0,0 +1,28 @@
+#pragma once
+
+#ifndef PST_COMPARE_H__
+#define PST_COMPARE_H__
+
+#include <functional> // less
+#include "detail.h"
+
+namespace pst
+{
+  // A less-than that also compares three ways. The trees notice the
+  // compare member (see detail::has_three_way) and descend with one call
+  // per level where a plain less-than takes up to two, one each way:
+  //
+  //   pst::set::rb_set<key, pst::three_way<key> >
+  //
+  // It compares as std::less<T> would, which the trees already take in
+  // one pass for numbers and strings; others need T to have operator<,
+  // or a specialization with a cheaper compare.
+  template <typename T>
+  struct three_way
+  {
+    bool operator()(T const& a, T const& b) const { return a < b; }
+    int compare(T const& a, T const& b) const { return detail::compare3(std::less<T>(), a, b); }
+  };
+}
+
+#endif // PST_COMPARE_H__
@@ -1,25 +1,188 @@
-#pragma once
-
-#ifndef PST_UTIL_H__
-#define PST_UTIL_H__
-
-#include <functional>
-
-namespace pst
-{
-  namespace detail
-  {
-    template <typename LessT>
-    struct pair_first_less
-    {
-      template <typename FirstT, typename SecondT>
-      bool operator()(std::pair<FirstT, SecondT> const& lhs,
-                      std::pair<FirstT, SecondT> const& rhs) const
-      {
-        return LessT()(lhs.first, rhs.first);
-      }
-    };
-  }
-}
-
-#endif // PST_UTIL_H__
+#pragma once
+
+#ifndef PST_UTIL_H__
+#define PST_UTIL_H__
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#if defined(_MSC_VER)
+#  define PST_EMPTY_BASES __declspec(empty_bases)
+#else
+#  define PST_EMPTY_BASES
+#endif
+
+namespace pst
+{
+  namespace detail
+  {
+    template <typename T> struct always_void { typedef void type; };
+
+    // Allocators that only give memory back when they are destroyed (such as
+    // arena_allocator) say so with a nested typedef std::true_type is_monotonic.
+    template <typename Alloc, typename = void>
+    struct is_monotonic : std::false_type {};
+
+    template <typename Alloc>
+    struct is_monotonic<Alloc, typename always_void<typename Alloc::is_monotonic>::type> : Alloc::is_monotonic {};
+
+    // How a Node allocated with NodeAlloc, rebound from Alloc, is referred
+    // to from a link. The low bit of a link is always left clear for the
+    // tree to tag it with.
+    //
+    // By default links are addresses. Allocators that can also name their
+    // blocks by index (slab_allocator) provide index_type, allocate_index,
+    // deallocate_index and address; links are then twice the index, held
+    // in an integer of the index's width. The interface is looked for on
+    // Alloc, and NodeAlloc is only touched inside the functions, as Node is
+    // still incomplete when the links are declared.
+    template <typename Node, typename NodeAlloc, typename Alloc, typename = void>
+    struct node_links
+    {
+      typedef std::uintptr_t link_type;
+
+      static link_type allocate(NodeAlloc& a) { return reinterpret_cast<link_type>(&*std::allocator_traits<NodeAlloc>::allocate(a, 1)); }
+      static void deallocate(NodeAlloc& a, link_type l) { std::allocator_traits<NodeAlloc>::deallocate(a, address(l), 1); }
+      static Node* address(link_type l) { return reinterpret_cast<Node*>(l); }
+    };
+
+    template <typename Node, typename NodeAlloc, typename Alloc>
+    struct node_links<Node, NodeAlloc, Alloc, typename always_void<typename Alloc::index_type>::type>
+    {
+      typedef typename Alloc::index_type link_type;
+
+      static link_type allocate(NodeAlloc& a) { return static_cast<link_type>(a.allocate_index() << 1); }
+      static void deallocate(NodeAlloc& a, link_type l) { a.deallocate_index(static_cast<link_type>(l >> 1)); }
+      static Node* address(link_type l) { return l ? NodeAlloc::address(static_cast<link_type>(l >> 1)) : 0; }
+    };
+
+    // Holds a T; takes up no space when T is an empty class.
+    template <typename T, bool = std::is_empty<T>::value>
+    struct ebo_holder
+    {
+      ebo_holder() : held() {}
+      explicit ebo_holder(T t) : held(std::move(t)) {}
+
+      T const& get() const { return held; }
+      T& get() { return held; }
+
+    private:
+      T held;
+    };
+
+    template <typename T>
+    struct ebo_holder<T, true> : private T
+    {
+      ebo_holder() {}
+      explicit ebo_holder(T t) : T(std::move(t)) {}
+
+      T const& get() const { return *this; }
+      T& get() { return *this; }
+    };
+
+    // Whether Compare also compares three ways, with a member
+    // int compare(a, b) that is negative, zero or positive as a is before,
+    // equivalent to or after b (see pst::three_way).
+    template <typename Compare, typename A, typename B, typename = void>
+    struct has_three_way : std::false_type {};
+
+    template <typename Compare, typename A, typename B>
+    struct has_three_way<Compare, A, B, typename always_void<decltype(std::declval<Compare const&>().compare(std::declval<A const&>(), std::declval<B const&>()))>::type> : std::true_type {};
+
+    template <typename Compare, typename A, typename B>
+    int compare3(Compare const& comp, A const& a, B const& b, std::true_type) {
+      return comp.compare(a, b);
+    }
+
+    // from a less-than, calling it a second time only for a not before b
+    template <typename Compare, typename A, typename B>
+    int compare3(Compare const& comp, A const& a, B const& b, std::false_type) {
+      return comp(a, b) ? -1 : comp(b, a) ? 1 : 0;
+    }
+
+    // numbers compare both ways at once, without branches
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value, int>::type compare3(std::less<T> const&, T const& a, T const& b, std::false_type) {
+      return static_cast<int>(b < a) - static_cast<int>(a < b);
+    }
+
+    // strings in one pass
+    template <typename CharT, typename Traits, typename Alloc>
+    int compare3(std::less<std::basic_string<CharT, Traits, Alloc>> const&,
+                 std::basic_string<CharT, Traits, Alloc> const& a, std::basic_string<CharT, Traits, Alloc> const& b, std::false_type) {
+      return a.compare(b);
+    }
+
+    // How a is ordered against b by comp, negative, zero or positive; one
+    // call of comp where it compares three ways.
+    template <typename Compare, typename A, typename B>
+    int compare3(Compare const& comp, A const& a, B const& b) {
+      return compare3(comp, a, b, has_three_way<Compare, A, B>());
+    }
+
+    // Orders map entries by key. It also compares a bare key against an
+    // entry, so that lookups need not build an entry; the map decides
+    // which key types get that far (see rb_map::find).
+    template <typename LessT>
+    struct pair_first_less : private ebo_holder<LessT>
+    {
+      typedef void is_transparent;
+
+      pair_first_less() {}
+      explicit pair_first_less(LessT less) : ebo_holder<LessT>(std::move(less)) {}
+
+      LessT const& first_less() const { return this->get(); }
+
+      template <typename FirstT, typename SecondT>
+      bool operator()(std::pair<FirstT, SecondT> const& lhs,
+                      std::pair<FirstT, SecondT> const& rhs) const
+      {
+        return first_less()(lhs.first, rhs.first);
+      }
+
+      // Each mixed overload is there only where first_less compares its
+      // key with the entry's: with std::pair keys an entry also passes
+      // for a key, and so matches the other mixed overload as well.
+      template <typename KeyT, typename FirstT, typename SecondT>
+      auto operator()(KeyT const& lhs, std::pair<FirstT, SecondT> const& rhs) const
+        -> decltype(std::declval<LessT const&>()(lhs, rhs.first))
+      {
+        return first_less()(lhs, rhs.first);
+      }
+
+      template <typename KeyT, typename FirstT, typename SecondT>
+      auto operator()(std::pair<FirstT, SecondT> const& lhs, KeyT const& rhs) const
+        -> decltype(std::declval<LessT const&>()(lhs.first, rhs))
+      {
+        return first_less()(lhs.first, rhs);
+      }
+
+      template <typename FirstT, typename SecondT>
+      int compare(std::pair<FirstT, SecondT> const& lhs,
+                  std::pair<FirstT, SecondT> const& rhs) const
+      {
+        return compare3(first_less(), lhs.first, rhs.first);
+      }
+
+      template <typename KeyT, typename FirstT, typename SecondT>
+      auto compare(KeyT const& lhs, std::pair<FirstT, SecondT> const& rhs) const
+        -> decltype(std::declval<LessT const&>()(lhs, rhs.first), int())
+      {
+        return compare3(first_less(), lhs, rhs.first);
+      }
+    };
+
+    // whether Compare takes keys of other types (see rb_map::find)
+    template <typename Compare, typename = void>
+    struct is_transparent : std::false_type {};
+
+    template <typename Compare>
+    struct is_transparent<Compare, typename always_void<typename Compare::is_transparent>::type> : std::true_type {};
+  }
+}
+
+#endif // PST_UTIL_H__
@@ -0,0 +1,118 @@
+#pragma once
+
+#ifndef PST_FINGER_H__
+#define PST_FINGER_H__
+
+#include <cstddef> // size_t
+#include <stdexcept> // length_error
+
+namespace pst
+{
+  namespace tree
+  {
+    // A cursor for lookups near the previous one. It keeps the path to
+    // where its last search ended, together with the keys that bound each
+    // subtree on that path. A search climbs only until it reaches a
+    // subtree whose bounds hold the key, then descends from there. So the
+    // cost depends on the height of the smallest subtree holding both
+    // keys, not on the height of the tree. Keys d apart mostly share a
+    // subtree of height about log d. Only neighbours on either side of a
+    // high node need a high climb. For ascending keys, as in a scan by
+    // id or time, each search costs O(1) amortized.
+    //
+    // Like tree_iterator it keeps the path in a fixed array, throwing
+    // std::length_error on a deeper bs_tree, and points into the tree
+    // handle it was made from. It searches that version and is valid
+    // while the handle is.
+    template <typename Tree>
+    struct tree_finger
+    {
+      typedef typename Tree::key_value_type key_value_type;
+      typedef typename Tree::key_compare key_compare;
+      typedef typename Tree::link link;
+
+      static std::size_t const max_depth = 2 * 8 * sizeof(std::size_t);
+
+      // at the root of t
+      explicit tree_finger(Tree const& t) : root(&t), depth(0) {}
+
+      key_value_type const* find(key_value_type const& kv) { return find_key(kv); }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      key_value_type const* find(Key const& key) { return find_key(key); }
+
+    private:
+      // Subtree path[i] holds the keys strictly between *lo[i] and *hi[i],
+      // a null bound being open. The key is compared with where the last
+      // search ended first: if after it, it is after every lower bound on
+      // the path and only upper bounds are checked on the way up, each
+      // distinct one once; the other way round if before. The descent
+      // then compares once per level, as rb_tree::find does.
+      template <typename Key>
+      key_value_type const* find_key(Key const& key)
+      {
+        if (depth == 0) {
+          if (root->empty()) {
+            return 0;
+          }
+          push(&root->root_link(), 0, 0);
+        }
+
+        int order = root->key_order(key, path[depth - 1]->keyval());
+        if (order != 0) {
+          key_value_type const* const* const bound = order < 0 ? lo : hi;
+          key_value_type const* outside = 0;
+          std::size_t d = depth;
+          while (d > 1 && bound[d - 1]) {
+            if (bound[d - 1] != outside) {
+              if (order < 0 ? root->key_less(*bound[d - 1], key) : root->key_less(key, *bound[d - 1])) {
+                break;
+              }
+              outside = bound[d - 1];
+            }
+            --d;
+          }
+          if (d < depth) {
+            depth = d;
+            order = root->key_order(key, path[depth - 1]->keyval());
+          }
+        }
+
+        for (;;) {
+          link const& t = *path[depth - 1];
+          if (order == 0) {
+            return &t.keyval();
+          }
+
+          link const& child = order < 0 ? t.left() : t.right();
+          if (child.empty()) {
+            return 0;
+          }
+          push(&child, order < 0 ? lo[depth - 1] : &t.keyval(), order < 0 ? &t.keyval() : hi[depth - 1]);
+          order = root->key_order(key, child.keyval());
+        }
+      }
+
+      void push(link const* t, key_value_type const* low, key_value_type const* high)
+      {
+        if (depth == max_depth) {
+          throw std::length_error("tree_finger: tree too deep");
+        }
+        path[depth] = t;
+        lo[depth] = low;
+        hi[depth] = high;
+        ++depth;
+      }
+
+      Tree const* root;
+      std::size_t depth;
+      link const* path[max_depth];
+      key_value_type const* lo[max_depth];
+      key_value_type const* hi[max_depth];
+    };
+
+    template <typename Tree> std::size_t const tree_finger<Tree>::max_depth;
+  }
+}
+
+#endif // PST_FINGER_H__
@@ -0,0 +1,271 @@
+#pragma once
+
+#ifndef PST_INTERVAL_MAP_H__
+#define PST_INTERVAL_MAP_H__
+
+#include "tree.h"
+#include "detail.h"
+#include <cassert>
+#include <functional>
+#include <initializer_list>
+#include <type_traits>
+#include <utility> // pair
+#include <vector>
+
+namespace pst
+{
+  namespace detail
+  {
+    // Orders entries by start, then end, of their interval. It also
+    // compares a bare interval against an entry, so that lookups need not
+    // build an entry (see rb_interval_map::find).
+    template <typename Compare>
+    struct interval_less : private ebo_holder<Compare>
+    {
+      typedef void is_transparent;
+
+      interval_less() {}
+      explicit interval_less(Compare less) : ebo_holder<Compare>(std::move(less)) {}
+
+      Compare const& point_less() const { return this->get(); }
+
+      template <typename IntervalT, typename ValT>
+      bool operator()(std::pair<IntervalT, ValT> const& lhs, std::pair<IntervalT, ValT> const& rhs) const {
+        return less(lhs.first, rhs.first);
+      }
+
+      template <typename Point, typename ValT>
+      bool operator()(std::pair<Point, Point> const& lhs, std::pair<std::pair<Point, Point>, ValT> const& rhs) const {
+        return less(lhs, rhs.first);
+      }
+
+      template <typename Point, typename ValT>
+      bool operator()(std::pair<std::pair<Point, Point>, ValT> const& lhs, std::pair<Point, Point> const& rhs) const {
+        return less(lhs.first, rhs);
+      }
+
+      template <typename IntervalT, typename ValT>
+      int compare(std::pair<IntervalT, ValT> const& lhs, std::pair<IntervalT, ValT> const& rhs) const {
+        return order(lhs.first, rhs.first);
+      }
+
+      template <typename Point, typename ValT>
+      int compare(std::pair<Point, Point> const& lhs, std::pair<std::pair<Point, Point>, ValT> const& rhs) const {
+        return order(lhs, rhs.first);
+      }
+
+    private:
+      template <typename IntervalT>
+      bool less(IntervalT const& lhs, IntervalT const& rhs) const
+      {
+        Compare const& less = point_less();
+        return less(lhs.first, rhs.first) || (!less(rhs.first, lhs.first) && less(lhs.second, rhs.second));
+      }
+
+      template <typename IntervalT>
+      int order(IntervalT const& lhs, IntervalT const& rhs) const
+      {
+        Compare const& less = point_less();
+        int const by_start = compare3(less, lhs.first, rhs.first);
+        return by_start ? by_start : compare3(less, lhs.second, rhs.second);
+      }
+    };
+
+    // the greatest end of the intervals in a subtree, none when it is empty
+    template <typename Point>
+    struct max_end
+    {
+      max_end() : any(false), end() {}
+      explicit max_end(Point end) : any(true), end(std::move(end)) {}
+
+      bool any;
+      Point end;
+    };
+
+    // Augments have no comparator at hand, so this one makes its own;
+    // that only orders the ends as the map does when Compare is empty.
+    template <typename Point, typename Compare>
+    struct max_end_augment
+    {
+      static_assert(std::is_empty<Compare>::value, "max_end_augment needs a Compare without state");
+
+      typedef max_end<Point> summary_type;
+
+      static summary_type identity() { return summary_type(); }
+
+      template <typename T>
+      static summary_type summarize(summary_type const& left, T const& kv, summary_type const& right)
+      {
+        Compare const less = Compare();
+        Point const* end = &kv.first.second;
+        if (left.any && less(*end, left.end)) {
+          end = &left.end;
+        }
+        if (right.any && less(*end, right.end)) {
+          end = &right.end;
+        }
+        return summary_type(*end);
+      }
+    };
+  }
+
+  namespace interval
+  {
+    // A persistent map from half-open intervals [start, end) to values,
+    // an rb_tree ordered by start that keeps the greatest end in each
+    // subtree. That bounds the search for overlaps: a subtree whose
+    // greatest end is at or before the query is skipped, as is everything
+    // right of a node starting at or after it. Each entry reported can
+    // still cost a descent of its own, so reporting k entries takes
+    // O(min(n, (k + 1) log n)), not the O(log n + k) of a centered
+    // interval tree. Intervals are distinct keys even when they overlap;
+    // inserting one that is there replaces its value.
+    //
+    // Compare must be an empty class, as the greatest ends are kept
+    // without a comparator at hand (see max_end_augment).
+    template <typename Point,
+              typename ValT,
+              typename Compare = std::less<Point>,
+              typename Alloc = std::allocator<ValT>,
+              typename RefCount = atomic_refcount,
+              typename Storage = inline_payload>
+    struct rb_interval_map
+    {
+      typedef Point point_type;
+      typedef std::pair<point_type, point_type> interval_type; // [first, second)
+      typedef ValT mapped_type;
+      typedef std::pair<interval_type, mapped_type> value_type;
+      typedef pst::tree::rb_tree<value_type,
+                                 detail::interval_less<Compare>,
+                                 Alloc,
+                                 RefCount,
+                                 Storage,
+                                 detail::max_end_augment<point_type, Compare>> rb_tree_type;
+
+      rb_interval_map() {}
+      rb_interval_map(rb_tree_type t) : tree(std::move(t)) {}
+
+      static rb_interval_map empty_map() { return rb_interval_map(); }
+
+      static rb_interval_map from(std::initializer_list<value_type> lst) {
+        return from(begin(lst), end(lst));
+      }
+
+      template <typename It>
+      static rb_interval_map from(It begin, It end) {
+        rb_interval_map m;
+        for (; begin != end; ++begin) {
+          m = m.insert(begin->first.first, begin->first.second, begin->second);
+        }
+        return m;
+      }
+
+      bool empty() const { return tree.empty(); }
+      std::size_t size() const { return tree.size(); }
+
+      rb_interval_map insert(point_type start, point_type end, mapped_type v) const
+      {
+        assert(point_less()(start, end));
+        return tree.insert(value_type(interval_type(std::move(start), std::move(end)), std::move(v)));
+      }
+
+      // the entry for exactly [start, end), if any
+      value_type const* find(point_type const& start, point_type const& end) const {
+        return tree.find(interval_type(start, end));
+      }
+
+      rb_interval_map erase(point_type const& start, point_type const& end) const {
+        return tree.erase(interval_type(start, end));
+      }
+
+      // Calls f with each entry whose interval meets [lo, hi), in order of
+      // start.
+      template <typename F>
+      void for_each_overlapping(point_type const& lo, point_type const& hi, F f) const
+      {
+        Compare const& less = point_less();
+        if (less(lo, hi)) {
+          visit(tree, less, lo, [&less, &hi](point_type const& start) { return less(start, hi); }, f);
+        }
+      }
+
+      // Calls f with each entry whose interval holds p, in order of start.
+      template <typename F>
+      void for_each_containing(point_type const& p, F f) const
+      {
+        Compare const& less = point_less();
+        visit(tree, less, p, [&less, &p](point_type const& start) { return !less(p, start); }, f);
+      }
+
+      // The same, collected; the entries live as long as the map.
+      std::vector<value_type const*> overlapping(point_type const& lo, point_type const& hi) const
+      {
+        std::vector<value_type const*> found;
+        for_each_overlapping(lo, hi, [&found](value_type const& kv) { found.push_back(&kv); });
+        return found;
+      }
+
+      std::vector<value_type const*> containing(point_type const& p) const
+      {
+        std::vector<value_type const*> found;
+        for_each_containing(p, [&found](value_type const& kv) { found.push_back(&kv); });
+        return found;
+      }
+
+      // Batch updates in place, see rb_tree::transient.
+      class transient
+      {
+      public:
+        explicit transient(rb_interval_map const& m = rb_interval_map()) : tree(m.tree) {}
+
+        bool empty() const { return tree.empty(); }
+
+        value_type const* find(point_type const& start, point_type const& end) const {
+          return tree.find(interval_type(start, end));
+        }
+
+        void insert(point_type start, point_type end, mapped_type v)
+        {
+          assert(tree.key_comp().point_less()(start, end));
+          tree.insert(value_type(interval_type(std::move(start), std::move(end)), std::move(v)));
+        }
+
+        void erase(point_type const& start, point_type const& end) {
+          tree.erase(interval_type(start, end));
+        }
+
+        rb_interval_map persistent() const { return tree.persistent(); }
+
+      private:
+        typename rb_tree_type::transient tree;
+      };
+
+    private:
+      Compare const& point_less() const { return tree.key_comp().point_less(); }
+
+      // Reports, in order, the entries of t ending after lo whose start
+      // passes starts_before; that test holds for a prefix of the starts.
+      template <typename StartsBefore, typename F>
+      static void visit(typename rb_tree_type::subtree const& t, Compare const& less, point_type const& lo, StartsBefore const& starts_before, F& f)
+      {
+        if (t.empty() || !less(lo, t.summary().end)) {
+          return;
+        }
+
+        visit(t.left(), less, lo, starts_before, f);
+
+        value_type const& kv = t.keyval();
+        if (starts_before(kv.first.first)) {
+          if (less(lo, kv.first.second)) {
+            f(kv);
+          }
+          visit(t.right(), less, lo, starts_before, f);
+        }
+      }
+
+      rb_tree_type tree;
+    };
+  }
+}
+
+#endif // PST_INTERVAL_MAP_H__
@@ -1,94 +1,142 @@
-#pragma once
-
-#ifndef PST_LIST_H__
-#define PST_LIST_H__
-
-#include <memory>
-
-namespace pst
-{
-  namespace list
-  {
-    template <typename T, typename Alloc = std::allocator<T> >
-    struct slist
-    {
-      typedef T value_type;
-      typedef Alloc allocator_type;
-
-      slist(slist&& other) : impl(std::move(other.impl)) {}
-      slist(slist const& other) : impl(other.impl) {}
-
-      slist(T val, slist const& tail)
-        : impl(std::allocate_shared<impl_t>(impl_allocator(), std::move(val), std::move(tail)))
-      {}
-
-      slist& operator=(slist other) {
-        swap(other);
-        return *this;
-      }
-
-      void swap(slist& other) {
-        using std::swap;
-        swap(impl, other.impl);            
-      }
-
-      friend void swap(slist& lhs, slist& rhs) {
-        lhs.swap(rhs);
-      }
-
-      friend T const& car(slist const& lst) { return lst.impl->val; }
-      friend slist cdr(slist const& lst) { return lst.impl->tail; }
-      friend bool empty(slist const& lst) { return !lst.impl; }
-
-      static slist empty_slist() { return slist(); }
-
-    private:
-      slist() {}
-
-      struct impl_t
-      {
-        impl_t(T val, slist const tail)
-          : val(std::move(val)),
-            tail(std::move(tail))
-        {}
-
-        T const val;
-        slist const tail;
-
-      private:
-        impl_t(impl_t const&);
-        impl_t& operator=(impl_t const&);
-      };
-
-      typedef typename allocator_type::template rebind<impl_t>::other impl_allocator;
-
-      std::shared_ptr<impl_t const> impl;
-    };
-
-    template <typename T> slist<T> empty_slist() { return slist<T>::empty_slist(); }
-
-    template <typename T, typename U>
-    slist<U> cons(T&& value, slist<U> tail = empty_slist<U>()) {
-      return slist<U>(std::forward<T>(value), std::move(tail));
-    }
-
-    template <typename T> slist<T> append(slist<T> const& llst, slist<T> const& rlst) {
-      return empty(llst) ? rlst : cons(car(llst), append(cdr(llst), rlst));
-    }
-
-    template <typename T>
-    slist<T> update(slist<T> const& lst, std::size_t index, T&& new_value) {
-      return index == 0 ?
-        cons(std::forward<T>(new_value), cdr(lst)) :
-        cons(car(lst), update(cdr(lst), index - 1, std::forward<T>(new_value)));
-    }
-
-    template <typename T>
-    slist<slist<T> > suffixes(slist<T> const& lst) {
-      return empty(lst) ? cons(lst, empty_slist<slist<T>>()) : cons(lst, suffixes(cdr(lst)));
-    }
-  }
-}
-
-#endif // PST_LIST_H__
-
+#pragma once
+
+#ifndef PST_LIST_H__
+#define PST_LIST_H__
+
+#include <memory>
+#include <cstddef>
+#include "refcount.h"
+
+namespace pst
+{
+  namespace list
+  {
+    template <typename T, typename Alloc = std::allocator<T>, typename RefCount = atomic_refcount>
+    struct slist
+    {
+      typedef T value_type;
+      typedef Alloc allocator_type;
+      typedef RefCount refcount_policy;
+
+      slist(slist&& other) : impl(other.impl) { other.impl = 0; }
+      slist(slist const& other) : impl(other.impl) { retain(); }
+
+      slist(T val, slist const& tail)
+        : impl(make_impl(std::move(val), tail))
+      {}
+
+      ~slist() { release(); }
+
+      slist& operator=(slist other) {
+        swap(other);
+        return *this;
+      }
+
+      void swap(slist& other) {
+        using std::swap;
+        swap(impl, other.impl);            
+      }
+
+      friend void swap(slist& lhs, slist& rhs) {
+        lhs.swap(rhs);
+      }
+
+      friend T const& car(slist const& lst) { return lst.impl->val; }
+      friend slist cdr(slist const& lst) { return lst.impl->tail; }
+      friend bool empty(slist const& lst) { return !lst.impl; }
+
+      static slist empty_slist() { return slist(); }
+
+    private:
+      slist() : impl(0) {}
+
+      struct impl_t
+      {
+        impl_t(T val, slist const& tail)
+          : refs(1),
+            val(std::move(val)),
+            tail(tail)
+        {}
+
+        mutable typename refcount_policy::count_type refs;
+        T const val;
+        slist tail;
+
+      private:
+        impl_t(impl_t const&);
+        impl_t& operator=(impl_t const&);
+      };
+
+      typedef typename allocator_type::template rebind<impl_t>::other impl_allocator;
+      typedef std::allocator_traits<impl_allocator> impl_allocator_traits;
+
+      static impl_t const* make_impl(T&& val, slist const& tail)
+      {
+        impl_allocator alloc;
+        impl_t* p = impl_allocator_traits::allocate(alloc, 1);
+        try {
+          impl_allocator_traits::construct(alloc, p, std::move(val), tail);
+        }
+        catch (...) {
+          impl_allocator_traits::deallocate(alloc, p, 1);
+          throw;
+        }
+        return p;
+      }
+
+      void retain() const
+      {
+        if (impl) {
+          refcount_policy::increment(impl->refs);
+        }
+      }
+
+      // Unlinks the tail before destroying a node, so dropping a long list
+      // does not recurse once per element.
+      void release()
+      {
+        impl_t* p = const_cast<impl_t*>(impl);
+        impl = 0;
+        while (p && refcount_policy::decrement(p->refs)) {
+          impl_t* next = const_cast<impl_t*>(p->tail.impl);
+          p->tail.impl = 0;
+
+          impl_allocator alloc;
+          impl_allocator_traits::destroy(alloc, p);
+          impl_allocator_traits::deallocate(alloc, p, 1);
+          p = next;
+        }
+      }
+
+      impl_t const* impl;
+    };
+
+    template <typename T, typename A = std::allocator<T>, typename R = atomic_refcount>
+    slist<T, A, R> empty_slist() { return slist<T, A, R>::empty_slist(); }
+
+    template <typename T, typename U, typename A = std::allocator<U>, typename R = atomic_refcount>
+    slist<U, A, R> cons(T&& value, slist<U, A, R> tail = empty_slist<U, A, R>()) {
+      return slist<U, A, R>(std::forward<T>(value), std::move(tail));
+    }
+
+    template <typename T, typename A, typename R>
+    slist<T, A, R> append(slist<T, A, R> const& llst, slist<T, A, R> const& rlst) {
+      return empty(llst) ? rlst : cons(car(llst), append(cdr(llst), rlst));
+    }
+
+    template <typename T, typename A, typename R>
+    slist<T, A, R> update(slist<T, A, R> const& lst, std::size_t index, T&& new_value) {
+      return index == 0 ?
+        cons(std::forward<T>(new_value), cdr(lst)) :
+        cons(car(lst), update(cdr(lst), index - 1, std::forward<T>(new_value)));
+    }
+
+    template <typename T, typename A, typename R>
+    slist<slist<T, A, R> > suffixes(slist<T, A, R> const& lst) {
+      return empty(lst) ? cons(lst, empty_slist<slist<T, A, R> >()) : cons(lst, suffixes(cdr(lst)));
+    }
+  }
+}
+
+#endif // PST_LIST_H__
+
@@ -1,84 +1,380 @@
-#pragma once
-
-#ifndef PST_MAP_H__
-#define PST_MAP_H__
-
-#include "tree.h"
-#include "detail.h"
-#include <functional>
-#include <initializer_list>
-
-namespace pst
-{
-  namespace map
-  {
-    template <typename KeyT, typename ValT, typename Compare = std::less<KeyT>, typename Alloc = std::allocator<ValT> >
-    struct rb_map
-    {
-      typedef KeyT key_type;
-      typedef ValT mapped_type;
-      typedef std::pair<key_type, mapped_type> value_type;
-      typedef pst::tree::rb_tree<value_type,
-                                 detail::pair_first_less<Compare>,
-                                 Alloc> rb_tree_type;
-
-      rb_map() {}
-      rb_map(rb_tree_type t) : tree(std::move(t)) {}
-
-      static rb_map empty_map() { return rb_map(); }
-
-      static rb_map from(std::initializer_list<value_type> lst) {
-        return from(begin(lst), end(lst));
-      }
-
-      template <typename It>
-      static rb_map from(It begin, It end) {
-        return empty_map().insert(std::move(begin), std::move(end));
-      }
-
-      bool empty() const { return tree.empty(); }
-
-      rb_map insert(key_type k, mapped_type v) const {
-        return tree.insert(std::make_pair(std::move(k), std::move(v)));
-      }
-
-      template <typename It>
-      rb_map insert(It begin, It end) const
-      {
-        rb_map temp = *this;
-
-        while (begin != end) {
-          temp = temp.insert(begin->first, begin->second);
-          ++begin;
-        }
-
-        return temp;
-      }
-
-      template <typename It>
-      rb_map erase(It begin, It end) const
-      {
-        rb_map temp = *this;
-
-        while (begin != end) {
-          temp = temp.erase(*begin++);
-        }
-
-        return temp;
-      }
-
-      value_type const* find(key_type const& key) const {
-        return tree.find(std::make_pair(key, mapped_type()));
-      }
-
-      rb_map erase(key_type const& k) const {
-        return tree.erase(std::make_pair(k, mapped_type()));
-      }
-
-    private:
-      rb_tree_type tree;
-    };
-  }
-}
-
-#endif // PST_MAP_H__
+#pragma once
+
+#ifndef PST_MAP_H__
+#define PST_MAP_H__
+
+#include "tree.h"
+#include "detail.h"
+#include <algorithm> // sort
+#include <functional>
+#include <initializer_list>
+#include <vector>
+
+namespace pst
+{
+  namespace map
+  {
+    template <typename KeyT,
+              typename ValT,
+              typename Compare = std::less<KeyT>,
+              typename Alloc = std::allocator<ValT>,
+              typename RefCount = atomic_refcount,
+              typename Storage = inline_payload,
+              typename Augment = no_augment>
+    struct rb_map
+    {
+      typedef KeyT key_type;
+      typedef ValT mapped_type;
+      typedef std::pair<key_type, mapped_type> value_type;
+      typedef pst::tree::rb_tree<value_type,
+                                 detail::pair_first_less<Compare>,
+                                 Alloc,
+                                 RefCount,
+                                 Storage,
+                                 Augment> rb_tree_type;
+      typedef typename rb_tree_type::summary_type summary_type;
+      typedef typename rb_tree_type::iterator iterator;
+      typedef typename rb_tree_type::const_iterator const_iterator;
+      typedef typename rb_tree_type::reverse_iterator reverse_iterator;
+
+      rb_map() {}
+      rb_map(rb_tree_type t) : tree(std::move(t)) {}
+      explicit rb_map(Compare const& comp, Alloc const& alloc = Alloc())
+        : tree(detail::pair_first_less<Compare>(comp), alloc)
+      {}
+
+      static rb_map empty_map() { return rb_map(); }
+      static rb_map empty_map(Compare const& comp, Alloc const& alloc = Alloc()) { return rb_map(comp, alloc); }
+
+      static rb_map from(std::initializer_list<value_type> lst) {
+        return from(lst.begin(), lst.end());
+      }
+
+      template <typename It>
+      static rb_map from(It begin, It end) {
+        return empty_map().insert(std::move(begin), std::move(end));
+      }
+
+      template <typename It>
+      static rb_map from(It begin, It end, Compare const& comp, Alloc const& alloc = Alloc()) {
+        return empty_map(comp, alloc).insert(std::move(begin), std::move(end));
+      }
+
+      // linear time, see rb_tree::from_sorted
+      template <typename It>
+      static rb_map from_sorted(It begin, It end, Compare const& comp = Compare(), Alloc const& alloc = Alloc()) {
+        return rb_tree_type::from_sorted(std::move(begin), std::move(end), detail::pair_first_less<Compare>(comp), alloc);
+      }
+
+      // sorts, deduplicates and builds on several threads, see
+      // rb_tree::from_unsorted_parallel; of equal keys the last one wins
+      static rb_map from_parallel(std::vector<value_type> values, unsigned threads = parallel::default_threads(),
+                                  Compare const& comp = Compare(), Alloc const& alloc = Alloc()) {
+        static_assert(rb_tree_type::parallel_safe::value, "from_parallel needs atomic_refcount and an allocator safe to share between threads");
+        return rb_tree_type::from_unsorted_parallel(std::move(values), threads, detail::pair_first_less<Compare>(comp), alloc);
+      }
+
+      Compare const& key_comp() const { return tree.key_comp().first_less(); }
+      Alloc get_allocator() const { return tree.get_allocator(); }
+
+      bool empty() const { return tree.empty(); }
+
+      // O(1) with size_augment; rank, select and count_range need it, see
+      // rb_tree::rank
+      std::size_t size() const { return tree.size(); }
+
+      std::size_t rank(key_type const& k) const {
+        return tree.rank(k);
+      }
+
+      value_type const* select(std::size_t i) const { return tree.select(i); }
+
+      std::size_t count_range(key_type const& lo, key_type const& hi) const {
+        return tree.count_range(lo, hi);
+      }
+
+      // The fold of the entries with keys in [lo, hi) in O(log n), see
+      // rb_tree::aggregate. With monoid_augment<Monoid, mapped_value> it
+      // sums, or takes the least or greatest of, the mapped values:
+      //
+      //   rb_map<time, int, ..., monoid_augment<max_monoid<int>, mapped_value>>
+      //   peak = m.aggregate(from, to);
+      summary_type aggregate(key_type const& lo, key_type const& hi) const {
+        return tree.aggregate(lo, hi);
+      }
+
+      // the summary of all of it, see augment.h
+      summary_type const& summary() const { return tree.summary(); }
+
+      // The changes from *this to a later version, in key order, skipping
+      // the subtrees the two share; see rb_tree::for_each_difference. f
+      // gets the entry before and after: null before for an added key,
+      // null after for an erased one, both for a changed value.
+      template <typename F>
+      void for_each_difference(rb_map const& to, F f) const {
+        rb_tree_type::for_each_difference(tree, to.tree, std::move(f));
+      }
+
+      // By content, see rb_tree::equal_content; with hash_augment unequal
+      // contents mostly differ by hash and are told apart in O(1).
+      friend bool operator==(rb_map const& lhs, rb_map const& rhs) {
+        return rb_tree_type::equal_content(lhs.tree, rhs.tree);
+      }
+
+      friend bool operator!=(rb_map const& lhs, rb_map const& rhs) {
+        return !(lhs == rhs);
+      }
+
+      rb_map insert(key_type k, mapped_type v) const {
+        return tree.insert(std::make_pair(std::move(k), std::move(v)));
+      }
+
+      // Batch updates in place, see rb_tree::transient.
+      class transient
+      {
+      public:
+        explicit transient(rb_map const& m = rb_map()) : tree(m.tree) {}
+
+        bool empty() const { return tree.empty(); }
+
+        value_type const* find(key_type const& key) const {
+          return tree.find(key);
+        }
+
+        template <typename K, typename C = Compare, typename = typename C::is_transparent>
+        value_type const* find(K const& key) const {
+          return tree.find(key);
+        }
+
+        void insert(key_type k, mapped_type v) {
+          tree.insert(std::make_pair(std::move(k), std::move(v)));
+        }
+
+        void erase(key_type const& k) {
+          tree.erase(k);
+        }
+
+        template <typename K, typename C = Compare, typename = typename C::is_transparent>
+        void erase(K const& k) {
+          tree.erase(k);
+        }
+
+        rb_map persistent() const { return tree.persistent(); }
+
+      private:
+        typename rb_tree_type::transient tree;
+      };
+
+      // Many edits close together, see rb_tree::zipper: the path above
+      // them is rebuilt once, by close(), rather than per edit.
+      class zipper
+      {
+      public:
+        explicit zipper(rb_map const& m) : z(m.tree) {}
+        zipper(rb_map const& m, key_type const& near) : z(m.tree, near) {}
+
+        value_type const* find(key_type const& key) const { return z.find(key); }
+
+        void insert(key_type k, mapped_type v) {
+          z.insert(std::make_pair(std::move(k), std::move(v)));
+        }
+
+        void erase(key_type const& k) { z.erase(k); }
+
+        rb_map close() { return z.close(); }
+
+      private:
+        typename rb_tree_type::zipper z;
+      };
+
+      // Lookups near the previous one, in O(log d) for keys about d
+      // apart, as for a burst of ids or times; see tree_finger. Valid
+      // while the map is.
+      class finger
+      {
+      public:
+        explicit finger(rb_map const& m) : f(m.tree) {}
+
+        value_type const* find(key_type const& key) { return f.find(key); }
+
+        template <typename K, typename C = Compare, typename = typename C::is_transparent>
+        value_type const* find(K const& key) { return f.find(key); }
+
+      private:
+        typename rb_tree_type::finger f;
+      };
+
+      // Builds a map from entries pushed in strictly ascending key order,
+      // one pass and O(log n) memory besides the map, see
+      // rb_tree::sorted_loader.
+      class sorted_loader
+      {
+      public:
+        explicit sorted_loader(Compare const& comp = Compare(), Alloc const& alloc = Alloc())
+          : loader(rb_tree_type(detail::pair_first_less<Compare>(comp), alloc))
+        {}
+
+        void push_back(key_type k, mapped_type v) {
+          loader.push_back(std::make_pair(std::move(k), std::move(v)));
+        }
+
+        rb_map finish() { return loader.finish(); }
+
+      private:
+        typename rb_tree_type::sorted_loader loader;
+      };
+
+      // batch updates, see rb_tree::insert_batch; of equal keys the last
+      // one wins
+      template <typename It>
+      rb_map insert(It begin, It end) const
+      {
+        std::vector<value_type> batch;
+        for (; begin != end; ++begin) {
+          batch.push_back(value_type(begin->first, begin->second));
+        }
+        return tree.insert_batch(std::move(batch));
+      }
+
+      // erases the keys in [begin, end), sorted by key and pushed down the
+      // tree together as in rb_tree::erase_batch; no entry is built
+      template <typename It>
+      rb_map erase(It begin, It end) const
+      {
+        std::vector<key_type> keys(begin, end);
+        std::sort(keys.begin(), keys.end(), key_comp());
+        return tree.erase_sorted_keys(keys);
+      }
+
+      // Lookups compare the key alone, no entry is built. With a
+      // transparent Compare, such as std::less<>, they also take anything
+      // it compares with keys, a string literal for std::string keys.
+      value_type const* find(key_type const& key) const {
+        return tree.find(key);
+      }
+
+      template <typename K, typename C = Compare, typename = typename C::is_transparent>
+      value_type const* find(K const& key) const {
+        return tree.find(key);
+      }
+
+      rb_map erase(key_type const& k) const {
+        return tree.erase(k);
+      }
+
+      template <typename K, typename C = Compare, typename = typename C::is_transparent>
+      rb_map erase(K const& k) const {
+        return tree.erase(k);
+      }
+
+      // In key order without allocating or copying entries, for
+      // range-for; the iterators are valid while the map is. for_each is
+      // the fastest full scan.
+      iterator begin() const { return tree.begin(); }
+      iterator end() const { return tree.end(); }
+      reverse_iterator rbegin() const { return tree.rbegin(); }
+      reverse_iterator rend() const { return tree.rend(); }
+
+      template <typename F>
+      void for_each(F f) const { tree.for_each(std::move(f)); }
+
+      // Ordered lookups in O(log n), see rb_tree::lower_bound: the latest
+      // price at or before t is
+      //
+      //   auto p = prices.floor(t);
+      //   if (p != prices.end()) ... p->second
+      iterator lower_bound(key_type const& k) const { return tree.lower_bound(k); }
+      iterator upper_bound(key_type const& k) const { return tree.upper_bound(k); }
+      iterator floor(key_type const& k) const { return tree.floor(k); }
+      iterator ceiling(key_type const& k) const { return tree.ceiling(k); }
+      std::pair<iterator, iterator> equal_range(key_type const& k) const { return tree.equal_range(k); }
+
+      template <typename K, typename C = Compare, typename = typename C::is_transparent>
+      iterator lower_bound(K const& k) const { return tree.lower_bound(k); }
+
+      template <typename K, typename C = Compare, typename = typename C::is_transparent>
+      iterator upper_bound(K const& k) const { return tree.upper_bound(k); }
+
+      template <typename K, typename C = Compare, typename = typename C::is_transparent>
+      iterator floor(K const& k) const { return tree.floor(k); }
+
+      template <typename K, typename C = Compare, typename = typename C::is_transparent>
+      iterator ceiling(K const& k) const { return tree.ceiling(k); }
+
+      template <typename K, typename C = Compare, typename = typename C::is_transparent>
+      std::pair<iterator, iterator> equal_range(K const& k) const { return tree.equal_range(k); }
+
+      // Takes out the entries with keys in [lo, hi) in O(log n), see
+      // rb_tree::extract_range; extract_range also returns them.
+      rb_map erase_range(key_type const& lo, key_type const& hi) const {
+        return tree.erase_range(lo, hi);
+      }
+
+      std::pair<rb_map, rb_map> extract_range(key_type const& lo, key_type const& hi) const
+      {
+        auto const parts = tree.extract_range(lo, hi);
+        return std::make_pair(rb_map(parts.first), rb_map(parts.second));
+      }
+
+      // The entries of both maps; for a key in both, combine(mine, theirs)
+      // gives the value. O(m log(n/m + 1)) for sizes m <= n, see
+      // rb_tree::set_union.
+      template <typename Combine>
+      rb_map merge_with(rb_map const& other, Combine combine) const
+      {
+        return rb_tree_type::set_union(tree, other.tree, [&combine](value_type const& mine, value_type const& theirs) {
+          return value_type(mine.first, combine(mine.second, theirs.second));
+        });
+      }
+
+      // merge_with on the threads of pool, see rb_tree::set_union_parallel;
+      // combine may be called from several threads at once.
+      template <typename Combine>
+      rb_map merge_with(rb_map const& other, Combine combine, parallel::work_stealing_pool& pool, std::size_t grain = parallel::default_grain) const
+      {
+        static_assert(rb_tree_type::parallel_safe::value, "merge_with needs atomic_refcount and an allocator safe to share between threads");
+        return rb_tree_type::set_union_parallel(tree, other.tree, [&combine](value_type const& mine, value_type const& theirs) {
+          return value_type(mine.first, combine(mine.second, theirs.second));
+        }, pool, grain);
+      }
+
+      // Batch updates on the threads of pool: the batch is sorted and
+      // built into a tree, then united with or taken from this one. Of
+      // equal keys in values the last one wins.
+      rb_map insert_parallel(std::vector<value_type> values, parallel::work_stealing_pool& pool, std::size_t grain = parallel::default_grain) const {
+        static_assert(rb_tree_type::parallel_safe::value, "insert_parallel needs atomic_refcount and an allocator safe to share between threads");
+        return rb_tree_type::set_union_parallel(batch(std::move(values), pool), tree, pool, grain);
+      }
+
+      // the keys are sorted and pushed down the tree, see
+      // rb_tree::erase_sorted_keys_parallel
+      rb_map erase_parallel(std::vector<key_type> keys, parallel::work_stealing_pool& pool, std::size_t grain = parallel::default_grain) const
+      {
+        static_assert(rb_tree_type::parallel_safe::value, "erase_parallel needs atomic_refcount and an allocator safe to share between threads");
+        parallel::stable_sort(keys.begin(), keys.end(), key_comp(), pool.size());
+        return tree.erase_sorted_keys_parallel(keys, pool, grain);
+      }
+
+    private:
+      rb_tree_type batch(std::vector<value_type> values, parallel::work_stealing_pool& pool) const {
+        return rb_tree_type::from_unsorted_parallel(std::move(values), pool.size(), tree.key_comp(), tree.get_allocator());
+      }
+
+      rb_tree_type tree;
+    };
+  }
+}
+
+namespace std
+{
+  // O(1) from the content hash kept at the root
+  template <typename KeyT, typename ValT, typename Compare, typename Alloc, typename RefCount, typename Storage, typename Hash>
+  struct hash<pst::map::rb_map<KeyT, ValT, Compare, Alloc, RefCount, Storage, pst::hash_augment<Hash>>>
+  {
+    std::size_t operator()(pst::map::rb_map<KeyT, ValT, Compare, Alloc, RefCount, Storage, pst::hash_augment<Hash>> const& m) const {
+      return static_cast<std::size_t>(m.summary().value());
+    }
+  };
+}
+
+#endif // PST_MAP_H__
@@ -0,0 +1,424 @@
+#pragma once
+
+#ifndef PST_PARALLEL_H__
+#define PST_PARALLEL_H__
+
+#include <algorithm> // stable_sort, inplace_merge
+#include <atomic>
+#include <condition_variable>
+#include <cstddef> // size_t
+#include <deque>
+#include <exception> // exception_ptr
+#include <future> // async
+#include <memory> // unique_ptr
+#include <mutex>
+#include <thread> // hardware_concurrency
+#include <utility> // move
+#include <vector>
+
+namespace pst
+{
+  namespace parallel
+  {
+    // threads to use when the caller leaves it open
+    inline unsigned default_threads()
+    {
+      unsigned const n = std::thread::hardware_concurrency();
+      return n ? n : 1;
+    }
+
+    // Runs f and g, g on another thread when fork is true, and returns
+    // when both are done. Exceptions from either are passed on.
+    template <typename F, typename G>
+    void fork_join(bool fork, F&& f, G&& g)
+    {
+      if (!fork) {
+        f();
+        g();
+        return;
+      }
+
+      std::future<void> other = std::async(std::launch::async, std::forward<G>(g));
+      try {
+        f();
+      }
+      catch (...) {
+        other.wait();
+        throw;
+      }
+      other.get();
+    }
+
+    // elements below which the parallel tree operations stop forking
+    std::size_t const default_grain = 4096;
+
+    // A fixed set of worker threads for fork-join work. Each worker keeps
+    // a deque of forked tasks: it pushes and pops at the back, so it works
+    // depth first on its own tasks, and idle workers steal from the front
+    // of the others, where the oldest and so largest tasks are. A worker
+    // waiting for a stolen task runs other tasks meanwhile, so no worker
+    // blocks while there is work.
+    //
+    // fork_join may be called from any thread; called from outside the
+    // pool it hands the work to the pool and waits for it.
+    class work_stealing_pool
+    {
+    public:
+      explicit work_stealing_pool(unsigned threads = default_threads())
+        : stopping(false), queued(0), sleepers(0)
+      {
+        unsigned const n = threads ? threads : 1;
+
+        // one deque per worker, and one more for work from outside
+        for (unsigned i = 0; i <= n; ++i) {
+          deques.push_back(std::unique_ptr<deque_t>(new deque_t));
+        }
+
+        for (unsigned i = 0; i < n; ++i) {
+          workers.push_back(std::thread([this, i] { work(i); }));
+        }
+      }
+
+      ~work_stealing_pool()
+      {
+        {
+          std::lock_guard<std::mutex> lock(m);
+          stopping = true;
+        }
+        wake.notify_all();
+
+        for (auto& w : workers) {
+          w.join();
+        }
+      }
+
+      unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+      // Runs f and g, g possibly on another worker, and returns when both
+      // are done. Exceptions from either are passed on.
+      template <typename F, typename G>
+      void fork_join(F&& f, G&& g)
+      {
+        slot const self = current();
+        if (self.pool != this) {
+          run_outside([&] { fork_join(f, g); });
+          return;
+        }
+
+        task_for<G> forked(g);
+        push(self.index, &forked);
+
+        try {
+          f();
+        }
+        catch (...) {
+          if (!pop(self.index, &forked)) {
+            wait_for(self.index, forked);
+          }
+          throw;
+        }
+
+        if (pop(self.index, &forked)) {
+          g();
+          return;
+        }
+
+        wait_for(self.index, forked);
+        if (forked.error) {
+          std::rethrow_exception(forked.error);
+        }
+      }
+
+    private:
+      // how a thread outside the pool waits for its task
+      struct outside_wait
+      {
+        outside_wait() : finished(false) {}
+
+        std::mutex m;
+        std::condition_variable cv;
+        bool finished;
+      };
+
+      struct task
+      {
+        task() : done(false), waiter(0) {}
+
+        void execute()
+        {
+          try {
+            run();
+          }
+          catch (...) {
+            error = std::current_exception();
+          }
+
+          // the owner may destroy the task as soon as it sees done
+          outside_wait* const w = waiter;
+          done.store(true, std::memory_order_release);
+
+          if (w) {
+            std::lock_guard<std::mutex> lock(w->m);
+            w->finished = true;
+            w->cv.notify_one();
+          }
+        }
+
+        virtual void run() = 0;
+
+        std::atomic<bool> done;
+        std::exception_ptr error;
+        outside_wait* waiter;
+
+      protected:
+        ~task() {}
+      };
+
+      template <typename F>
+      struct task_for : task
+      {
+        explicit task_for(F& f) : f(f) {}
+        void run() { f(); }
+        F& f;
+      };
+
+      struct deque_t
+      {
+        std::mutex m;
+        std::deque<task*> tasks;
+      };
+
+      // the pool and worker the current thread belongs to, if any
+      struct slot
+      {
+        work_stealing_pool* pool;
+        std::size_t index;
+      };
+
+      static slot& current()
+      {
+        static thread_local slot s = { 0, 0 };
+        return s;
+      }
+
+      template <typename F>
+      void run_outside(F f)
+      {
+        outside_wait w;
+        task_for<F> t(f);
+        t.waiter = &w;
+        push(workers.size(), &t);
+
+        {
+          std::unique_lock<std::mutex> lock(w.m);
+          while (!w.finished) {
+            w.cv.wait(lock);
+          }
+        }
+
+        if (t.error) {
+          std::rethrow_exception(t.error);
+        }
+      }
+
+      void push(std::size_t index, task* t)
+      {
+        {
+          std::lock_guard<std::mutex> lock(deques[index]->m);
+          deques[index]->tasks.push_back(t);
+        }
+
+        // a worker going to sleep counts itself before it looks at queued,
+        // so one of the two sees the other
+        queued.fetch_add(1);
+        if (sleepers.load() > 0) {
+          std::lock_guard<std::mutex> lock(m);
+          wake.notify_one();
+        }
+      }
+
+      // takes t back from the back of the worker's own deque unless it has
+      // been stolen
+      bool pop(std::size_t index, task* t)
+      {
+        std::lock_guard<std::mutex> lock(deques[index]->m);
+        std::deque<task*>& tasks = deques[index]->tasks;
+        if (tasks.empty() || tasks.back() != t) {
+          return false;
+        }
+        tasks.pop_back();
+        queued.fetch_sub(1);
+        return true;
+      }
+
+      // the worker's own newest task, or the oldest of another's
+      task* find(std::size_t index)
+      {
+        {
+          std::lock_guard<std::mutex> lock(deques[index]->m);
+          std::deque<task*>& tasks = deques[index]->tasks;
+          if (!tasks.empty()) {
+            task* t = tasks.back();
+            tasks.pop_back();
+            queued.fetch_sub(1);
+            return t;
+          }
+        }
+
+        for (std::size_t i = 1; i < deques.size(); ++i) {
+          deque_t& victim = *deques[(index + i) % deques.size()];
+          std::lock_guard<std::mutex> lock(victim.m);
+          if (!victim.tasks.empty()) {
+            task* t = victim.tasks.front();
+            victim.tasks.pop_front();
+            queued.fetch_sub(1);
+            return t;
+          }
+        }
+
+        return 0;
+      }
+
+      // runs other tasks until t, stolen from this worker, is done
+      void wait_for(std::size_t index, task const& t)
+      {
+        while (!t.done.load(std::memory_order_acquire)) {
+          if (task* other = find(index)) {
+            other->execute();
+          }
+          else {
+            std::this_thread::yield();
+          }
+        }
+      }
+
+      void work(std::size_t index)
+      {
+        current().pool = this;
+        current().index = index;
+
+        for (;;) {
+          if (task* t = find(index)) {
+            t->execute();
+            continue;
+          }
+
+          std::unique_lock<std::mutex> lock(m);
+          sleepers.fetch_add(1);
+          while (!stopping && queued.load() == 0) {
+            wake.wait(lock);
+          }
+          sleepers.fetch_sub(1);
+
+          if (stopping) {
+            return;
+          }
+        }
+      }
+
+      work_stealing_pool(work_stealing_pool const&);
+      work_stealing_pool& operator=(work_stealing_pool const&);
+
+      std::vector<std::unique_ptr<deque_t> > deques;
+      std::vector<std::thread> workers;
+      std::mutex m;
+      std::condition_variable wake;
+      bool stopping;
+      std::atomic<std::size_t> queued;
+      std::atomic<std::size_t> sleepers;
+    };
+
+    // Sorts [begin, end) by less, keeping the original order of equivalent
+    // elements, on up to threads threads: the range is cut into one run
+    // per thread, the runs are sorted and then merged pairwise.
+    template <typename RandomIt, typename Less>
+    void stable_sort(RandomIt begin, RandomIt end, Less const& less, unsigned threads)
+    {
+      std::size_t const n = static_cast<std::size_t>(end - begin);
+      std::size_t runs = threads ? threads : 1;
+      if (runs > n / 1024 + 1) {
+        runs = n / 1024 + 1;
+      }
+
+      std::vector<RandomIt> bounds;
+      for (std::size_t i = 0; i <= runs; ++i) {
+        bounds.push_back(begin + static_cast<std::ptrdiff_t>(n * i / runs));
+      }
+
+      std::vector<std::future<void> > sorts;
+      for (std::size_t i = 1; i < runs; ++i) {
+        sorts.push_back(std::async(std::launch::async, [&bounds, &less, i] { std::stable_sort(bounds[i], bounds[i + 1], less); }));
+      }
+      std::stable_sort(bounds[0], bounds[1], less);
+      for (auto& s : sorts) {
+        s.get();
+      }
+
+      // merge neighbouring runs until one is left
+      for (std::size_t width = 1; width < runs; width *= 2) {
+        std::vector<std::future<void> > merges;
+        for (std::size_t i = 0; i + width < runs; i += 2 * width) {
+          RandomIt const lo = bounds[i];
+          RandomIt const mid = bounds[i + width];
+          RandomIt const hi = bounds[i + 2 * width < runs ? i + 2 * width : runs];
+          merges.push_back(std::async(std::launch::async, [lo, mid, hi, &less] { std::inplace_merge(lo, mid, hi, less); }));
+        }
+        for (auto& m : merges) {
+          m.get();
+        }
+      }
+    }
+
+    // Moves the last of each run of equivalent elements of sorted to a new
+    // vector: up to threads threads mark and count what they keep of
+    // their parts, then the kept elements are moved, in order, into
+    // storage reserved for them. T need only be move constructible.
+    template <typename T, typename Less>
+    std::vector<T> unique_last(std::vector<T>& sorted, Less const& less, unsigned threads)
+    {
+      std::size_t const n = sorted.size();
+      std::size_t parts = threads ? threads : 1;
+      if (parts > n / 1024 + 1) {
+        parts = n / 1024 + 1;
+      }
+
+      // sorted[i] is kept unless the next element is equivalent to it;
+      // decided for all elements before any is moved
+      std::vector<char> kept(n);
+      std::vector<std::size_t> counts(parts, 0);
+      {
+        std::vector<std::future<void> > marks;
+        for (std::size_t p = 0; p < parts; ++p) {
+          marks.push_back(std::async(std::launch::async, [&sorted, &less, &kept, &counts, n, parts, p] {
+            std::size_t c = 0;
+            for (std::size_t i = n * p / parts; i < n * (p + 1) / parts; ++i) {
+              kept[i] = i + 1 == n || less(sorted[i], sorted[i + 1]);
+              c += kept[i] ? 1 : 0;
+            }
+            counts[p] = c;
+          }));
+        }
+        for (auto& m : marks) {
+          m.get();
+        }
+      }
+
+      std::size_t total = 0;
+      for (std::size_t p = 0; p < parts; ++p) {
+        total += counts[p];
+      }
+
+      std::vector<T> result;
+      result.reserve(total);
+      for (std::size_t i = 0; i < n; ++i) {
+        if (kept[i]) {
+          result.push_back(std::move(sorted[i]));
+        }
+      }
+
+      return result;
+    }
+  }
+}
+
+#endif // PST_PARALLEL_H__
@@ -0,0 +1,120 @@
+#pragma once
+
+#ifndef PST_PAYLOAD_H__
+#define PST_PAYLOAD_H__
+
+#include <memory> // allocator_traits
+#include <utility> // move
+#include "detail.h"
+#include "refcount.h"
+
+namespace pst
+{
+  // Storage policies for the key/value held by a tree node.
+  //
+  // Path copying makes a new node for every node above a change. With
+  // inline_payload, the default, each of those nodes copies the key/value
+  // of the node it replaces. With shared_payload the key/value lives in a
+  // separately allocated, reference counted box, and the nodes of old and
+  // new versions point at the same box; an insert or erase then copies
+  // O(log n) pointers instead of O(log n) keys and values, at the cost of
+  // one more allocation per element and one more indirection per lookup.
+  //
+  // A policy provides holder<T, Alloc, RefCount>, movable and built from
+  // a T, with get() and share(), which makes another holder for the same
+  // key/value.
+
+  struct inline_payload
+  {
+    template <typename T, typename Alloc, typename RefCount>
+    struct holder
+    {
+      holder(T&& val, Alloc const&) : val(std::move(val)) {}
+      holder(holder&& other) : val(std::move(other.val)) {}
+
+      holder& operator=(holder&& other) {
+        val = std::move(other.val);
+        return *this;
+      }
+
+      T const& get() const { return val; }
+      holder share() const { return holder(T(val)); }
+
+    private:
+      explicit holder(T&& val) : val(std::move(val)) {}
+      holder(holder const&);
+      holder& operator=(holder const&);
+
+      T val;
+    };
+  };
+
+  struct shared_payload
+  {
+    template <typename T, typename Alloc, typename RefCount>
+    struct holder
+    {
+      holder(T&& val, Alloc const& alloc) : b(box::make(std::move(val), alloc)) {}
+      holder(holder&& other) : b(other.b) { other.b = 0; }
+      ~holder() { box::release(b); }
+
+      holder& operator=(holder&& other) {
+        std::swap(b, other.b);
+        return *this;
+      }
+
+      T const& get() const { return b->val; }
+
+      holder share() const
+      {
+        RefCount::increment(b->refs);
+        return holder(b);
+      }
+
+    private:
+      // keeps the allocator it came from, the nodes pointing at it do not
+      // have one at hand when they are destroyed
+      struct box : private pst::detail::ebo_holder<Alloc>
+      {
+        typedef typename Alloc::template rebind<box>::other box_allocator;
+        typedef std::allocator_traits<box_allocator> box_allocator_traits;
+
+        box(T&& val, Alloc const& alloc) : pst::detail::ebo_holder<Alloc>(alloc), refs(1), val(std::move(val)) {}
+
+        static box* make(T&& val, Alloc const& alloc)
+        {
+          box_allocator a(alloc);
+          box* p = box_allocator_traits::allocate(a, 1);
+          try {
+            box_allocator_traits::construct(a, p, std::move(val), alloc);
+          }
+          catch (...) {
+            box_allocator_traits::deallocate(a, p, 1);
+            throw;
+          }
+          return p;
+        }
+
+        static void release(box* p)
+        {
+          if (p && RefCount::decrement(p->refs)) {
+            box_allocator a(p->get());
+            box_allocator_traits::destroy(a, p);
+            box_allocator_traits::deallocate(a, p, 1);
+          }
+        }
+
+        mutable typename RefCount::count_type refs;
+        T const val;
+      };
+
+      explicit holder(box* b) : b(b) {}
+      holder(holder const&);
+      holder& operator=(holder const&);
+
+      box* b;
+    };
+  };
+}
+
+#endif // PST_PAYLOAD_H__
@@ -0,0 +1,237 @@
+#pragma once
+
+#ifndef PST_POOL_ALLOCATOR_H__
+#define PST_POOL_ALLOCATOR_H__
+
+#include <cstddef> // size_t, max_align_t
+#include <new> // operator new
+#include <mutex>
+#include <vector>
+#include <utility> // pair
+#include <type_traits> // alignment_of
+
+namespace pst
+{
+  namespace detail
+  {
+    // Free lists of fixed-size blocks, one pool per block size and alignment.
+    //
+    // Every thread keeps its own cache of free blocks, so allocating and
+    // freeing nodes normally touches no shared state. Blocks freed on one
+    // thread stay in that thread's cache and are reused there. Caches that
+    // grow too large hand a batch of blocks back to a shared list, and
+    // caches that run dry take a batch from it (or carve a new chunk), both
+    // under a mutex but only once per batch_size blocks.
+    //
+    // Memory is never returned to the system; the pool keeps its high water
+    // mark for the lifetime of the process.
+    template <std::size_t Size, std::size_t Align>
+    struct node_pool
+    {
+      static void* allocate()
+      {
+        thread_cache* cache = local_cache();
+
+        if (!cache) {
+          return shared().take_one();
+        }
+
+        if (!cache->head) {
+          batch_t batch = shared().take_batch();
+          cache->head = batch.first;
+          cache->count = batch.second;
+        }
+
+        block* b = cache->head;
+        cache->head = b->next;
+        --cache->count;
+        return b;
+      }
+
+      static void deallocate(void* p)
+      {
+        thread_cache* cache = local_cache();
+
+        block* b = static_cast<block*>(p);
+
+        if (!cache) {
+          b->next = 0;
+          shared().put_batch(batch_t(b, 1));
+          return;
+        }
+
+        b->next = cache->head;
+        cache->head = b;
+
+        if (++cache->count == 2 * batch_size) {
+          shared().put_batch(batch_t(cache->split_batch(), batch_size));
+        }
+      }
+
+    private:
+      struct block { block* next; };
+      typedef std::pair<block*, std::size_t> batch_t; // list of blocks and its length
+
+      static std::size_t const alignment = Align < std::alignment_of<block>::value ? std::alignment_of<block>::value : Align;
+      static std::size_t const block_size = ((Size < sizeof(block) ? sizeof(block) : Size) + alignment - 1) / alignment * alignment;
+      static std::size_t const batch_size = 256;
+
+      static_assert(Align <= std::alignment_of<std::max_align_t>::value, "node_pool does not support over-aligned types");
+
+      struct shared_pool
+      {
+        batch_t take_batch()
+        {
+          std::lock_guard<std::mutex> lock(m);
+
+          if (batches.empty()) {
+            return batch_t(carve(static_cast<char*>(::operator new(batch_size * block_size))), batch_size);
+          }
+
+          batch_t b = batches.back();
+          batches.pop_back();
+          return b;
+        }
+
+        void put_batch(batch_t b)
+        {
+          std::lock_guard<std::mutex> lock(m);
+          batches.push_back(b);
+        }
+
+        // a single block, for a thread whose cache is already gone
+        block* take_one()
+        {
+          batch_t b = take_batch();
+          if (b.first->next) {
+            put_batch(batch_t(b.first->next, b.second - 1));
+          }
+          return b.first;
+        }
+
+      private:
+        static block* carve(char* chunk)
+        {
+          for (std::size_t i = 0; i + 1 < batch_size; ++i) {
+            reinterpret_cast<block*>(chunk + i * block_size)->next = reinterpret_cast<block*>(chunk + (i + 1) * block_size);
+          }
+          reinterpret_cast<block*>(chunk + (batch_size - 1) * block_size)->next = 0;
+          return reinterpret_cast<block*>(chunk);
+        }
+
+        std::mutex m;
+        std::vector<batch_t> batches;
+      };
+
+      struct thread_cache
+      {
+        thread_cache() : head(0), count(0) {}
+
+        // a thread that goes away hands its blocks to the other threads;
+        // nodes freed later in its teardown (by other thread_local objects)
+        // go to the shared list directly
+        ~thread_cache()
+        {
+          if (head) {
+            shared().put_batch(batch_t(head, count));
+          }
+          head = 0;
+          count = 0;
+          cache_gone() = true;
+        }
+
+        // detaches batch_size blocks from the front of the list
+        block* split_batch()
+        {
+          block* batch = head;
+          block* last = head;
+          for (std::size_t i = 1; i < batch_size; ++i) {
+            last = last->next;
+          }
+          head = last->next;
+          last->next = 0;
+          count -= batch_size;
+          return batch;
+        }
+
+        block* head;
+        std::size_t count;
+      };
+
+      // never destroyed, trees with static storage duration may outlive any
+      // static pool object
+      static shared_pool& shared()
+      {
+        static shared_pool* pool = new shared_pool;
+        return *pool;
+      }
+
+      // null once the thread's cache has been destroyed
+      static thread_cache* local_cache()
+      {
+        static thread_local thread_cache cache;
+        return cache_gone() ? 0 : &cache;
+      }
+
+      // trivially destructible, so it stays valid after the cache is gone
+      static bool& cache_gone()
+      {
+        static thread_local bool gone = false;
+        return gone;
+      }
+    };
+
+    template <std::size_t Size, std::size_t Align> std::size_t const node_pool<Size, Align>::alignment;
+    template <std::size_t Size, std::size_t Align> std::size_t const node_pool<Size, Align>::block_size;
+    template <std::size_t Size, std::size_t Align> std::size_t const node_pool<Size, Align>::batch_size;
+  }
+
+  // Stateless allocator serving single objects from detail::node_pool, meant
+  // for the nodes of the persistent structures:
+  //
+  //   pst::set::rb_set<int, std::less<int>, pst::pool_allocator<int> >
+  //
+  // Array allocations go straight to operator new.
+  template <typename T>
+  struct pool_allocator
+  {
+    typedef T value_type;
+    typedef T* pointer;
+    typedef T const* const_pointer;
+    typedef T& reference;
+    typedef T const& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U> struct rebind { typedef pool_allocator<U> other; };
+
+    pool_allocator() {}
+    template <typename U> pool_allocator(pool_allocator<U> const&) {}
+
+    T* allocate(std::size_t n)
+    {
+      if (n == 1) {
+        return static_cast<T*>(pool_type::allocate());
+      }
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+      if (n == 1) {
+        pool_type::deallocate(p);
+      }
+      else {
+        ::operator delete(p);
+      }
+    }
+
+    friend bool operator==(pool_allocator const&, pool_allocator const&) { return true; }
+    friend bool operator!=(pool_allocator const&, pool_allocator const&) { return false; }
+
+  private:
+    typedef detail::node_pool<sizeof(T), std::alignment_of<T>::value> pool_type;
+  };
+}
+
+#endif // PST_POOL_ALLOCATOR_H__
@@ -1,9 +1,9 @@
-#pragma once
-
-#ifndef PST_PST_H__
-#define PST_PST_H__
-
-#include "list.h"
-#include "tree.h"
-
-#endif // PST_PST_H__
+#pragma once
+
+#ifndef PST_PST_H__
+#define PST_PST_H__
+
+#include "list.h"
+#include "tree.h"
+
+#endif // PST_PST_H__
@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef PST_REFCOUNT_H__
+#define PST_REFCOUNT_H__
+
+#include <atomic>
+#include <cstdint>
+
+namespace pst
+{
+  // Reference counting policies for the nodes of the persistent structures.
+  //
+  // atomic_refcount is the default and lets versions be shared freely between
+  // threads. local_refcount uses plain increments and decrements; use it when
+  // all versions of a structure stay on one thread.
+
+  struct atomic_refcount
+  {
+    typedef std::atomic<std::uint32_t> count_type;
+
+    static void increment(count_type& c) {
+      c.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // true when the last reference is gone
+    static bool decrement(count_type& c) {
+      return c.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    // true when the caller holds the only reference; acquire pairs with the
+    // release of the other references, so their owners are done with it
+    static bool unique(count_type const& c) {
+      return c.load(std::memory_order_acquire) == 1;
+    }
+  };
+
+  struct local_refcount
+  {
+    typedef std::uint32_t count_type;
+
+    static void increment(count_type& c) {
+      ++c;
+    }
+
+    static bool decrement(count_type& c) {
+      return --c == 0;
+    }
+
+    static bool unique(count_type const& c) {
+      return c == 1;
+    }
+  };
+}
+
+#endif // PST_REFCOUNT_H__
@@ -1,68 +1,229 @@
-#pragma once
-
-#ifndef PST_SET_H__
-#define PST_SET_H__
-
-#include "tree.h"
-#include <functional>
-#include <initializer_list>
-
-namespace pst
-{
-  namespace set
-  {
-    template <typename T, typename Compare = std::less<T>, typename Alloc = std::allocator<T> >
-    struct rb_set
-    {
-      typedef T value_type;
-      typedef pst::tree::rb_tree<value_type, Compare, Alloc> rb_tree_type;
-
-      rb_set() {}
-      rb_set(rb_tree_type t) : tree(std::move(t)) {}
-
-      static rb_set empty_set() { return rb_set(); }
-
-      template <typename U> static rb_set from(std::initializer_list<U> lst) {
-        return from(begin(lst), end(lst));
-      }
-
-      template <typename It> static rb_set from(It begin, It end) {
-        return empty_set().insert(std::move(begin), std::move(end));
-      }
-
-      bool empty() const { return tree.empty(); }
-      bool member(value_type const& t) const { return !!tree.find(t); }
-      rb_set insert(value_type t) const { return tree.insert(std::move(t)); }
-      rb_set erase(value_type const& t) const { return tree.erase(t); }
-
-      template <typename It>
-      rb_set insert(It begin, It end) const
-      {
-        rb_set temp = *this;
-
-        while (begin != end) {
-          temp = temp.insert(*begin++);
-        }
-
-        return temp;
-      }
-
-      template <typename It>
-      rb_set erase(It begin, It end) const
-      {
-        rb_set temp = *this;
-
-        while (begin != end) {
-          temp = temp.erase(*begin++);
-        }
-
-        return temp;
-      }
-
-    private:
-      rb_tree_type tree;
-    };
-  }
-}
-
-#endif // PST_SET_H__
+#pragma once
+
+#ifndef PST_SET_H__
+#define PST_SET_H__
+
+#include "tree.h"
+#include <functional>
+#include <initializer_list>
+#include <vector>
+
+namespace pst
+{
+  namespace set
+  {
+    template <typename T,
+              typename Compare = std::less<T>,
+              typename Alloc = std::allocator<T>,
+              typename RefCount = atomic_refcount,
+              typename Storage = inline_payload,
+              typename Augment = no_augment>
+    struct rb_set
+    {
+      typedef T value_type;
+      typedef pst::tree::rb_tree<value_type, Compare, Alloc, RefCount, Storage, Augment> rb_tree_type;
+      typedef typename rb_tree_type::summary_type summary_type;
+      typedef typename rb_tree_type::iterator iterator;
+      typedef typename rb_tree_type::const_iterator const_iterator;
+      typedef typename rb_tree_type::reverse_iterator reverse_iterator;
+
+      rb_set() {}
+      rb_set(rb_tree_type t) : tree(std::move(t)) {}
+      explicit rb_set(Compare const& comp, Alloc const& alloc = Alloc()) : tree(comp, alloc) {}
+
+      static rb_set empty_set() { return rb_set(); }
+      static rb_set empty_set(Compare const& comp, Alloc const& alloc = Alloc()) { return rb_set(comp, alloc); }
+
+      template <typename U> static rb_set from(std::initializer_list<U> lst) {
+        return from(lst.begin(), lst.end());
+      }
+
+      template <typename It> static rb_set from(It begin, It end) {
+        return empty_set().insert(std::move(begin), std::move(end));
+      }
+
+      template <typename It> static rb_set from(It begin, It end, Compare const& comp, Alloc const& alloc = Alloc()) {
+        return empty_set(comp, alloc).insert(std::move(begin), std::move(end));
+      }
+
+      // linear time, see rb_tree::from_sorted
+      template <typename It> static rb_set from_sorted(It begin, It end, Compare const& comp = Compare(), Alloc const& alloc = Alloc()) {
+        return rb_tree_type::from_sorted(std::move(begin), std::move(end), comp, alloc);
+      }
+
+      // sorts, deduplicates and builds on several threads, see
+      // rb_tree::from_unsorted_parallel
+      static rb_set from_parallel(std::vector<value_type> values, unsigned threads = parallel::default_threads(),
+                                  Compare const& comp = Compare(), Alloc const& alloc = Alloc()) {
+        static_assert(rb_tree_type::parallel_safe::value, "from_parallel needs atomic_refcount and an allocator safe to share between threads");
+        return rb_tree_type::from_unsorted_parallel(std::move(values), threads, comp, alloc);
+      }
+
+      Compare const& key_comp() const { return tree.key_comp(); }
+      Alloc get_allocator() const { return tree.get_allocator(); }
+
+      bool empty() const { return tree.empty(); }
+      bool member(value_type const& t) const { return !!tree.find(t); }
+      rb_set insert(value_type t) const { return tree.insert(std::move(t)); }
+      rb_set erase(value_type const& t) const { return tree.erase(t); }
+
+      // In order without allocating, for range-for; the iterators are
+      // valid while the set is. for_each is the fastest full scan.
+      iterator begin() const { return tree.begin(); }
+      iterator end() const { return tree.end(); }
+      reverse_iterator rbegin() const { return tree.rbegin(); }
+      reverse_iterator rend() const { return tree.rend(); }
+
+      template <typename F>
+      void for_each(F f) const { tree.for_each(std::move(f)); }
+
+      // Ordered lookups in O(log n), see rb_tree::lower_bound.
+      iterator lower_bound(value_type const& t) const { return tree.lower_bound(t); }
+      iterator upper_bound(value_type const& t) const { return tree.upper_bound(t); }
+      iterator floor(value_type const& t) const { return tree.floor(t); }
+      iterator ceiling(value_type const& t) const { return tree.ceiling(t); }
+      std::pair<iterator, iterator> equal_range(value_type const& t) const { return tree.equal_range(t); }
+
+      // O(1) with size_augment; rank, select and count_range need it, see
+      // rb_tree::rank
+      std::size_t size() const { return tree.size(); }
+      std::size_t rank(value_type const& t) const { return tree.rank(t); }
+      value_type const* select(std::size_t i) const { return tree.select(i); }
+      std::size_t count_range(value_type const& lo, value_type const& hi) const { return tree.count_range(lo, hi); }
+
+      // the fold of the elements in [lo, hi) in O(log n), see
+      // rb_tree::aggregate and monoid_augment
+      summary_type aggregate(value_type const& lo, value_type const& hi) const { return tree.aggregate(lo, hi); }
+
+      // the summary of all of it, see augment.h
+      summary_type const& summary() const { return tree.summary(); }
+
+      // Calls f(before, after) for each element only in *this, f(&e, 0),
+      // or only in to, f(0, &e), skipping what the versions share; see
+      // rb_tree::for_each_difference.
+      template <typename F>
+      void for_each_difference(rb_set const& to, F f) const {
+        rb_tree_type::for_each_difference(tree, to.tree, std::move(f));
+      }
+
+      // By content, see rb_tree::equal_content; with hash_augment unequal
+      // contents mostly differ by hash and are told apart in O(1).
+      friend bool operator==(rb_set const& lhs, rb_set const& rhs) {
+        return rb_tree_type::equal_content(lhs.tree, rhs.tree);
+      }
+
+      friend bool operator!=(rb_set const& lhs, rb_set const& rhs) {
+        return !(lhs == rhs);
+      }
+
+      // Batch updates in place, see rb_tree::transient.
+      class transient
+      {
+      public:
+        explicit transient(rb_set const& s = rb_set()) : tree(s.tree) {}
+
+        bool empty() const { return tree.empty(); }
+        bool member(value_type const& t) const { return !!tree.find(t); }
+        void insert(value_type t) { tree.insert(std::move(t)); }
+        void erase(value_type const& t) { tree.erase(t); }
+
+        rb_set persistent() const { return tree.persistent(); }
+
+      private:
+        typename rb_tree_type::transient tree;
+      };
+
+      // Membership tests near the previous one, in O(log d) for elements
+      // about d apart; see tree_finger. Valid while the set is.
+      class finger
+      {
+      public:
+        explicit finger(rb_set const& s) : f(s.tree) {}
+
+        bool member(value_type const& t) { return !!f.find(t); }
+
+      private:
+        typename rb_tree_type::finger f;
+      };
+
+      // batch updates, see rb_tree::insert_batch
+      template <typename It>
+      rb_set insert(It begin, It end) const {
+        return tree.insert_batch(std::vector<value_type>(begin, end));
+      }
+
+      template <typename It>
+      rb_set erase(It begin, It end) const {
+        return tree.erase_batch(std::vector<value_type>(begin, end));
+      }
+
+      // Takes out the elements in [lo, hi) in O(log n), see
+      // rb_tree::extract_range; extract_range also returns them.
+      rb_set erase_range(value_type const& lo, value_type const& hi) const {
+        return tree.erase_range(lo, hi);
+      }
+
+      std::pair<rb_set, rb_set> extract_range(value_type const& lo, value_type const& hi) const
+      {
+        auto const parts = tree.extract_range(lo, hi);
+        return std::make_pair(rb_set(parts.first), rb_set(parts.second));
+      }
+
+      // Set algebra by split and join, O(m log(n/m + 1)) for sizes m <= n;
+      // see rb_tree::set_union. Elements of *this win over equivalent ones
+      // of other.
+      rb_set union_with(rb_set const& other) const { return rb_tree_type::set_union(tree, other.tree); }
+      rb_set intersection_with(rb_set const& other) const { return rb_tree_type::set_intersection(tree, other.tree); }
+      rb_set difference_with(rb_set const& other) const { return rb_tree_type::set_difference(tree, other.tree); }
+
+      // The same on the threads of pool, see rb_tree::set_union_parallel.
+      rb_set union_with(rb_set const& other, parallel::work_stealing_pool& pool, std::size_t grain = parallel::default_grain) const {
+        static_assert(rb_tree_type::parallel_safe::value, "union_with needs atomic_refcount and an allocator safe to share between threads");
+        return rb_tree_type::set_union_parallel(tree, other.tree, pool, grain);
+      }
+
+      rb_set intersection_with(rb_set const& other, parallel::work_stealing_pool& pool, std::size_t grain = parallel::default_grain) const {
+        static_assert(rb_tree_type::parallel_safe::value, "intersection_with needs atomic_refcount and an allocator safe to share between threads");
+        return rb_tree_type::set_intersection_parallel(tree, other.tree, pool, grain);
+      }
+
+      rb_set difference_with(rb_set const& other, parallel::work_stealing_pool& pool, std::size_t grain = parallel::default_grain) const {
+        static_assert(rb_tree_type::parallel_safe::value, "difference_with needs atomic_refcount and an allocator safe to share between threads");
+        return rb_tree_type::set_difference_parallel(tree, other.tree, pool, grain);
+      }
+
+      // Batch updates on the threads of pool: the batch is sorted and
+      // built into a tree, then united with or taken from this one.
+      rb_set insert_parallel(std::vector<value_type> values, parallel::work_stealing_pool& pool, std::size_t grain = parallel::default_grain) const {
+        static_assert(rb_tree_type::parallel_safe::value, "insert_parallel needs atomic_refcount and an allocator safe to share between threads");
+        return rb_tree_type::set_union_parallel(batch(std::move(values), pool), tree, pool, grain);
+      }
+
+      rb_set erase_parallel(std::vector<value_type> values, parallel::work_stealing_pool& pool, std::size_t grain = parallel::default_grain) const {
+        static_assert(rb_tree_type::parallel_safe::value, "erase_parallel needs atomic_refcount and an allocator safe to share between threads");
+        return rb_tree_type::set_difference_parallel(tree, batch(std::move(values), pool), pool, grain);
+      }
+
+    private:
+      rb_tree_type batch(std::vector<value_type> values, parallel::work_stealing_pool& pool) const {
+        return rb_tree_type::from_unsorted_parallel(std::move(values), pool.size(), tree.key_comp(), tree.get_allocator());
+      }
+
+      rb_tree_type tree;
+    };
+  }
+}
+
+namespace std
+{
+  // O(1) from the content hash kept at the root
+  template <typename T, typename Compare, typename Alloc, typename RefCount, typename Storage, typename Hash>
+  struct hash<pst::set::rb_set<T, Compare, Alloc, RefCount, Storage, pst::hash_augment<Hash>>>
+  {
+    std::size_t operator()(pst::set::rb_set<T, Compare, Alloc, RefCount, Storage, pst::hash_augment<Hash>> const& s) const {
+      return static_cast<std::size_t>(s.summary().value());
+    }
+  };
+}
+
+#endif // PST_SET_H__
@@ -0,0 +1,263 @@
+#pragma once
+
+#ifndef PST_SLAB_ALLOCATOR_H__
+#define PST_SLAB_ALLOCATOR_H__
+
+#include <cstddef> // size_t, max_align_t
+#include <cstdint> // uint32_t
+#include <new> // operator new, bad_alloc
+#include <mutex>
+#include <vector>
+#include <utility> // pair
+#include <type_traits> // alignment_of
+
+namespace pst
+{
+  namespace detail
+  {
+    // Fixed-size blocks in slabs of slab_blocks, named by 32-bit indices
+    // rather than by address. Index 0 is never handed out and stands for
+    // null; the index of a block determines its slab and its offset in
+    // it, so turning an index into an address is two loads.
+    //
+    // Free blocks are kept on per-thread lists, linked through their
+    // indices and exchanged with a shared list in batches, as in node_pool.
+    // Slabs are never given back.
+    template <std::size_t Size, std::size_t Align>
+    struct slab_store
+    {
+      typedef std::uint32_t index_type;
+
+      // indices use 31 bits, leaving room for a tag bit next to them
+      static std::size_t const max_blocks = std::size_t(1) << 31;
+
+      static index_type allocate()
+      {
+        thread_cache* cache = local_cache();
+
+        if (!cache) {
+          return shared().take_one();
+        }
+
+        if (!cache->head) {
+          batch_t batch = shared().take_batch();
+          cache->head = batch.first;
+          cache->count = batch.second;
+        }
+
+        index_type i = cache->head;
+        cache->head = next(i);
+        --cache->count;
+        return i;
+      }
+
+      static void deallocate(index_type i)
+      {
+        thread_cache* cache = local_cache();
+
+        if (!cache) {
+          next(i) = 0;
+          shared().put_batch(batch_t(i, 1));
+          return;
+        }
+
+        next(i) = cache->head;
+        cache->head = i;
+
+        if (++cache->count == 2 * batch_size) {
+          shared().put_batch(batch_t(cache->split_batch(), batch_size));
+        }
+      }
+
+      static void* address(index_type i)
+      {
+        return directory[i >> slab_bits] + (i & slab_mask) * block_size;
+      }
+
+    private:
+      typedef std::pair<index_type, std::size_t> batch_t; // list of blocks and its length
+
+      static std::size_t const alignment = Align < std::alignment_of<index_type>::value ? std::alignment_of<index_type>::value : Align;
+      static std::size_t const block_size = ((Size < sizeof(index_type) ? sizeof(index_type) : Size) + alignment - 1) / alignment * alignment;
+      static std::size_t const slab_bits = 14;
+      static std::size_t const slab_blocks = std::size_t(1) << slab_bits;
+      static std::size_t const slab_mask = slab_blocks - 1;
+      static std::size_t const max_slabs = max_blocks / slab_blocks;
+      static std::size_t const batch_size = 256;
+
+      static_assert(Align <= std::alignment_of<std::max_align_t>::value, "slab_store does not support over-aligned types");
+      static_assert(slab_blocks % batch_size == 0, "slabs are carved into whole batches");
+
+      static index_type& next(index_type i) { return *static_cast<index_type*>(address(i)); }
+
+      struct shared_pool
+      {
+        shared_pool() : slabs(0) {}
+
+        batch_t take_batch()
+        {
+          std::lock_guard<std::mutex> lock(m);
+
+          if (batches.empty()) {
+            add_slab();
+          }
+
+          batch_t b = batches.back();
+          batches.pop_back();
+          return b;
+        }
+
+        void put_batch(batch_t b)
+        {
+          std::lock_guard<std::mutex> lock(m);
+          batches.push_back(b);
+        }
+
+        // a single block, for a thread whose cache is already gone
+        index_type take_one()
+        {
+          batch_t b = take_batch();
+          if (next(b.first)) {
+            put_batch(batch_t(next(b.first), b.second - 1));
+          }
+          return b.first;
+        }
+
+      private:
+        // links the blocks of a new slab into batches; block 0 of slab 0 is
+        // the null index and is left out
+        void add_slab()
+        {
+          if (slabs == max_slabs) {
+            throw std::bad_alloc();
+          }
+
+          directory[slabs] = static_cast<char*>(::operator new(slab_blocks * block_size));
+          index_type const base = static_cast<index_type>(slabs * slab_blocks);
+          ++slabs;
+
+          for (std::size_t b = 0; b < slab_blocks; b += batch_size) {
+            index_type const first = static_cast<index_type>(base + (b == 0 && base == 0 ? 1 : b));
+            index_type const last = static_cast<index_type>(base + b + batch_size - 1);
+            for (index_type i = first; i < last; ++i) {
+              next(i) = i + 1;
+            }
+            next(last) = 0;
+            batches.push_back(batch_t(first, last - first + 1));
+          }
+        }
+
+        std::mutex m;
+        std::vector<batch_t> batches;
+        std::size_t slabs;
+      };
+
+      struct thread_cache
+      {
+        thread_cache() : head(0), count(0) {}
+
+        // as in node_pool, later frees on this thread bypass the cache
+        ~thread_cache()
+        {
+          if (head) {
+            shared().put_batch(batch_t(head, count));
+          }
+          head = 0;
+          count = 0;
+          cache_gone() = true;
+        }
+
+        index_type split_batch()
+        {
+          index_type batch = head;
+          index_type last = head;
+          for (std::size_t i = 1; i < batch_size; ++i) {
+            last = next(last);
+          }
+          head = next(last);
+          next(last) = 0;
+          count -= batch_size;
+          return batch;
+        }
+
+        index_type head;
+        std::size_t count;
+      };
+
+      static shared_pool& shared()
+      {
+        static shared_pool* pool = new shared_pool;
+        return *pool;
+      }
+
+      static thread_cache* local_cache()
+      {
+        static thread_local thread_cache cache;
+        return cache_gone() ? 0 : &cache;
+      }
+
+      static bool& cache_gone()
+      {
+        static thread_local bool gone = false;
+        return gone;
+      }
+
+      // written under the shared lock before any index into the slab is
+      // handed out; zero initialized, so it needs no constructor to run
+      static char* directory[max_slabs];
+    };
+
+    template <std::size_t Size, std::size_t Align> std::size_t const slab_store<Size, Align>::max_blocks;
+    template <std::size_t Size, std::size_t Align> std::size_t const slab_store<Size, Align>::alignment;
+    template <std::size_t Size, std::size_t Align> std::size_t const slab_store<Size, Align>::block_size;
+    template <std::size_t Size, std::size_t Align> std::size_t const slab_store<Size, Align>::slab_bits;
+    template <std::size_t Size, std::size_t Align> std::size_t const slab_store<Size, Align>::slab_blocks;
+    template <std::size_t Size, std::size_t Align> std::size_t const slab_store<Size, Align>::slab_mask;
+    template <std::size_t Size, std::size_t Align> std::size_t const slab_store<Size, Align>::max_slabs;
+    template <std::size_t Size, std::size_t Align> std::size_t const slab_store<Size, Align>::batch_size;
+    template <std::size_t Size, std::size_t Align> char* slab_store<Size, Align>::directory[slab_store<Size, Align>::max_slabs];
+  }
+
+  // Stateless allocator whose single-object allocations can also be named
+  // by 32-bit index. The trees notice the index interface (see
+  // detail::node_links) and link their nodes by index instead of by
+  // pointer, which halves the size of a link on 64-bit builds:
+  //
+  //   pst::set::rb_set<int, std::less<int>, pst::slab_allocator<int> >
+  //
+  // keeps 16 bytes per element, reference count included. Plain
+  // allocate/deallocate go straight to operator new.
+  template <typename T>
+  struct slab_allocator
+  {
+    typedef T value_type;
+    typedef T* pointer;
+    typedef T const* const_pointer;
+    typedef T& reference;
+    typedef T const& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef std::uint32_t index_type;
+
+    template <typename U> struct rebind { typedef slab_allocator<U> other; };
+
+    slab_allocator() {}
+    template <typename U> slab_allocator(slab_allocator<U> const&) {}
+
+    T* allocate(std::size_t n) { return static_cast<T*>(::operator new(n * sizeof(T))); }
+    void deallocate(T* p, std::size_t) { ::operator delete(p); }
+
+    // never returns 0
+    static index_type allocate_index() { return store_type::allocate(); }
+    static void deallocate_index(index_type i) { store_type::deallocate(i); }
+    static T* address(index_type i) { return static_cast<T*>(store_type::address(i)); }
+
+    friend bool operator==(slab_allocator const&, slab_allocator const&) { return true; }
+    friend bool operator!=(slab_allocator const&, slab_allocator const&) { return false; }
+
+  private:
+    typedef detail::slab_store<sizeof(T), std::alignment_of<T>::value> store_type;
+  };
+}
+
+#endif // PST_SLAB_ALLOCATOR_H__
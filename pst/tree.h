@@ -1,866 +1,2856 @@
-#pragma once
-
-#ifndef PST_TREE_H__
-#define PST_TREE_H__
-
-#include <memory> // allocators
-#include <functional> // less, equal_to
-#include <algorithm> // swap
-#include <cassert> // assert...
-#include <cstddef> // size_t
-
-namespace pst
-{
-  namespace tree
-  {
-    template <typename Derived,
-              typename KeyValT,
-              typename Compare = std::less<KeyValT>,
-              typename ImplData = std::tuple<>,
-              typename Alloc = std::allocator<KeyValT> >
-    struct bst_base
-    {
-      typedef Derived tree_type;
-      typedef KeyValT key_value_type;
-      typedef Compare key_compare;
-      typedef Alloc allocator_type;
-      typedef ImplData impl_data_type;
-
-      friend bool operator==(tree_type const& lhs, tree_type const& rhs) {
-        return lhs.impl == rhs.impl;
-      }
-
-      friend bool operator!=(tree_type const& lhs, tree_type const& rhs) {
-        return !(lhs == rhs);
-      }
-
-      static tree_type empty_tree() { return tree_type(); }
-
-      bool empty() const
-      {
-        return !impl;
-      }
-
-      key_value_type const& keyval() const { return impl->val; }
-      key_value_type keyval_copy() const { return impl->val; }
-
-      std::size_t size() const {
-        return empty() ? 0 : (1 + left().size() + right().size());
-      }
-
-      std::size_t depth() const
-      {
-        return empty() ? 0 : (1 + std::max(left().depth(), right().depth()));
-      }
-
-      key_value_type const* find(typename key_value_type const& kv) const
-      {
-        if (empty()) {
-          return 0;
-        }
-        else if (key_less(kv, keyval())) {
-          return left().find(kv);
-        }
-        else if (key_less(keyval(), kv)) {
-          return right().find(kv);
-        }
-        else {
-          return &keyval();
-        }
-      }
-
-      key_value_type const* find_min() const
-      {
-        if (empty()) {
-          return 0;
-        }
-        else if (left().empty()) {
-          return &keyval();
-        }
-        else {
-          return left().find_min();
-        }
-      }
-
-      key_value_type const* find_max() const
-      {
-        if (empty()) {
-          return 0;
-        }
-        else if (right().empty()) {
-          return &keyval();
-        }
-        else {
-          return right().find_max();
-        }
-      }
-
-      tree_type const& left() const { return impl->left; }
-      tree_type const& right() const { return impl->right; }
-
-      static bool key_less(key_value_type const& lhs, key_value_type const& rhs) { return key_compare()(lhs, rhs); }
-
-    protected:
-      bst_base() {}
-      bst_base(bst_base&& other) : impl(std::move(other.impl)) {}
-      bst_base(bst_base const& other) : impl(other.impl) {}
-
-      bst_base& operator=(bst_base&& other) {
-        impl = std::move(other.impl);
-        return *this;
-      }
-
-      bst_base& operator=(bst_base const& other) {
-        impl = other.impl;
-        return *this;
-      }
-
-      struct impl_t
-      {
-        impl_t(key_value_type&& keyval, tree_type&& left, tree_type&& right, impl_data_type impl_data = impl_data_type())
-          : val(std::move(keyval)),
-            left(std::move(left)),
-            right(std::move(right)),
-            impl_data(std::move(impl_data))
-        {}
-
-        impl_t(key_value_type&& keyval)
-          : val(std::move(keyval))
-        {}
-
-        impl_t(key_value_type&& keyval, impl_data_type impl_data)
-          : val(std::move(keyval)),
-            impl_data(std::move(impl_data))
-        {}
-
-        key_value_type const val;
-        tree_type const left, right;
-        impl_data_type const impl_data;
-
-      private:
-        impl_t(impl_t const&);
-        impl_t& operator=(impl_t const&);
-      };
-
-      typedef typename allocator_type::template rebind<impl_t>::other impl_allocator;
-
-      bst_base(key_value_type&& keyval)
-        : impl(std::allocate_shared<impl_t>(impl_allocator(), std::move(keyval)))
-      {}
-
-      bst_base(key_value_type&& keyval, impl_data_type impl_data)
-        : impl(std::allocate_shared<impl_t>(impl_allocator(), std::move(keyval), std::move(impl_data)))
-      {}
-
-      bst_base(key_value_type&& keyval, tree_type&& left, tree_type&& right, impl_data_type impl_data = impl_data_type())
-        : impl(std::allocate_shared<impl_t>(impl_allocator(), std::move(keyval), std::move(left), std::move(right), std::move(impl_data)))
-      {}
-
-      ~bst_base() {}
-
-      impl_data_type const& impl_data() const { return impl->impl_data; }
-
-      static tree_type with_left(tree_type const& orig, tree_type&& left) {
-        return tree_type(orig.keyval_copy(), std::move(left), tree_type(orig.right()), orig.impl_data());
-      }
-
-      static tree_type with_right(tree_type const& orig, tree_type&& right) {
-        return tree_type(orig.keyval_copy(), tree_type(orig.left()), std::move(right), orig.impl_data());
-      }
-
-      static tree_type with_left_right(tree_type const& orig, tree_type&& left, tree_type&& right) {
-        return tree_type(orig.keyval_copy(), std::move(left), std::move(right), orig.impl_data());
-      }
-
-      static tree_type with_impl(tree_type const& orig, impl_data_type impl_data) {
-        return tree_type(orig.keyval_copy(), tree_type(orig.left()), tree_type(orig.right()), std::move(impl_data));
-      }
-
-      static tree_type with_left_right_impl_data(tree_type const& orig, tree_type&& left, tree_type&& right, impl_data_type impl_data) {
-        return tree_type(orig.keyval_copy(), std::move(left), std::move(right), std::move(impl_data));
-      }
-
-      static tree_type with_keyval(tree_type const& orig, key_value_type&& keyval) {
-        return tree_type(std::move(keyval), tree_type(orig.left()), tree_type(orig.right()), orig.impl_data());
-      }
-
-      static tree_type with_left_right_keyval(tree_type const& orig, tree_type&& left, tree_type&& right, key_value_type&& keyval) {
-        return tree_type(std::move(keyval), std::move(left), std::move(right), orig.impl_data());
-      }
-
-      std::shared_ptr<impl_t const> impl;
-    };
-
-    template <typename T,
-              typename Compare = std::less<T>,
-              typename Alloc = std::allocator<T> >
-    struct bs_tree : public bst_base<bs_tree<T, Compare, Alloc>, T, Compare, std::tuple<>, Alloc>
-    {
-      bs_tree() {}
-      bs_tree(bs_tree&& other) : bst_base(std::move(other)) {}
-      bs_tree(bs_tree const& other) : bst_base(other) {}
-
-      bs_tree insert(key_value_type&& v) const {
-        return insert_impl(std::move(v));
-      }
-
-      bs_tree insert(key_value_type const& v) const {
-        return insert_impl(std::move(key_value_type(v)));
-      }
-
-      bs_tree erase(key_value_type const& v) const
-      {
-        if (empty()) {
-          return *this;
-        }
-        else if (key_less(v, keyval())) {
-          return bs_tree(keyval(), left().erase(v), right());
-        }
-        else if (key_less(keyval(), v)) {
-          return bs_tree(keyval(), left(), right().erase(v));
-        }
-        else {
-          if (left().empty()) {
-            return right();
-          }
-          else if (right().empty()) {
-            return left();
-          }
-          else {
-            auto pred = left().find_max();
-            return bs_tree(*pred, left().erase(*pred), right());
-          }
-        }
-      }
-
-    protected:
-      bs_tree insert_impl(key_value_type&& v) const
-      {
-        if (empty()) {
-          return bs_tree(std::move(v));
-        }
-        else if (key_less(v, keyval())) {
-          return bs_tree(keyval_copy(), left().insert(std::move(v)), bs_tree(right()));
-        }
-        else if (key_less(keyval(), v)) {
-          return bs_tree(keyval_copy(), bs_tree(left()), right().insert(std::move(v)));
-        }
-        else {
-          return bs_tree(std::move(v), bs_tree(left()), bs_tree(right()));
-        }
-      }
-
-    protected:
-      bs_tree(key_value_type&& keyval)
-        : bst_base(std::move(keyval))
-      {}
-
-      bs_tree(key_value_type&& keyval, bs_tree&& l, bs_tree&& r)
-        : bst_base(std::move(keyval), std::move(l), std::move(r))
-      {}
-    };
-
-    /**************************************************************/
-
-    enum rb_color_t { BLACK, RED };
-
-    template <typename T,
-              typename LessT = std::less<T>,
-              typename Alloc = std::allocator<T> >
-    struct rb_tree : public bst_base<rb_tree<T, LessT, Alloc>, T, LessT, rb_color_t, Alloc>
-    {
-      friend bst_base;
-
-      rb_tree() {}
-      rb_tree(rb_tree&& other) : bst_base(std::move(other)) {}
-      rb_tree(rb_tree const& other) : bst_base(other) {}
-
-      rb_color_t color() const { return impl ? impl->impl_data : BLACK; }
-
-      std::size_t bdepth() const
-      {
-        return empty() ? 1 : (left().bdepth() + (color() == BLACK ? 1 : 0));
-      }
-
-      rb_tree insert(key_value_type&& v) const
-      {
-        auto with_insert = insert_impl<lhs_ops>(std::move(v), BLACK);
-        return with_insert.second.color() == BLACK ? with_insert.second : with_color(with_insert.second, BLACK);
-      }
-
-      rb_tree insert(key_value_type const& v) const
-      {
-        auto with_insert = insert_impl<lhs_ops>(std::move(key_value_type(v)), BLACK);
-        return with_insert.second.color() == BLACK ? with_insert.second : with_color(with_insert.second, BLACK);
-      }
-
-      rb_tree erase(key_value_type const& v) const
-      {
-        auto with_erase = erase_impl(v);
-        return with_erase.second.color() == BLACK ? with_erase.second : with_color(with_erase.second, BLACK);
-      }
-
-    private:
-      enum rb_shape_t { BBB, BBR, BRB, BRR, RBB, RBR, RRB, RRR }; /* RRR can't happen as we change one subtree at a time */
-
-      static rb_shape_t rb_mk_shape(rb_color_t parent, rb_color_t left, rb_color_t right) {
-        return static_cast<rb_shape_t>(4 * parent + 2 * left + right);
-      }
-
-      struct rhs_ops
-      {
-        static rb_shape_t shape_RRB() { return RRB; }
-        static rb_shape_t shape_RBR() { return RBR; }
-
-        static rb_shape_t rb_mk_shape(rb_color_t parent, rb_color_t left, rb_color_t right) {
-          return rb_tree::rb_mk_shape(parent, left, right);
-        }
-
-        static bool key_less(typename rb_tree::key_value_type const& lhs, typename rb_tree::key_value_type const& rhs) {
-          return rb_tree::key_less(lhs, rhs);
-        }
-        
-        static rb_tree with_left(rb_tree const& orig, rb_tree left) {
-          return rb_tree::with_left(orig, std::move(left));
-        }
-
-        static rb_tree with_right(rb_tree const& orig, rb_tree right) {
-          return rb_tree::with_right(orig, std::move(right));
-        }
-
-        static rb_tree with_left_right(rb_tree const& orig, rb_tree left, rb_tree right) {
-          return rb_tree::with_left_right(orig, std::move(left), std::move(right));
-        }
-
-        static rb_tree const& left(rb_tree const& t) {
-          return t.left();
-        }
-
-        static rb_tree const& right(rb_tree const& t) {
-          return t.right();
-        }
-
-        static rb_tree with_left_right_color(rb_tree const& t, rb_tree left, rb_tree right, rb_color_t color) {
-          return rb_tree::with_left_right_color(t, std::move(left), std::move(right), color);
-        }
-      };
-
-      struct lhs_ops
-      {
-        static rb_shape_t shape_RRB() { return RBR; }
-        static rb_shape_t shape_RBR() { return RRB; }
-
-        static rb_shape_t rb_mk_shape(rb_color_t parent, rb_color_t left, rb_color_t right) {
-          return rb_tree::rb_mk_shape(parent, right, left);
-        }
-
-        static bool key_less(typename rb_tree::key_value_type const& lhs, typename rb_tree::key_value_type const& rhs) {
-          return rb_tree::key_less(rhs, lhs);
-        }
-
-        static rb_tree with_left(rb_tree const& orig, rb_tree left) {
-          return rb_tree::with_right(orig, std::move(left));
-        }
-
-        static rb_tree with_right(rb_tree const& orig, rb_tree right) {
-          return rb_tree::with_left(orig, std::move(right));
-        }
-
-        static rb_tree with_left_right(rb_tree const& orig, rb_tree left, rb_tree right) {
-          return rb_tree::with_left_right(orig, std::move(right), std::move(left));
-        }
-
-        static rb_tree const& left(rb_tree const& t) {
-          return t.right();
-        }
-
-        static rb_tree const& right(rb_tree const& t) {
-          return t.left();
-        }
-
-        static rb_tree with_left_right_color(rb_tree const& t, rb_tree left, rb_tree right, rb_color_t color) {
-          return rb_tree::with_left_right_color(t, std::move(right), std::move(left), color);
-        }
-      };
-
-      template <typename some_hs> struct other_hs;
-      template <> struct other_hs<rhs_ops> { typedef lhs_ops type; };
-      template <> struct other_hs<lhs_ops> { typedef rhs_ops type; };
-
-      typedef std::pair<int, rb_tree> deltatree_t;
-
-      deltatree_t erase_impl(key_value_type const& v) const
-      {
-        if (empty()) {
-          return std::make_pair(0, *this);
-        }
-        else if (color() == BLACK) {
-          return black_erase_impl(v);
-        }
-        else {
-          return red_erase_impl(v);
-        }
-      }
-
-      template <typename Ops>
-      static deltatree_t black_fixup_right_impl(rb_tree const& parent/*_with_new_right*/)
-      {
-        assert(parent.color() == BLACK);
-        assert(Ops::right(parent).color() == BLACK);
-
-        rb_tree const& left = Ops::left(parent);
-
-        if (left.color() == RED)
-        {
-          rb_tree const& left_r = Ops::right(left);
-          rb_tree const& left_r_r = Ops::right(left_r);
-
-          if (left_r_r.color() == BLACK)
-          {
-            // (P{B} (L{R} LL{B} (LR{B} LRL{?} LRR{B})) R{B}) -> (L{B} LL{B} (LR{B} LRL{?} (P{R} LRR{B} R{B})))
-            return std::make_pair(0,
-                                  Ops::with_left_right_color(left,
-                                                             Ops::left(left),
-                                                             Ops::with_right(left_r,
-                                                                             Ops::with_left_right_color(parent,
-                                                                                                        left_r_r,
-                                                                                                        Ops::right(parent),
-                                                                                                        RED)),
-                                                             BLACK));
-          }
-          else
-          {
-            // (P{B} (L{R} LL{B} (LR{B} LRL{?} LRR{R})) R{B}) -> (L{B} LL{B} (LRR{B} (LR{B} LRL{?} LRRL{B}) (P{B} (LRRR{B}, R{B}))))
-            assert(left_r_r.color() == RED);
-            return std::make_pair(0,
-                                  Ops::with_left_right_color(left,
-                                                             Ops::left(left),
-                                                             Ops::with_left_right(left_r_r,
-                                                                                  Ops::with_right(left_r,
-                                                                                                  Ops::left(left_r_r)),
-                                                                                  Ops::with_left(parent,
-                                                                                                 Ops::right(left_r_r))),
-                                                             BLACK));
-          }
-        }
-        else
-        {
-          assert(left.color() == BLACK);
-
-          rb_tree const& left_l = Ops::left(left);
-          rb_tree const& left_r = Ops::right(left);
-
-          if (left_l.color() == RED)
-          {
-            // (P{B} (L{B} LL{R} LR{?}) R{B}) -> (L{B} LL{B} (P{B} LR{?} R{B}))
-            return std::make_pair(0,
-                                  Ops::with_left_right(left,
-                                                       with_color(left_l, BLACK),
-                                                       Ops::with_left(parent,
-                                                                      left_r)));
-          }
-          else if (left_r.color() == RED)
-          {
-            // (P{B} (L{B} LL{B} LR{R}) R{B}) -> (LR{B} (L{B} LL{B} LRL{B})) (P{B} LRR{B} R{B})
-            assert(left_l.color() == BLACK);
-            return std::make_pair(0,
-                                  Ops::with_left_right_color(left_r,
-                                                             Ops::with_right(left,
-                                                                             Ops::left(left_r)),
-                                                             Ops::with_left(parent,
-                                                                            Ops::right(left_r)),
-                                                             BLACK));
-          }
-          else
-          {
-            // (P{B} (L{B} LL{B} LR{B}) R{B}) -> (P{B} (L{R} LL{B} LR{B}) R{B})
-            // still -1
-            assert(left_l.color() == BLACK);
-            assert(left_r.color() == BLACK);
-            return std::make_pair(-1,
-                                  Ops::with_left(parent,
-                                                 with_color(left, RED)));
-          }
-        }
-      }
-
-      static deltatree_t black_fixup_left(rb_tree const& new_parent) {
-        return black_fixup_right_impl<lhs_ops>(new_parent);
-      }
-
-      template <typename Ops>
-      deltatree_t black_erase_right_impl(key_value_type const& v) const
-      {
-        auto new_right = Ops::right(*this).erase_impl(v);
-
-        if (new_right.first == 0)
-        {
-          return std::make_pair(0, Ops::with_right(*this,
-                                                   std::move(new_right.second)));
-        }
-        else
-        {
-          return black_fixup_right_impl<Ops>(Ops::with_right(*this,
-                                                             std::move(new_right.second)));
-        }
-      }
-
-      deltatree_t black_erase_impl(key_value_type const& v) const
-      {
-        assert(color() == BLACK);
-
-        if (key_less(v, keyval()))
-        {
-          return black_erase_right_impl<lhs_ops>(v);
-        }
-        else if (key_less(keyval(), v))
-        {
-          return black_erase_right_impl<rhs_ops>(v);
-        }
-        else
-        {
-          if (left().empty())
-          {
-            if (right().empty())
-            {
-              return std::make_pair(-1, empty_tree());
-            }
-            else
-            {
-              // Since empty(left), right must be a red leaf. No change in black depth.
-              return std::make_pair(0, with_color(right(), BLACK));
-            }
-          }
-          else if (right().empty())
-          {
-            assert(!left().empty());
-            // Since empty(right), left must be a red leaf. No change in black depth.
-            return std::make_pair(0, with_color(left(), BLACK));
-          }
-          else
-          {
-            assert(!left().empty() && !right().empty());
-            auto predecessor_kv = left().find_max();
-            auto new_left = left().erase_impl(*predecessor_kv);
-            auto relabeled_t = with_left_right_keyval(*this, std::move(new_left.second), rb_tree(right()), std::move(key_value_type(*predecessor_kv)));
-            if (new_left.first == 0)
-            {
-              return std::make_pair(0, std::move(relabeled_t));
-            }
-            else
-            {
-              return black_fixup_left(relabeled_t);
-            }
-          }
-        }
-      }
-
-      template <typename Ops>
-      static deltatree_t red_fixup_right_impl(rb_tree const& parent/*_with_new_right*/)
-      {
-        assert(parent.color() == RED);
-        assert(Ops::left(parent).color() == BLACK);
-        assert(Ops::right(parent).color() == BLACK);
-
-        rb_tree const& left = Ops::left(parent);
-        rb_tree const& left_l = Ops::left(left);
-        rb_tree const& left_r = Ops::right(left);
-
-        if (left_l.color() == RED)
-        {
-          // (P{R} (L{B} LL{R} LR{?}) R{B}) -> (L{R} LL{B} (P{B} LR{?} R{B}))
-          return std::make_pair(0,
-                                Ops::with_left_right_color(left,
-                                                           with_color(left_l, BLACK),
-                                                           Ops::with_left_right_color(parent,
-                                                                                      left_r,
-                                                                                      Ops::right(parent),
-                                                                                      BLACK),
-                                                           RED));
-        }
-        else if (left_r.color() == RED)
-        {
-          // (P{R} (L{B} LL{?} LR{R}) R{B}) -> (LR{R} (L{B} LL{?} LRL{B}) (P{B} LRR{B} R{B}))
-          return std::make_pair(0,
-                                Ops::with_left_right(left_r,
-                                                     Ops::with_right(left,
-                                                                     Ops::left(left_r)),
-                                                     Ops::with_left_right_color(parent,
-                                                                                Ops::right(left_r),
-                                                                                Ops::right(parent),
-                                                                                BLACK)));
-        }
-        else
-        {
-          // (P{R} (L{B} LL{B} LR{B}) R{B}) -> (P{B} L{R} R{B})
-          return std::make_pair(0,
-                                Ops::with_left_right_color(parent,
-                                                           with_color(left, RED),
-                                                           Ops::right(parent),
-                                                           BLACK));
-        }
-      }
-
-      static deltatree_t red_fixup_left(rb_tree const& new_parent) {
-        return red_fixup_right_impl<lhs_ops>(new_parent);
-      }
-
-      template <typename Ops>
-      deltatree_t red_erase_right_impl(key_value_type const& v) const
-      {
-        auto new_right = Ops::right(*this).erase_impl(v);
-
-        if (new_right.first == 0)
-        {
-          return std::make_pair(0, Ops::with_right(*this,
-                                                   std::move(new_right.second)));
-        }
-        else
-        {
-          return red_fixup_right_impl<Ops>(Ops::with_right(*this,
-                                                           std::move(new_right.second)));
-        }
-      }
-
-      deltatree_t red_erase_impl(key_value_type const& v) const
-      {
-        if (key_less(v, keyval()))
-        {
-          return red_erase_right_impl<lhs_ops>(v);
-        }
-        else if (key_less(keyval(), v))
-        {
-          return red_erase_right_impl<rhs_ops>(v);
-        }
-        else
-        {
-          // deleting t
-          if (left().empty())
-          {
-            assert(right().empty());
-            return std::make_pair(0, empty_tree());
-          }
-          else
-          {
-            assert(!right().empty());
-            auto predecessor_kv = left().find_max();
-            auto new_left = left().erase_impl(*predecessor_kv);
-            auto relabeled_t = with_left_right_keyval(*this, std::move(new_left.second), rb_tree(right()), std::move(key_value_type(*predecessor_kv)));
-            if (new_left.first == 0)
-            {
-              return std::make_pair(0, std::move(relabeled_t));
-            }
-            else
-            {
-              return red_fixup_left(relabeled_t);
-            }
-          }
-        }
-      }
-
-      typedef std::pair<rb_shape_t, rb_tree> shapetree_t;
-
-      static rb_color_t rb_shape_parent(rb_shape_t s)
-      {
-        return static_cast<rb_color_t>(!!(s & 4));
-      }
-
-      static rb_color_t rb_shape_left(rb_shape_t s)
-      {
-        return static_cast<rb_color_t(!!(s & 2));
-      }
-
-      static rb_color_t rb_shape_right(rb_shape_t s)
-      {
-        return static_cast<rb_color_t(!!(s & 1));
-      }
-
-      static bool rb_check_shape(rb_shape_t s, rb_tree const& t)
-      {
-        if (t.empty())
-          return s == BBB;
-
-        return rb_shape_parent(s) == color() && rb_shape_left(s) == left().color() && rb_shape_right(s) == rigtht().color();
-      }
-
-      static shapetree_t shape_checked(shapetree_t st)
-      {
-        assert(rb_check_shape(st.first, st.second));
-        return st;
-      }
-
-      template <typename Ops>
-      shapetree_t insert_impl(key_value_type&& v, rb_color_t sibling_color) const
-      {
-        if (empty())
-        {
-          return std::make_pair(RBB,
-                                rb_tree(std::move(v), RED));
-        }
-
-        // paranoid? use shape_checked(..._insert_impl(...)) below.
-
-        if (color() == BLACK)
-        {
-          return black_insert_impl(std::move(v));
-        }
-        else
-        {
-          return red_insert_impl<Ops>(std::move(v), sibling_color);
-        }
-      }
-
-      // special case for red parent nodes
-      shapetree_t black_or_empty_insert_impl(key_value_type&& v) const
-      {
-        return empty() ?
-          std::make_pair(RBB, rb_tree(std::move(v), RED)) :
-          black_insert_impl(std::move(v));
-      }
-
-      template <typename Ops>
-      shapetree_t black_insert_right_impl(key_value_type&& v) const
-      {
-        auto left_color = Ops::left(*this).color();
-        auto new_right = Ops::right(*this).insert_impl<Ops>(std::move(v), left_color);
-
-        if (new_right.first == Ops::shape_RRB())
-        {
-          // child will rotate RRB to RBR if sibling_color (left_color here) is black
-          assert(left_color == RED);
-          // (T{B} L{R} R{?})
-          // (T{B} L{R} (R*{R} RL*{R} RR*{B})) -> (T{R} L{B} R*{B})
-          return std::make_pair(RBB,
-                                Ops::with_left_right_color(*this,
-                                                           with_color(Ops::left(*this), BLACK),
-                                                           // FIXME: move new_right?
-                                                           with_color(new_right.second, BLACK),
-                                                           RED));
-        }
-        else if (new_right.first == Ops::shape_RBR())
-        {
-          // (T{B} L{?} R{?}
-          if (left_color == BLACK)
-          {
-            // (T{B} L{B} (R*{R} RL*{B} RR*{R})) -> (R*{B} (T{R} L RL*) RR*)
-            return std::make_pair(BRR,
-                                  // FIXME: move new_right
-                                  Ops::with_left_right_color(new_right.second,
-                                                             Ops::with_left_right_color(*this,
-                                                                                        Ops::left(*this),
-                                                                                        Ops::left(new_right.second),
-                                                                              RED),
-                                                             Ops::right(new_right.second),
-                                                             BLACK));
-          }
-          else
-          {
-            // (T{B} L{R} (R*{R} RL*{B} RR*{R})) -> (T{R} L{B} R*{B})
-            return std::make_pair(RBB,
-                                  Ops::with_left_right_color(*this,
-                                                             with_color(Ops::left(*this), BLACK),
-                                                             with_color(new_right.second, BLACK),
-                                                             RED));
-          }
-        }
-        else
-        {
-          // (T{B} L{?} R{?})
-          // (T L R*) -> (T L R*)
-          return std::make_pair(Ops::rb_mk_shape(BLACK, left_color, rb_shape_parent(new_right.first)),
-                                Ops::with_right(*this, std::move(new_right.second)));
-        }
-      }
-
-      shapetree_t black_insert_impl(key_value_type&& v) const
-      {
-        if (key_less(v, keyval()))
-        {
-          return black_insert_right_impl<lhs_ops>(std::move(v));
-        }
-        else if (key_less(keyval(), v))
-        {
-          return black_insert_right_impl<rhs_ops>(std::move(v));
-        }
-        else
-        {
-          // (T{B} L{?} R{?}) -> (T{val = v} L R)
-          return std::make_pair(rb_mk_shape(BLACK, left().color(), right().color()),
-                                with_keyval(*this, std::move(v)));
-        }
-      }
-
-      template <typename Ops>
-      shapetree_t red_insert_impl(key_value_type&& v, rb_color_t sibling_color) const
-      {
-        // (T{R} L{B} R{B})
-        assert(color() == RED);
-
-        if (Ops::key_less(v, keyval()))
-        {
-          // As t is red, t.left() is black ...
-          auto new_left = Ops::left(*this).black_or_empty_insert_impl(std::move(v));
-
-          // no change causes three consecutive RED nodes, only have to consider these cases
-          assert(rb_shape_parent(new_left.first) == BLACK || new_left.first == RBB);
-
-          if (new_left.first == RBB && sibling_color == BLACK)
-          {
-              // (T{R} (L*{R} LL*{B} LR*{B}) R{B}) -> (L*{R} LL*{B} (T{R} LR*{B} R{B}))
-            // FIXME: new_left.second moved? steal keyval...
-            return std::make_pair(Ops::shape_RBR(),
-                                  Ops::with_right(new_left.second,
-                                                  Ops::with_left(*this, Ops::right(new_left.second))));
-          }
-          else
-          {
-            // (T{R} L*{R} R{B}) -> (T{R} L*{R} R{B}) - new_left.first == RBB && sibling_color == RED
-            // or
-            // (T{R} L*{B} R{B}) -> (T{R} L*{B} R{B}) - rb_shape_parent(new_left.first) == BLACK
-            return std::make_pair(Ops::rb_mk_shape(RED, rb_shape_parent(new_left.first), BLACK),
-                                  Ops::with_left(*this, std::move(new_left.second)));
-          }
-        }
-        else if (Ops::key_less(keyval(), v))
-        {
-          // As t is red, t.right() is black ...
-          auto new_right = Ops::right(*this).black_or_empty_insert_impl(std::move(v));
-
-          // no change causes three consecutive RED nodes, only have to consider these cases
-          assert(rb_shape_parent(new_right.first) == BLACK || new_right.first == RBB);
-
-          // (T{R} L{B} R*{R}) -> (T{R} L{B} R*{R})
-          // or
-          // (T{R} L{B} R*{B}) -> (T{R} L{B} R*{B})
-          return std::make_pair(Ops::rb_mk_shape(RED, BLACK, rb_shape_parent(new_right.first)),
-                                Ops::with_right(*this, std::move(new_right.second)));
-        }
-        else
-        {
-          // (T{R} L{B} R{B}) -> (T{R, val = v}, L{B} R{B})
-          return std::make_pair(RBB,
-                                with_keyval(*this, std::move(v)));
-        }
-      }
-
-    protected:
-      static rb_tree with_color(rb_tree const& t, rb_color_t color) {
-        return with_impl(t, color);
-      }
-
-      static rb_tree with_left_right_color(rb_tree const& t, rb_tree left, rb_tree right, rb_color_t color) {
-        return with_left_right_impl_data(t, std::move(left), std::move(right), color);
-      }
-
-      rb_tree(key_value_type&& keyval, rb_color_t clr)
-        : bst_base(std::move(keyval), clr)
-      {}
-      rb_tree(key_value_type&& keyval, rb_tree&& l, rb_tree&& r, rb_color_t clr = rb_color_t())
-        : bst_base(std::move(keyval), std::move(l), std::move(r), clr)
-      {}
-    };
-  }
-}
-
-#endif // PST_TREE_H__
-
+#pragma once
+
+#ifndef PST_TREE_H__
+#define PST_TREE_H__
+
+#include <memory> // allocators
+#include <functional> // less, equal_to
+#include <algorithm> // swap
+#include <cassert> // assert...
+#include <cstddef> // size_t
+#include <cstdint> // uintptr_t
+#include <iterator> // distance
+#include <vector>
+#include "detail.h"
+#include "compare.h"
+#include "refcount.h"
+#include "payload.h"
+#include "augment.h"
+#include "parallel.h"
+#include "tree_iterator.h"
+#include "finger.h"
+
+namespace pst
+{
+  namespace tree
+  {
+    template <typename Derived,
+              typename KeyValT,
+              typename Compare = std::less<KeyValT>,
+              typename Augment = no_augment,
+              typename Alloc = std::allocator<KeyValT>,
+              typename RefCount = atomic_refcount,
+              typename Storage = inline_payload>
+    struct PST_EMPTY_BASES bst_base
+      : private pst::detail::ebo_holder<Compare>,
+        private pst::detail::ebo_holder<Alloc>
+    {
+      typedef Derived tree_type;
+      typedef KeyValT key_value_type;
+      typedef Compare key_compare;
+      typedef Alloc allocator_type;
+      typedef Augment augment_policy;
+      typedef typename Augment::summary_type summary_type;
+      typedef summary_type impl_data_type;
+      typedef RefCount refcount_policy;
+      typedef Storage storage_policy;
+      typedef unsigned tag_type;
+      typedef tree_iterator<tree_type> iterator;
+      typedef iterator const_iterator;
+      typedef std::reverse_iterator<iterator> reverse_iterator;
+      typedef tree_finger<tree_type> finger; // lookups near the last, see tree_finger
+
+      struct link;
+      struct subtree_ref;
+
+      friend bool operator==(tree_type const& lhs, tree_type const& rhs) {
+        return lhs.root_link() == rhs.root_link();
+      }
+
+      friend bool operator!=(tree_type const& lhs, tree_type const& rhs) {
+        return !(lhs == rhs);
+      }
+
+      static tree_type empty_tree() { return tree_type(); }
+
+      static tree_type empty_tree(key_compare const& comp, allocator_type const& alloc = allocator_type()) {
+        return tree_type(comp, alloc);
+      }
+
+      // An empty tree ordered and allocated like orig.
+      static tree_type empty_like(subtree_ref const& orig) {
+        return tree_type(orig.key_comp(), orig.get_allocator());
+      }
+
+      bool empty() const { return root.empty(); }
+
+      key_value_type const& keyval() const { return root.keyval(); }
+
+      // the augmentation summary of the tree (see augment.h)
+      summary_type const& summary() const { return root.summary(); }
+
+      key_value_type keyval_copy() const { return keyval(); }
+
+      std::size_t size() const { return root.size(); }
+
+      std::size_t depth() const { return root.depth(); }
+
+      key_value_type const* find(key_value_type const& kv) const { return find_key(kv); }
+
+      // Lookups also take keys of other types where the comparator does
+      // (has is_transparent), so that the caller need not build a
+      // key/value to compare with; see rb_map::find.
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      key_value_type const* find(Key const& key) const { return find_key(key); }
+
+      key_value_type const* find_min() const { return root.find_min(); }
+
+      key_value_type const* find_max() const { return root.find_max(); }
+
+      // In-order iteration, both ways, without allocating; see
+      // tree_iterator. The iterators point into this handle and are valid
+      // while it is.
+      iterator begin() const { return iterator(*static_cast<tree_type const*>(this)); }
+      iterator end() const { return iterator::end_of(*static_cast<tree_type const*>(this)); }
+      reverse_iterator rbegin() const { return reverse_iterator(end()); }
+      reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+      // Calls f with each value in order. For a scan of the whole tree
+      // this beats the iterators, which test on every step whether to go
+      // down or up.
+      template <typename F>
+      void for_each(F f) const { for_each_impl(root, f); }
+
+      // Ordered lookups, each a single descent from the root that leaves
+      // an iterator at the value found, so that a scan can go on from
+      // there; end() if there is none.
+      //
+      //   lower_bound, ceiling  the first value not before key
+      //   upper_bound           the first value after key
+      //   floor                 the last value not after key
+      //   equal_range           [lower_bound, upper_bound)
+      iterator lower_bound(key_value_type const& kv) const { return lower_bound_key(kv); }
+      iterator upper_bound(key_value_type const& kv) const { return upper_bound_key(kv); }
+      iterator floor(key_value_type const& kv) const { return floor_key(kv); }
+      iterator ceiling(key_value_type const& kv) const { return lower_bound_key(kv); }
+      std::pair<iterator, iterator> equal_range(key_value_type const& kv) const { return equal_range_key(kv); }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      iterator lower_bound(Key const& key) const { return lower_bound_key(key); }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      iterator upper_bound(Key const& key) const { return upper_bound_key(key); }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      iterator floor(Key const& key) const { return floor_key(key); }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      iterator ceiling(Key const& key) const { return lower_bound_key(key); }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      std::pair<iterator, iterator> equal_range(Key const& key) const { return equal_range_key(key); }
+
+      // the link to the root node, where walks over the tree start
+      link const& root_link() const { return root; }
+
+      // The comparator and allocator a tree was created with are carried
+      // along to every version derived from it; for stateless types they
+      // take no space. Only handles keep them, the links between nodes
+      // do not (see link).
+      key_compare const& key_comp() const { return compare_holder::get(); }
+      allocator_type get_allocator() const { return allocator_holder::get(); }
+
+      bool key_less(key_value_type const& lhs, key_value_type const& rhs) const { return key_comp()(lhs, rhs); }
+
+      // negative, zero or positive as lhs is before, equivalent to or
+      // after rhs; a single comparator call if it compares three ways (see
+      // three_way)
+      int key_order(key_value_type const& lhs, key_value_type const& rhs) const { return pst::detail::compare3(key_comp(), lhs, rhs); }
+
+      // the same with keys of other types, see find
+      template <typename Lhs, typename Rhs>
+      bool key_less(Lhs const& lhs, Rhs const& rhs) const { return key_comp()(lhs, rhs); }
+
+      template <typename Lhs, typename Rhs>
+      int key_order(Lhs const& lhs, Rhs const& rhs) const { return pst::detail::compare3(key_comp(), lhs, rhs); }
+
+    protected:
+      // Nodes are intrusively reference counted (see refcount.h).
+      typedef typename storage_policy::template holder<key_value_type, allocator_type, refcount_policy> payload_type;
+
+      struct impl_t;
+
+      typedef typename allocator_type::template rebind<impl_t>::other impl_allocator;
+      typedef std::allocator_traits<impl_allocator> impl_allocator_traits;
+      typedef pst::detail::node_links<impl_t, impl_allocator, allocator_type> node_links;
+      typedef typename node_links::link_type link_type;
+
+      static link_type const tag_mask = 1;
+
+    public:
+      // A single word linking to a node, an address or a slab index (see
+      // detail::node_links), what a node keeps for each child and a handle
+      // for its root. The low bit of the word is free for the derived tree
+      // to tag the link with (rb_tree keeps the color there), so
+      // recoloring a subtree does not need a new node.
+      //
+      // A link holds a reference to its node but does not drop it when it
+      // goes away: nodes go back to the allocator, and only the handle at
+      // the root keeps one (see release). So links only move, and only
+      // into empty links.
+      struct link
+      {
+        link() : bits(0) {}
+        link(link&& other) : bits(other.bits) { other.bits = 0; }
+
+        link& operator=(link&& other) {
+          assert(empty() && "link: the reference held would be lost");
+          bits = other.bits;
+          other.bits = 0;
+          return *this;
+        }
+
+        bool empty() const { return !node(); }
+
+        key_value_type const& keyval() const { return node()->payload.get(); }
+
+        summary_type const& summary() const
+        {
+          static summary_type const identity = augment_policy::identity();
+          return empty() ? identity : node()->impl_data();
+        }
+
+        link const& left() const { return node()->left; }
+        link const& right() const { return node()->right; }
+
+        impl_t const* node() const { return node_links::address(bits & ~tag_mask); }
+        tag_type tag() const { return static_cast<tag_type>(bits & tag_mask); }
+
+        std::size_t size() const {
+          return empty() ? 0 : (1 + left().size() + right().size());
+        }
+
+        std::size_t depth() const
+        {
+          return empty() ? 0 : (1 + std::max(left().depth(), right().depth()));
+        }
+
+        key_value_type const* find_min() const
+        {
+          link const* t = this;
+          if (t->empty()) {
+            return 0;
+          }
+          while (!t->left().empty()) {
+            t = &t->left();
+          }
+          return &t->keyval();
+        }
+
+        key_value_type const* find_max() const
+        {
+          link const* t = this;
+          if (t->empty()) {
+            return 0;
+          }
+          while (!t->right().empty()) {
+            t = &t->right();
+          }
+          return &t->keyval();
+        }
+
+        // by the node linked to, whatever the tag
+        friend bool operator==(link const& lhs, link const& rhs) {
+          return lhs.node() == rhs.node();
+        }
+
+        friend bool operator!=(link const& lhs, link const& rhs) {
+          return !(lhs == rhs);
+        }
+
+      private:
+        friend struct bst_base;
+
+        link(link const&);
+        link& operator=(link const&);
+
+        link_type bits;
+      };
+
+      // A subtree as the node makers below and the derived trees'
+      // algorithms take it: a link in some tree, with a handle of that tree
+      // for the comparator and allocator, which the nodes do not keep. It
+      // is valid while the handle is; the derived trees' subtree adds the
+      // walks down to the children.
+      struct subtree_ref
+      {
+        typedef KeyValT key_value_type;
+
+        subtree_ref(tree_type const& t) : cx(&t), l(&t.root_link()) {}
+        subtree_ref(tree_type const& cx, link const& l) : cx(&cx), l(&l) {}
+
+        bool empty() const { return l->empty(); }
+        key_value_type const& keyval() const { return l->keyval(); }
+        summary_type const& summary() const { return l->summary(); }
+        tag_type tag() const { return l->tag(); }
+        std::size_t size() const { return l->size(); }
+        key_value_type const* find_max() const { return l->find_max(); }
+
+        tree_type const& context() const { return *cx; }
+        link const& root_link() const { return *l; }
+
+        key_compare const& key_comp() const { return cx->key_comp(); }
+        allocator_type get_allocator() const { return cx->get_allocator(); }
+
+        bool key_less(key_value_type const& lhs, key_value_type const& rhs) const { return cx->key_less(lhs, rhs); }
+        int key_order(key_value_type const& lhs, key_value_type const& rhs) const { return cx->key_order(lhs, rhs); }
+
+        template <typename Lhs, typename Rhs>
+        bool key_less(Lhs const& lhs, Rhs const& rhs) const { return cx->key_less(lhs, rhs); }
+
+        template <typename Lhs, typename Rhs>
+        int key_order(Lhs const& lhs, Rhs const& rhs) const { return cx->key_order(lhs, rhs); }
+
+      protected:
+        tree_type const* cx;
+        link const* l;
+      };
+
+    protected:
+      // recursion on the left only, the right spine is a loop
+      template <typename F>
+      static void for_each_impl(link const& l, F& f)
+      {
+        for (link const* t = &l; !t->empty(); t = &t->right()) {
+          for_each_impl(t->left(), f);
+          f(t->keyval());
+        }
+      }
+
+      template <typename Key>
+      iterator lower_bound_key(Key const& key) const
+      {
+        return iterator::first_where(*static_cast<tree_type const*>(this), [this, &key](key_value_type const& kv) { return !key_less(kv, key); });
+      }
+
+      template <typename Key>
+      iterator upper_bound_key(Key const& key) const
+      {
+        return iterator::first_where(*static_cast<tree_type const*>(this), [this, &key](key_value_type const& kv) { return key_less(key, kv); });
+      }
+
+      template <typename Key>
+      iterator floor_key(Key const& key) const
+      {
+        return iterator::last_where(*static_cast<tree_type const*>(this), [this, &key](key_value_type const& kv) { return !key_less(key, kv); });
+      }
+
+      // keys are unique, so the range holds at most the lower bound
+      template <typename Key>
+      std::pair<iterator, iterator> equal_range_key(Key const& key) const
+      {
+        iterator const first = lower_bound_key(key);
+        iterator last = first;
+        if (last != end() && !key_less(key, *last)) {
+          ++last;
+        }
+        return std::make_pair(first, last);
+      }
+
+      // One comparison per level. The step down stays a branch: picking
+      // the child with a conditional move makes each load wait on the
+      // comparison before it, and measured slower on trees that do not fit
+      // in cache.
+      template <typename Key>
+      key_value_type const* find_key(Key const& key) const
+      {
+        for (link const* t = &root; !t->empty();) {
+          int const order = key_order(key, t->keyval());
+          if (order < 0) {
+            t = &t->left();
+          }
+          else if (order > 0) {
+            t = &t->right();
+          }
+          else {
+            return &t->keyval();
+          }
+        }
+        return 0;
+      }
+
+      typedef pst::detail::ebo_holder<key_compare> compare_holder;
+      typedef pst::detail::ebo_holder<allocator_type> allocator_holder;
+
+      bst_base() {}
+      bst_base(key_compare const& comp, allocator_type const& alloc) : compare_holder(comp), allocator_holder(alloc) {}
+      bst_base(bst_base&& other) : compare_holder(static_cast<compare_holder const&>(other)), allocator_holder(static_cast<allocator_holder const&>(other)), root(std::move(other.root)) {}
+      bst_base(bst_base const& other) : compare_holder(static_cast<compare_holder const&>(other)), allocator_holder(static_cast<allocator_holder const&>(other)) { root.bits = other.root.bits; retain(root); }
+
+      // a handle of its own to the subtree s, ordered and allocated like
+      // the tree it is in
+      bst_base(subtree_ref const& s) : compare_holder(s.key_comp()), allocator_holder(s.get_allocator()) { root.bits = s.root_link().bits; retain(root); }
+
+      // the nodes are released with the allocator they came from, so the
+      // allocators are exchanged along with the nodes
+      bst_base& operator=(bst_base&& other) {
+        std::swap(static_cast<compare_holder&>(*this), static_cast<compare_holder&>(other));
+        std::swap(static_cast<allocator_holder&>(*this), static_cast<allocator_holder&>(other));
+        std::swap(root.bits, other.root.bits);
+        return *this;
+      }
+
+      bst_base& operator=(bst_base const& other) {
+        link_type other_bits = other.root.bits;
+        retain(other.root);
+        release(root);
+        static_cast<compare_holder&>(*this) = other;
+        static_cast<allocator_holder&>(*this) = other;
+        root.bits = other_bits;
+        return *this;
+      }
+
+      struct impl_t : private pst::detail::ebo_holder<impl_data_type>
+      {
+        impl_t(payload_type&& payload, link&& left, link&& right, impl_data_type impl_data)
+          : pst::detail::ebo_holder<impl_data_type>(std::move(impl_data)),
+            refs(1),
+            payload(std::move(payload)),
+            left(std::move(left)),
+            right(std::move(right))
+        {}
+
+        impl_data_type const& impl_data() const { return this->get(); }
+        impl_data_type& impl_data() { return this->get(); }
+
+        // only changed in place by a transient that owns the node alone
+        mutable typename refcount_policy::count_type refs;
+        payload_type payload;
+        link left, right;
+
+      private:
+        impl_t(impl_t const&);
+        impl_t& operator=(impl_t const&);
+      };
+
+      ~bst_base() { release(root); }
+
+      impl_t const* node() const { return root.node(); }
+      tag_type tag() const { return root.tag(); }
+
+      // whether nodes keep a summary that needs redoing after edits in place
+      static bool const augmented = !std::is_empty<impl_data_type>::value;
+
+      // A single node with empty children, ordered and allocated like at.
+      static tree_type leaf(subtree_ref const& at, key_value_type&& keyval, tag_type tag = 0) {
+        return branch(at, std::move(keyval), empty_like(at), empty_like(at), tag);
+      }
+
+      // A new node over the given children, ordered and allocated like at.
+      static tree_type branch(subtree_ref const& at, key_value_type&& keyval, tree_type&& left, tree_type&& right, tag_type tag = 0) {
+        return make_tree(at, payload_type(std::move(keyval), at.get_allocator()), std::move(left), std::move(right), tag);
+      }
+
+      // A handle of its own to the subtree at l, which must be in a tree
+      // ordered and allocated like this one.
+      tree_type share(link const& l) const {
+        return tree_type(subtree_ref(*static_cast<tree_type const*>(this), l));
+      }
+
+      // In-place editing, for transients (see rb_tree::transient). A node
+      // may only be changed while its link is reached from a handle the
+      // editor owns through nothing but unique nodes; the handle supplies
+      // the allocator for the nodes copied and dropped.
+      link& edit_root() { return root; }
+
+      static bool unique(link const& l) { return refcount_policy::unique(l.node()->refs); }
+
+      // gives the link a node of its own, copying the node if it is shared
+      void unshare(link& l) const {
+        if (!unique(l)) {
+          tree_type t(with_left_right(subtree_ref(*static_cast<tree_type const*>(this), l), share(l.left()), share(l.right())));
+          assign(l, std::move(t));
+        }
+      }
+
+      // drops what l links to and moves t into it
+      void assign(link& l, tree_type&& t) const {
+        release(l);
+        l = std::move(static_cast<bst_base&>(t).root);
+      }
+
+      static impl_t* edit_node(link& l) {
+        assert(unique(l));
+        return const_cast<impl_t*>(l.node());
+      }
+
+      // redoes the summary of an owned node after its children or
+      // key/value were changed in place
+      static void refresh(link& l) {
+        impl_t* n = edit_node(l);
+        n->impl_data() = augment_policy::summarize(n->left.summary(), n->payload.get(), n->right.summary());
+      }
+
+      static void set_tag(link& l, tag_type tag) {
+        assert(!l.empty() || tag == 0);
+        l.bits = static_cast<link_type>((l.bits & ~tag_mask) | tag);
+      }
+
+      static tree_type with_tag(subtree_ref const& orig, tag_type tag) {
+        assert(!orig.empty() || tag == 0);
+        tree_type t(orig);
+        set_tag(static_cast<bst_base&>(t).root, tag);
+        return t;
+      }
+
+      static tree_type with_left(subtree_ref const& orig, tree_type&& left) {
+        return make_tree(orig, payload(orig).share(), std::move(left), child(orig, orig.root_link().right()), orig.tag());
+      }
+
+      static tree_type with_right(subtree_ref const& orig, tree_type&& right) {
+        return make_tree(orig, payload(orig).share(), child(orig, orig.root_link().left()), std::move(right), orig.tag());
+      }
+
+      static tree_type with_left_right(subtree_ref const& orig, tree_type&& left, tree_type&& right) {
+        return make_tree(orig, payload(orig).share(), std::move(left), std::move(right), orig.tag());
+      }
+
+      static tree_type with_left_right_tag(subtree_ref const& orig, tree_type&& left, tree_type&& right, tag_type tag) {
+        return make_tree(orig, payload(orig).share(), std::move(left), std::move(right), tag);
+      }
+
+      static tree_type with_keyval(subtree_ref const& orig, key_value_type&& keyval) {
+        return make_tree(orig, payload_type(std::move(keyval), orig.get_allocator()), child(orig, orig.root_link().left()), child(orig, orig.root_link().right()), orig.tag());
+      }
+
+      static tree_type with_left_right_keyval(subtree_ref const& orig, tree_type&& left, tree_type&& right, key_value_type&& keyval) {
+        return make_tree(orig, payload_type(std::move(keyval), orig.get_allocator()), std::move(left), std::move(right), orig.tag());
+      }
+
+      // drops the reference l holds, with this tree's allocator; l is
+      // left empty
+      void release(link& l) const
+      {
+        link_type const bits = static_cast<link_type>(l.bits & ~tag_mask);
+        impl_t* p = const_cast<impl_t*>(l.node());
+        l.bits = 0;
+        if (p && refcount_policy::decrement(p->refs)) {
+          destroy_node(bits, p, trivial_release());
+        }
+      }
+
+    private:
+      // Nodes allocated from a monotonic allocator (see arena.h) are never
+      // freed one by one; when destroying them does nothing either, the
+      // last reference to a subtree can be dropped without visiting it.
+      typedef std::integral_constant<bool,
+                                     pst::detail::is_monotonic<allocator_type>::value &&
+                                     std::is_trivially_destructible<key_value_type>::value &&
+                                     std::is_trivially_destructible<impl_data_type>::value> trivial_release;
+
+      static payload_type const& payload(subtree_ref const& orig) { return orig.root_link().node()->payload; }
+
+      // a child of orig as a handle of its own
+      static tree_type child(subtree_ref const& orig, link const& l) {
+        return tree_type(subtree_ref(orig.context(), l));
+      }
+
+      // the summary of the new node is made from its parts here, so every
+      // way of making a node keeps it right
+      static tree_type make_tree(subtree_ref const& state, payload_type&& payload, tree_type&& left, tree_type&& right, tag_type tag)
+      {
+        assert(tag <= tag_mask);
+        impl_data_type impl_data = augment_policy::summarize(left.summary(), payload.get(), right.summary());
+        tree_type t(empty_like(state));
+        static_cast<bst_base&>(t).root.bits = static_cast<link_type>(t.make_node(std::move(payload), std::move(left), std::move(right), std::move(impl_data)) | tag);
+        return t;
+      }
+
+      link_type make_node(payload_type&& payload, tree_type&& left, tree_type&& right, impl_data_type impl_data) const
+      {
+        impl_allocator alloc(get_allocator());
+        link_type l = node_links::allocate(alloc);
+        try {
+          impl_allocator_traits::construct(alloc, node_links::address(l), std::move(payload),
+                                           std::move(static_cast<bst_base&>(left).root), std::move(static_cast<bst_base&>(right).root),
+                                           std::move(impl_data));
+        }
+        catch (...) {
+          node_links::deallocate(alloc, l);
+          throw;
+        }
+        return l;
+      }
+
+      static void retain(link const& l)
+      {
+        if (impl_t const* p = l.node()) {
+          refcount_policy::increment(p->refs);
+        }
+      }
+
+      // the children go first, their links in the node cannot drop them
+      void destroy_node(link_type l, impl_t* p, std::false_type) const
+      {
+        release(p->left);
+        release(p->right);
+        impl_allocator alloc(get_allocator());
+        impl_allocator_traits::destroy(alloc, p);
+        node_links::deallocate(alloc, l);
+      }
+
+      void destroy_node(link_type, impl_t*, std::true_type) const {}
+
+      link root;
+    };
+
+    template <typename T,
+              typename Compare = std::less<T>,
+              typename Alloc = std::allocator<T>,
+              typename RefCount = atomic_refcount,
+              typename Storage = inline_payload>
+    struct bs_tree : public bst_base<bs_tree<T, Compare, Alloc, RefCount, Storage>, T, Compare, no_augment, Alloc, RefCount, Storage>
+    {
+      typedef bst_base<bs_tree<T, Compare, Alloc, RefCount, Storage>, T, Compare, no_augment, Alloc, RefCount, Storage> base_type;
+      typedef typename base_type::key_value_type key_value_type;
+      typedef typename base_type::link link;
+
+      using base_type::empty;
+      using base_type::keyval;
+      using base_type::keyval_copy;
+      using base_type::key_less;
+      using base_type::key_order;
+
+      typedef typename base_type::key_compare key_compare;
+      typedef typename base_type::allocator_type allocator_type;
+
+      class subtree;
+
+      bs_tree() {}
+      explicit bs_tree(key_compare const& comp, allocator_type const& alloc = allocator_type()) : base_type(comp, alloc) {}
+      bs_tree(bs_tree&& other) : base_type(std::move(other)) {}
+      bs_tree(bs_tree const& other) : base_type(other) {}
+      bs_tree(typename base_type::subtree_ref const& s) : base_type(s) {}
+
+      bs_tree& operator=(bs_tree&& other) {
+        base_type::operator=(std::move(other));
+        return *this;
+      }
+
+      bs_tree& operator=(bs_tree const& other) {
+        base_type::operator=(other);
+        return *this;
+      }
+
+      subtree left() const { return subtree(*this).left(); }
+      subtree right() const { return subtree(*this).right(); }
+
+      bs_tree insert(key_value_type&& v) const {
+        return subtree(*this).insert_impl(std::move(v));
+      }
+
+      bs_tree insert(key_value_type const& v) const {
+        return subtree(*this).insert_impl(std::move(key_value_type(v)));
+      }
+
+      bs_tree erase(key_value_type const& v) const { return subtree(*this).erase(v); }
+
+      // A subtree of some bs_tree as insert and erase walk it, see
+      // bst_base::subtree_ref.
+      class subtree : public base_type::subtree_ref
+      {
+      public:
+        subtree(bs_tree const& t) : base_type::subtree_ref(t) {}
+        subtree(bs_tree const& cx, link const& l) : base_type::subtree_ref(cx, l) {}
+
+        using base_type::subtree_ref::empty;
+        using base_type::subtree_ref::keyval;
+        using base_type::subtree_ref::key_order;
+
+        subtree left() const { return subtree(*this->cx, this->l->left()); }
+        subtree right() const { return subtree(*this->cx, this->l->right()); }
+
+      private:
+        friend struct bs_tree;
+
+        bs_tree erase(key_value_type const& v) const
+        {
+          if (empty()) {
+            return *this;
+          }
+
+          int const order = key_order(v, keyval());
+          if (order < 0) {
+            return bs_tree::with_left(*this, left().erase(v));
+          }
+          else if (order > 0) {
+            return bs_tree::with_right(*this, right().erase(v));
+          }
+          else {
+            if (left().empty()) {
+              return right();
+            }
+            else if (right().empty()) {
+              return left();
+            }
+            else {
+              auto pred = left().find_max();
+              return bs_tree::with_left_right_keyval(*this, left().erase(*pred), bs_tree(right()), key_value_type(*pred));
+            }
+          }
+        }
+
+        bs_tree insert_impl(key_value_type&& v) const
+        {
+          if (empty()) {
+            return bs_tree::leaf(*this, std::move(v));
+          }
+
+          int const order = key_order(v, keyval());
+          if (order < 0) {
+            return bs_tree::with_left(*this, left().insert_impl(std::move(v)));
+          }
+          else if (order > 0) {
+            return bs_tree::with_right(*this, right().insert_impl(std::move(v)));
+          }
+          else {
+            return bs_tree::with_keyval(*this, std::move(v));
+          }
+        }
+      };
+    };
+
+    /**************************************************************/
+
+    enum rb_color_t { BLACK, RED };
+
+    template <typename T,
+              typename LessT = std::less<T>,
+              typename Alloc = std::allocator<T>,
+              typename RefCount = atomic_refcount,
+              typename Storage = inline_payload,
+              typename Augment = no_augment>
+    struct rb_tree : public bst_base<rb_tree<T, LessT, Alloc, RefCount, Storage, Augment>, T, LessT, Augment, Alloc, RefCount, Storage>
+    {
+      typedef bst_base<rb_tree<T, LessT, Alloc, RefCount, Storage, Augment>, T, LessT, Augment, Alloc, RefCount, Storage> base_type;
+      typedef typename base_type::key_value_type key_value_type;
+      typedef typename base_type::summary_type summary_type;
+      typedef typename base_type::link link;
+      typedef typename base_type::subtree_ref subtree_ref;
+
+      friend base_type;
+
+      using base_type::empty;
+      using base_type::empty_tree;
+      using base_type::keyval;
+      using base_type::key_less;
+      using base_type::key_order;
+
+      typedef typename base_type::key_compare key_compare;
+      typedef typename base_type::allocator_type allocator_type;
+
+      // Whether the parallel operations may be used. Their threads make
+      // and drop nodes at once, so the reference counts must be atomic and
+      // the allocator safe to share. std::allocator, pool_allocator and
+      // slab_allocator are; a monotonic one, such as arena_allocator, is
+      // not.
+      typedef std::integral_constant<bool,
+                                     std::is_same<RefCount, atomic_refcount>::value &&
+                                     !pst::detail::is_monotonic<Alloc>::value> parallel_safe;
+
+      class subtree;
+
+      rb_tree() {}
+      explicit rb_tree(key_compare const& comp, allocator_type const& alloc = allocator_type()) : base_type(comp, alloc) {}
+      rb_tree(rb_tree&& other) : base_type(std::move(other)) {}
+      rb_tree(rb_tree const& other) : base_type(other) {}
+      rb_tree(subtree_ref const& s) : base_type(s) {}
+
+      rb_tree& operator=(rb_tree&& other) {
+        base_type::operator=(std::move(other));
+        return *this;
+      }
+
+      rb_tree& operator=(rb_tree const& other) {
+        base_type::operator=(other);
+        return *this;
+      }
+
+      // The color lives in the tag bit of the link to the node, empty trees are black.
+      rb_color_t color() const { return static_cast<rb_color_t>(this->tag()); }
+
+      subtree left() const { return subtree(*this).left(); }
+      subtree right() const { return subtree(*this).right(); }
+
+      std::size_t bdepth() const { return subtree(*this).bdepth(); }
+
+      // O(1) when the augmentation counts elements (see size_augment),
+      // a walk over the tree otherwise
+      std::size_t size() const { return size_impl(counted()); }
+
+      // The number of values before v.
+      std::size_t rank(key_value_type const& v) const { return rank_key(v); }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      std::size_t rank(Key const& key) const { return rank_key(key); }
+
+      // The value with i values before it, or null if there are not that
+      // many values.
+      key_value_type const* select(std::size_t i) const
+      {
+        static_assert(counted::value, "select needs an augmentation that counts elements, such as size_augment");
+
+        for (subtree t = *this; !t.empty();) {
+          std::size_t const left_count = count(t.left());
+          if (i < left_count) {
+            t = t.left();
+          }
+          else if (i == left_count) {
+            return &t.keyval();
+          }
+          else {
+            i -= left_count + 1;
+            t = t.right();
+          }
+        }
+        return 0;
+      }
+
+      // The number of values in [lo, hi).
+      std::size_t count_range(key_value_type const& lo, key_value_type const& hi) const { return count_range_key(lo, hi); }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      std::size_t count_range(Key const& lo, Key const& hi) const { return count_range_key(lo, hi); }
+
+      // The summary of the values in [lo, hi), as if they made a tree of
+      // their own; O(log n) for an in-order fold such as monoid_augment.
+      summary_type aggregate(key_value_type const& lo, key_value_type const& hi) const { return aggregate_key(lo, hi); }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      summary_type aggregate(Key const& lo, Key const& hi) const { return aggregate_key(lo, hi); }
+
+      // Whether a and b hold equal values (by ==) in the same order: a
+      // walk over both that skips the subtrees they share. With
+      // hash_augment, trees whose content hashes differ are told apart in
+      // O(1) first; equal hashes can still collide, so they are walked.
+      static bool equal_content(rb_tree const& a, rb_tree const& b)
+      {
+        return a == b || (!differ_by_summary(a, b, detail::hashes_content<Augment>()) && equal_walk(a, b));
+      }
+
+      // Calls f(before, after) for each value that differs between two
+      // versions, in key order: f(&v, 0) for a v only in from, f(0, &v) for
+      // a v only in to, and f(&v, &w) where v and w have equal keys but
+      // not v == w. Subtrees the versions share are skipped whole, so d
+      // edits apart in a tree of n values this takes O(d log n).
+      template <typename F>
+      static void for_each_difference(rb_tree const& from, rb_tree const& to, F f)
+      {
+        diff_cursor a(from), b(to);
+
+        while (!a.done() && !b.done()) {
+          diff_item const x = a.top();
+          diff_item const y = b.top();
+
+          if (x.whole && y.whole) {
+            if (x.t.root_link() == y.t.root_link()) {
+              a.pop();
+              b.pop();
+            }
+            else {
+              // shared subtrees are met by unfolding the taller side
+              if (x.bdepth >= y.bdepth) {
+                a.expand();
+              }
+              if (y.bdepth >= x.bdepth) {
+                b.expand();
+              }
+            }
+          }
+          else if (x.whole) {
+            a.expand();
+          }
+          else if (y.whole) {
+            b.expand();
+          }
+          else {
+            int const order = from.key_order(x.t.keyval(), y.t.keyval());
+            if (order < 0) {
+              f(&x.t.keyval(), static_cast<key_value_type const*>(0));
+              a.pop();
+            }
+            else if (order > 0) {
+              f(static_cast<key_value_type const*>(0), &y.t.keyval());
+              b.pop();
+            }
+            else {
+              if (!(x.t.keyval() == y.t.keyval())) {
+                f(&x.t.keyval(), &y.t.keyval());
+              }
+              a.pop();
+              b.pop();
+            }
+          }
+        }
+
+        for (; !a.done(); a.pop()) {
+          while (a.top().whole) {
+            a.expand();
+          }
+          f(&a.top().t.keyval(), static_cast<key_value_type const*>(0));
+        }
+
+        for (; !b.done(); b.pop()) {
+          while (b.top().whole) {
+            b.expand();
+          }
+          f(static_cast<key_value_type const*>(0), &b.top().t.keyval());
+        }
+      }
+
+      rb_tree insert(key_value_type&& v) const
+      {
+        auto with_insert = subtree(*this).template insert_impl<lhs_ops>(std::move(v), BLACK);
+        return with_insert.second.color() == BLACK ? with_insert.second : with_color(with_insert.second, BLACK);
+      }
+
+      rb_tree insert(key_value_type const& v) const
+      {
+        auto with_insert = subtree(*this).template insert_impl<lhs_ops>(std::move(key_value_type(v)), BLACK);
+        return with_insert.second.color() == BLACK ? with_insert.second : with_color(with_insert.second, BLACK);
+      }
+
+      rb_tree erase(key_value_type const& v) const { return blacken(subtree(*this).erase_impl(v).second); }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      rb_tree erase(Key const& key) const { return blacken(subtree(*this).erase_impl(key).second); }
+
+      // Inserts a batch at once. The batch is sorted, of equivalent values
+      // the last one is kept, as with inserts one by one, and pushed down
+      // the tree together, split at each node it reaches: every node above
+      // a change is copied and rebalanced once per batch rather than once
+      // per value, and a value is compared O(log k) times per level.
+      rb_tree insert_batch(std::vector<key_value_type> batch) const
+      {
+        sort_batch(batch);
+        return blacken(subtree(*this).insert_batch_impl(bdepth(), batch.begin(), batch.end()).second);
+      }
+
+      // Erases a batch at once, pushed down the tree like insert_batch;
+      // subtrees holding none of it are kept as they are.
+      rb_tree erase_batch(std::vector<key_value_type> batch) const
+      {
+        sort_batch(batch);
+        return blacken(subtree(*this).erase_batch_impl(bdepth(), batch.begin(), batch.end(), serial_fork()).second);
+      }
+
+      // erase_batch for keys of another type, see find. Keys are only ever
+      // compared with values, so they must come sorted; repeats do no harm.
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      rb_tree erase_sorted_keys(std::vector<Key> const& keys) const {
+        return blacken(subtree(*this).erase_batch_impl(bdepth(), keys.begin(), keys.end(), serial_fork()).second);
+      }
+
+      // erase_sorted_keys with the two sides of each split done as separate
+      // tasks on pool, as in set_difference_parallel
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      rb_tree erase_sorted_keys_parallel(std::vector<Key> const& keys, parallel::work_stealing_pool& pool,
+                                         std::size_t grain = parallel::default_grain) const
+      {
+        static_assert(parallel_safe::value, "erase_sorted_keys_parallel needs atomic_refcount and an allocator safe to share between threads");
+        return blacken(subtree(*this).erase_batch_impl(bdepth(), keys.begin(), keys.end(), pool_fork(pool, grain)).second);
+      }
+
+      // Builds a tree from the strictly ascending range [begin, end) in
+      // linear time with one allocation per element: a perfectly balanced
+      // tree, black but for its deepest level when that is not full.
+      // Single pass input iterators go to from_sorted_stream.
+      template <typename It>
+      static rb_tree from_sorted(It begin, It end, key_compare const& comp = key_compare(), allocator_type const& alloc = allocator_type())
+      {
+        return from_sorted(std::move(begin), std::move(end), comp, alloc, typename std::iterator_traits<It>::iterator_category());
+      }
+
+      // from_sorted for the n elements starting at begin, reading each of
+      // them once, so begin may be a single pass input iterator.
+      template <typename It>
+      static rb_tree from_sorted_n(It begin, std::size_t n, key_compare const& comp = key_compare(), allocator_type const& alloc = allocator_type())
+      {
+        rb_tree const like(comp, alloc);
+
+        key_value_type const* prev = 0;
+        return build_sorted(like, begin, n, 0, full_levels(n), prev);
+      }
+
+      // from_sorted for an input range of unknown length, read once front
+      // to back with sorted_loader; besides the tree it holds O(log n).
+      template <typename It>
+      static rb_tree from_sorted_stream(It begin, It end, key_compare const& comp = key_compare(), allocator_type const& alloc = allocator_type())
+      {
+        sorted_loader loader(rb_tree(comp, alloc));
+
+        for (; begin != end; ++begin) {
+          loader.push_back(*begin);
+        }
+
+        return loader.finish();
+      }
+
+      // from_sorted for a random access range, with the subtrees below the
+      // top levels built on up to threads threads at once; only for
+      // parallel_safe trees.
+      template <typename RandomIt>
+      static rb_tree from_sorted_parallel(RandomIt begin, RandomIt end, unsigned threads = parallel::default_threads(),
+                                          key_compare const& comp = key_compare(), allocator_type const& alloc = allocator_type())
+      {
+        static_assert(parallel_safe::value, "from_sorted_parallel needs atomic_refcount and an allocator safe to share between threads");
+        rb_tree const like(comp, alloc);
+        std::size_t const n = static_cast<std::size_t>(end - begin);
+
+        assert(std::adjacent_find(begin, end, [&like](key_value_type const& lhs, key_value_type const& rhs) { return !like.key_less(lhs, rhs); }) == end &&
+               "from_sorted_parallel: input is not strictly ascending");
+
+        // one subtree per thread
+        std::size_t fork_depth = 0;
+        while ((std::size_t(1) << fork_depth) < threads) {
+          ++fork_depth;
+        }
+
+        return build_sorted_parallel(like, begin, n, 0, full_levels(n), fork_depth);
+      }
+
+      // Sorts and deduplicates values on up to threads threads, the last of
+      // equivalent values winning as with repeated inserts, and builds the
+      // tree with from_sorted_parallel.
+      static rb_tree from_unsorted_parallel(std::vector<key_value_type> values, unsigned threads = parallel::default_threads(),
+                                            key_compare const& comp = key_compare(), allocator_type const& alloc = allocator_type())
+      {
+        static_assert(parallel_safe::value, "from_unsorted_parallel needs atomic_refcount and an allocator safe to share between threads");
+        rb_tree const like(comp, alloc);
+        auto const less = [&like](key_value_type const& lhs, key_value_type const& rhs) { return like.key_less(lhs, rhs); };
+
+        parallel::stable_sort(values.begin(), values.end(), less, threads);
+        std::vector<key_value_type> unique = parallel::unique_last(values, less, threads);
+        values.clear();
+
+        return from_sorted_parallel(std::make_move_iterator(unique.begin()), std::make_move_iterator(unique.end()), threads, comp, alloc);
+      }
+
+      class zipper;
+
+      // A mutable view of an rb_tree for batches of updates. Nodes the
+      // transient owns alone are changed in place, shared nodes are copied
+      // once on the way down and owned from then on, so a batch allocates
+      // about one node per new key instead of a path per key.
+      //
+      // persistent() hands out the current tree in O(1); the nodes become
+      // shared with it and later edits copy them again. A transient, unlike
+      // the trees, is not safe to use from several threads at once.
+      class transient
+      {
+      public:
+        explicit transient(rb_tree t = rb_tree()) : root(std::move(t)) {}
+
+        key_compare const& key_comp() const { return root.key_comp(); }
+
+        bool empty() const { return root.empty(); }
+        std::size_t size() const { return root.size(); }
+        key_value_type const* find(key_value_type const& kv) const { return root.find(kv); }
+
+        template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+        key_value_type const* find(Key const& key) const { return root.find(key); }
+
+        rb_tree persistent() const { return root; }
+
+        void insert(key_value_type const& v) { insert(key_value_type(v)); }
+
+        void insert(key_value_type&& v)
+        {
+          std::size_t n = 0;
+          link* l = &root.edit_root();
+
+          while (!l->empty()) {
+            root.unshare(*l);
+            path[n++] = l;
+            assert(n < max_depth);
+
+            auto node = rb_tree::edit_node(*l);
+
+            int const order = root.key_order(v, node->payload.get());
+            if (order < 0) {
+              l = &node->left;
+            }
+            else if (order > 0) {
+              l = &node->right;
+            }
+            else {
+              node->payload = typename rb_tree::payload_type(std::move(v), root.get_allocator());
+              refresh(n);
+              return;
+            }
+          }
+
+          root.assign(*l, rb_tree::leaf(root, std::move(v), RED));
+          path[n] = l;
+          refresh(n);
+          insert_fixup(n);
+        }
+
+        void erase(key_value_type const& v) { erase_key(v); }
+
+        template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+        void erase(Key const& key) { erase_key(key); }
+
+      private:
+        static std::size_t const max_depth = 2 * 8 * sizeof(void*) + 2;
+
+        template <typename Key>
+        void erase_key(Key const& v)
+        {
+          if (!root.find_key(v)) {
+            return;
+          }
+
+          std::size_t n = 0;
+          link* l = &root.edit_root();
+
+          for (;;) {
+            root.unshare(*l);
+            path[n] = l;
+            assert(n + 1 < max_depth);
+
+            auto node = rb_tree::edit_node(*l);
+
+            int const order = root.key_order(v, node->payload.get());
+            if (order < 0) {
+              l = &node->left;
+            }
+            else if (order > 0) {
+              l = &node->right;
+            }
+            else {
+              break;
+            }
+            ++n;
+          }
+
+          // an inner node takes over its predecessor's key/value, and the
+          // predecessor, which has no right child, is removed instead
+          auto found = rb_tree::edit_node(*path[n]);
+          if (!found->left.empty() && !found->right.empty()) {
+            l = &found->left;
+            for (;;) {
+              root.unshare(*l);
+              path[++n] = l;
+              assert(n + 1 < max_depth);
+              if (l->right().empty()) {
+                break;
+              }
+              l = &rb_tree::edit_node(*l)->right;
+            }
+            found->payload = std::move(rb_tree::edit_node(*l)->payload);
+          }
+
+          remove(n);
+        }
+
+        static rb_color_t color(link const& l) { return static_cast<rb_color_t>(l.tag()); }
+
+        // which child of parent the link at child is
+        static bool is_left(link* parent, link const* child) {
+          return &rb_tree::edit_node(*parent)->left == child;
+        }
+
+        static link& child(link* parent, bool left) {
+          auto node = rb_tree::edit_node(*parent);
+          return left ? node->left : node->right;
+        }
+
+        // moves the child on the other side of left up into l; both nodes
+        // must be owned
+        static void rotate(link& l, bool left)
+        {
+          link up(std::move(child(&l, !left)));
+          child(&l, !left) = std::move(child(&up, left));
+          child(&up, left) = std::move(l);
+          l = std::move(up);
+
+          if (rb_tree::augmented) {
+            rb_tree::refresh(child(&l, left));
+            rb_tree::refresh(l);
+          }
+        }
+
+        // redoes the summaries of path[0..n), bottom up, after a change
+        // below path[n - 1]; rotations redo their own
+        void refresh(std::size_t n)
+        {
+          if (rb_tree::augmented) {
+            while (n > 0) {
+              rb_tree::refresh(*path[--n]);
+            }
+          }
+        }
+
+        // path[0..n] leads to a new red node
+        void insert_fixup(std::size_t n)
+        {
+          while (n >= 2 && color(*path[n - 1]) == RED) {
+            link* x = path[n];
+            link* p = path[n - 1];
+            link* g = path[n - 2];
+
+            bool const p_left = is_left(g, p);
+            link& uncle = child(g, !p_left);
+
+            if (color(uncle) == RED) {
+              // the colors live on the links, all in owned nodes
+              rb_tree::set_tag(*p, BLACK);
+              rb_tree::set_tag(uncle, BLACK);
+              rb_tree::set_tag(*g, RED);
+              n -= 2;
+            }
+            else {
+              if (is_left(p, x) != p_left) {
+                rotate(*p, p_left);
+              }
+              rotate(*g, !p_left);
+              rb_tree::set_tag(*g, BLACK);
+              rb_tree::set_tag(child(g, !p_left), RED);
+              break;
+            }
+          }
+
+          rb_tree::set_tag(root.edit_root(), BLACK);
+        }
+
+        // removes the node at path[n], which has at most one child
+        void remove(std::size_t n)
+        {
+          link* l = path[n];
+          auto node = rb_tree::edit_node(*l);
+          rb_color_t const removed_color = color(*l);
+
+          link removed(std::move(node->left.empty() ? node->right : node->left));
+          root.release(*l);
+          *l = std::move(removed);
+          refresh(n);
+
+          if (removed_color == RED) {
+            return;
+          }
+
+          if (!l->empty()) {
+            rb_tree::set_tag(*l, BLACK);
+            return;
+          }
+
+          erase_fixup(n);
+        }
+
+        // the link at path[n] is one black short
+        void erase_fixup(std::size_t n)
+        {
+          while (n > 0 && color(*path[n]) == BLACK) {
+            link* x = path[n];
+            link* p = path[n - 1];
+
+            bool const x_left = is_left(p, x);
+            link* w = &child(p, !x_left);
+
+            if (color(*w) == RED) {
+              // rotate the red sibling above p, p gets a black sibling
+              root.unshare(*w);
+              rotate(*p, x_left);
+              rb_tree::set_tag(*p, BLACK);
+              link& new_p = child(p, x_left);
+              rb_tree::set_tag(new_p, RED);
+
+              assert(n + 1 < max_depth);
+              path[n + 1] = x;
+              path[n] = &new_p;
+              ++n;
+              continue;
+            }
+
+            if (color(w->left()) == BLACK && color(w->right()) == BLACK) {
+              rb_tree::set_tag(*w, RED);
+              --n;
+              continue;
+            }
+
+            root.unshare(*w);
+
+            if (color(child(w, !x_left)) == BLACK) {
+              // the near child is red, rotate it into w's place
+              root.unshare(child(w, x_left));
+              rotate(*w, !x_left);
+              rb_tree::set_tag(*w, BLACK);
+              rb_tree::set_tag(child(w, !x_left), RED);
+            }
+
+            tag_type const p_color = p->tag();
+            rotate(*p, x_left);
+            rb_tree::set_tag(*p, p_color);
+            rb_tree::set_tag(child(p, x_left), BLACK);
+            rb_tree::set_tag(child(p, !x_left), BLACK);
+            n = 0;
+            break;
+          }
+
+          if (!path[n]->empty()) {
+            rb_tree::set_tag(*path[n], BLACK);
+          }
+        }
+
+        typedef typename rb_tree::tag_type tag_type;
+
+        friend class zipper;
+
+        rb_tree root;
+        link* path[max_depth];
+      };
+
+      // An edit cursor for many edits close together, a zipper. It holds
+      // the path from the root down to a focus subtree, as the nodes left
+      // behind on the way, and edits the focus in place as a transient
+      // does. Nothing above the focus is rebuilt per edit. An edit outside
+      // the keys the focus spans widens it one level at a time, joining
+      // it with the node above and that node's other subtree; close() does
+      // that up to the root, once, and the red-black invariants hold again.
+      // Clustered edits thus copy the nodes they touch once and the path
+      // above them once, about k + log n nodes for k edits instead of k
+      // paths. Where nothing was edited, widening and close() allocate
+      // nothing.
+      //
+      // The focus starts at the node holding near, or where near would go,
+      // and only widens. Like a transient, not for several threads at once.
+      class zipper
+      {
+      public:
+        explicit zipper(rb_tree t) : origin(t), focus(std::move(t)), focus_bdepth(origin.bdepth()), depth(0), dirty(false) {}
+
+        zipper(rb_tree t, key_value_type const& near) : zipper(std::move(t)) { narrow(near); }
+
+        template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+        zipper(rb_tree t, Key const& near) : zipper(std::move(t)) { narrow(near); }
+
+        // Keys outside the focus have not changed since the zipper was
+        // made, so they are looked up in the tree it was made from.
+        key_value_type const* find(key_value_type const& kv) const { return find_key(kv); }
+
+        template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+        key_value_type const* find(Key const& key) const { return find_key(key); }
+
+        // insert replaces the value of an equivalent key, as in transient
+        void insert(key_value_type v)
+        {
+          widen(v);
+          focus.insert(std::move(v));
+          dirty = true;
+        }
+
+        void erase(key_value_type const& kv) { erase_key(kv); }
+
+        template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+        void erase(Key const& key) { erase_key(key); }
+
+        // The edited tree. The zipper then spans all of it and may go on,
+        // copying nodes shared with the result as a transient does.
+        rb_tree close()
+        {
+          while (depth > 0) {
+            climb();
+          }
+          focus.root = blacken(std::move(focus.root));
+          origin = focus.root;
+          focus_bdepth = origin.bdepth();
+          dirty = false;
+          return origin;
+        }
+
+      private:
+        static std::size_t const max_depth = 2 * 8 * sizeof(void*) + 2;
+
+        // A node of the original tree left above the focus, the focus
+        // being its left or right subtree; the focus spans the keys
+        // strictly between lo and hi, a null bound being open.
+        struct frame
+        {
+          link const* node;
+          std::size_t bdepth;
+          bool focus_left;
+          key_value_type const* lo;
+          key_value_type const* hi;
+        };
+
+        template <typename Key>
+        bool inside(Key const& key) const
+        {
+          if (depth == 0) {
+            return true;
+          }
+          frame const& f = path[depth - 1];
+          return (!f.lo || focus.root.key_less(*f.lo, key)) && (!f.hi || focus.root.key_less(key, *f.hi));
+        }
+
+        template <typename Key>
+        key_value_type const* find_key(Key const& key) const
+        {
+          return inside(key) ? focus.root.find_key(key) : origin.find_key(key);
+        }
+
+        template <typename Key>
+        void erase_key(Key const& key)
+        {
+          widen(key);
+          focus.erase_key(key);
+          dirty = true;
+        }
+
+        // down the search path for key while the focus is made of nodes
+        // other than the one holding it
+        template <typename Key>
+        void narrow(Key const& key)
+        {
+          for (;;) {
+            rb_tree const& t = focus.root;
+            int const order = t.empty() ? 0 : t.key_order(key, t.keyval());
+            if (order == 0 || (order < 0 ? t.left() : t.right()).empty()) {
+              return;
+            }
+
+            assert(depth < max_depth);
+            frame& f = path[depth];
+            f.node = depth ? (path[depth - 1].focus_left ? &path[depth - 1].node->left() : &path[depth - 1].node->right()) : &origin.root_link();
+            f.bdepth = focus_bdepth;
+            f.focus_left = order < 0;
+            f.lo = order < 0 ? (depth ? path[depth - 1].lo : 0) : &t.keyval();
+            f.hi = order < 0 ? &t.keyval() : (depth ? path[depth - 1].hi : 0);
+            ++depth;
+
+            focus.root = origin.share(order < 0 ? f.node->left() : f.node->right());
+            focus_bdepth = subtree(origin, *f.node).child_bdepth(f.bdepth);
+          }
+        }
+
+        template <typename Key>
+        void widen(Key const& key)
+        {
+          while (!inside(key)) {
+            climb();
+          }
+        }
+
+        // Puts the node above back over the focus: as it was if nothing
+        // changed below it, by a join otherwise, which also mends the black
+        // depth if edits changed that of the focus.
+        void climb()
+        {
+          frame const& f = path[--depth];
+          if (!dirty) {
+            focus.root = origin.share(*f.node);
+            focus_bdepth = f.bdepth;
+            return;
+          }
+
+          subtree const node(origin, *f.node);
+          bdepthtree_t const own(focus.root.bdepth(), std::move(focus.root));
+          bdepthtree_t const other(node.child_bdepth(f.bdepth), f.focus_left ? node.right() : node.left());
+          bdepthtree_t joined = f.focus_left ? join_at(own, node, other) : join_at(other, node, own);
+
+          focus.root = std::move(joined.second);
+          focus_bdepth = joined.first;
+        }
+
+        rb_tree origin; // keeps the nodes of the path alive
+        transient focus;
+        std::size_t focus_bdepth;
+        std::size_t depth;
+        bool dirty;
+        frame path[max_depth];
+      };
+
+      // Builds a tree from strictly ascending elements pushed one at a time,
+      // without knowing how many will come. The elements are gathered into
+      // perfect black subtrees of distinct heights, each followed by one
+      // pending element, like the digits of a binary counter: two subtrees
+      // of height h and the element between them make one of height h + 1.
+      // So the loader holds O(log n) subtrees besides the nodes, and
+      // finish() joins them, smallest first, into a balanced tree.
+      class sorted_loader
+      {
+      public:
+        explicit sorted_loader(rb_tree const& like = rb_tree()) : like(rb_tree::empty_like(like)) {}
+
+        void push_back(key_value_type v)
+        {
+          assert((units.empty() || like.key_less(units.back().pending, v)) && "sorted_loader: input is not strictly ascending");
+          units.push_back(unit(rb_tree::empty_like(like), std::move(v), 0));
+
+          while (units.size() >= 2 && units[units.size() - 2].height == units.back().height) {
+            unit hi(std::move(units.back()));
+            units.pop_back();
+            unit lo(std::move(units.back()));
+            units.pop_back();
+
+            units.push_back(unit(rb_tree::branch(like, std::move(lo.pending), std::move(lo.tree), std::move(hi.tree), BLACK),
+                                 std::move(hi.pending),
+                                 lo.height + 1));
+          }
+        }
+
+        // the tree of everything pushed so far; the loader is left empty
+        rb_tree finish()
+        {
+          bdepthtree_t t(1, rb_tree::empty_like(like));
+
+          while (!units.empty()) {
+            unit u(std::move(units.back()));
+            units.pop_back();
+            t = join_impl(bdepthtree_t(u.height + 1, u.tree), value_mid(like, u.pending), t);
+          }
+
+          return blacken(std::move(t.second));
+        }
+
+      private:
+        // a perfect black subtree of the given height and the element after it
+        struct unit
+        {
+          unit(rb_tree tree, key_value_type&& pending, std::size_t height)
+            : tree(std::move(tree)), pending(std::move(pending)), height(height)
+          {}
+
+          unit(unit&& other)
+            : tree(std::move(other.tree)), pending(std::move(other.pending)), height(other.height)
+          {}
+
+          rb_tree tree;
+          key_value_type pending;
+          std::size_t height;
+        };
+
+        rb_tree like;
+        std::vector<unit> units;
+      };
+
+      // The tree of left, v and right, where all of left is before v and
+      // all of right after it, in O(|log n - log m|) new nodes; the trees
+      // are spliced where their black depths meet.
+      static rb_tree join(rb_tree const& left, key_value_type v, rb_tree const& right)
+      {
+        return blacken(join_impl(with_bdepth(left), value_mid(left, v), with_bdepth(right)).second);
+      }
+
+      // The tree of left and right, all of left before all of right.
+      static rb_tree join(rb_tree const& left, rb_tree const& right)
+      {
+        return blacken(join2(with_bdepth(left), with_bdepth(right)).second);
+      }
+
+      // A tree cut at a key: left holds what is before it, right what is
+      // after it, and found, unless empty, is the subtree of the original
+      // tree whose root is equivalent to it. Only the root of found is
+      // between left and right.
+      struct split_t
+      {
+        rb_tree left;
+        rb_tree found;
+        rb_tree right;
+      };
+
+      // O(log n) new nodes; subtrees entirely on one side are shared.
+      split_t split(key_value_type const& v) const { return split_key(v); }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      split_t split(Key const& key) const { return split_key(key); }
+
+      // The tree without the values in [lo, hi), and a tree of those
+      // values, in O(log n): the tree is split at lo and hi and the outer
+      // parts joined, the removed values are not visited.
+      std::pair<rb_tree, rb_tree> extract_range(key_value_type const& lo, key_value_type const& hi) const { return extract_range_key(lo, hi); }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      std::pair<rb_tree, rb_tree> extract_range(Key const& lo, Key const& hi) const { return extract_range_key(lo, hi); }
+
+      rb_tree erase_range(key_value_type const& lo, key_value_type const& hi) const { return extract_range_key(lo, hi).first; }
+
+      template <typename Key, typename C = key_compare, typename = typename C::is_transparent>
+      rb_tree erase_range(Key const& lo, Key const& hi) const { return extract_range_key(lo, hi).first; }
+
+      // Set algebra in O(m log(n/m + 1)) for sizes m <= n, sharing the
+      // subtrees of either input that need no change. Of equivalent
+      // elements the one from lhs is kept.
+      static rb_tree set_union(rb_tree const& lhs, rb_tree const& rhs)
+      {
+        return blacken(union_impl(with_bdepth(lhs), with_bdepth(rhs), keep_left(), serial_fork()).second);
+      }
+
+      // set_union, with merge(l, r) making the element kept for the
+      // equivalent elements l of lhs and r of rhs
+      template <typename Merge>
+      static rb_tree set_union(rb_tree const& lhs, rb_tree const& rhs, Merge merge)
+      {
+        return blacken(union_impl(with_bdepth(lhs), with_bdepth(rhs), merge_mid<Merge>(merge), serial_fork()).second);
+      }
+
+      static rb_tree set_intersection(rb_tree const& lhs, rb_tree const& rhs)
+      {
+        return blacken(intersection_impl(with_bdepth(lhs), with_bdepth(rhs), serial_fork()).second);
+      }
+
+      static rb_tree set_difference(rb_tree const& lhs, rb_tree const& rhs)
+      {
+        return blacken(difference_impl(with_bdepth(lhs), with_bdepth(rhs), serial_fork()).second);
+      }
+
+      // The set operations with the two sides of each split done as
+      // separate tasks on pool, down to inputs of about grain elements.
+      // Only for parallel_safe trees.
+      static rb_tree set_union_parallel(rb_tree const& lhs, rb_tree const& rhs, parallel::work_stealing_pool& pool,
+                                        std::size_t grain = parallel::default_grain)
+      {
+        static_assert(parallel_safe::value, "set_union_parallel needs atomic_refcount and an allocator safe to share between threads");
+        return blacken(union_impl(with_bdepth(lhs), with_bdepth(rhs), keep_left(), pool_fork(pool, grain)).second);
+      }
+
+      template <typename Merge>
+      static rb_tree set_union_parallel(rb_tree const& lhs, rb_tree const& rhs, Merge merge, parallel::work_stealing_pool& pool,
+                                        std::size_t grain = parallel::default_grain)
+      {
+        static_assert(parallel_safe::value, "set_union_parallel needs atomic_refcount and an allocator safe to share between threads");
+        return blacken(union_impl(with_bdepth(lhs), with_bdepth(rhs), merge_mid<Merge>(merge), pool_fork(pool, grain)).second);
+      }
+
+      static rb_tree set_intersection_parallel(rb_tree const& lhs, rb_tree const& rhs, parallel::work_stealing_pool& pool,
+                                               std::size_t grain = parallel::default_grain)
+      {
+        static_assert(parallel_safe::value, "set_intersection_parallel needs atomic_refcount and an allocator safe to share between threads");
+        return blacken(intersection_impl(with_bdepth(lhs), with_bdepth(rhs), pool_fork(pool, grain)).second);
+      }
+
+      static rb_tree set_difference_parallel(rb_tree const& lhs, rb_tree const& rhs, parallel::work_stealing_pool& pool,
+                                             std::size_t grain = parallel::default_grain)
+      {
+        static_assert(parallel_safe::value, "set_difference_parallel needs atomic_refcount and an allocator safe to share between threads");
+        return blacken(difference_impl(with_bdepth(lhs), with_bdepth(rhs), pool_fork(pool, grain)).second);
+      }
+
+    private:
+      template <typename It>
+      static rb_tree from_sorted(It begin, It end, key_compare const& comp, allocator_type const& alloc, std::input_iterator_tag)
+      {
+        return from_sorted_stream(std::move(begin), std::move(end), comp, alloc);
+      }
+
+      template <typename It>
+      static rb_tree from_sorted(It begin, It end, key_compare const& comp, allocator_type const& alloc, std::forward_iterator_tag)
+      {
+        std::size_t const n = static_cast<std::size_t>(std::distance(begin, end));
+        return from_sorted_n(std::move(begin), n, comp, alloc);
+      }
+
+      typedef detail::counts_elements<Augment> counted;
+
+      static std::size_t count(subtree_ref const& t) { return Augment::count(t.summary()); }
+
+      std::size_t size_impl(std::true_type) const { return count(*this); }
+      std::size_t size_impl(std::false_type) const { return base_type::size(); }
+
+      // The rest of an in-order walk for for_each_difference: a stack of
+      // subtrees not yet unfolded and of single nodes, the next on top.
+      struct diff_item
+      {
+        subtree t;
+        std::size_t bdepth;
+        bool whole; // the subtree, or just the value at its root
+      };
+
+      class diff_cursor
+      {
+      public:
+        explicit diff_cursor(rb_tree const& t) { push(t, t.bdepth(), true); }
+
+        bool done() const { return stack.empty(); }
+        diff_item const& top() const { return stack.back(); }
+        void pop() { stack.pop_back(); }
+
+        // replaces the subtree on top by its left subtree, root and right
+        // subtree
+        void expand()
+        {
+          diff_item const x = stack.back();
+          std::size_t const child_bdepth = x.t.child_bdepth(x.bdepth);
+          stack.pop_back();
+          push(x.t.right(), child_bdepth, true);
+          push(x.t, x.bdepth, false);
+          push(x.t.left(), child_bdepth, true);
+        }
+
+      private:
+        void push(subtree const& t, std::size_t bdepth, bool whole)
+        {
+          if (!t.empty()) {
+            diff_item const x = { t, bdepth, whole };
+            stack.push_back(x);
+          }
+        }
+
+        std::vector<diff_item> stack;
+      };
+
+      static bool differ_by_summary(rb_tree const& a, rb_tree const& b, std::true_type) {
+        return !(a.summary() == b.summary());
+      }
+
+      static bool differ_by_summary(rb_tree const&, rb_tree const&, std::false_type) {
+        return false;
+      }
+
+      // walks both in order; at a node both share, the values after it up
+      // to the end of its right subtree are the same too and are skipped,
+      // x and y being null until the next pop
+      static bool equal_walk(rb_tree const& a, rb_tree const& b)
+      {
+        std::vector<link const*> as, bs;
+        link const* x = &a.root_link();
+        link const* y = &b.root_link();
+        for (;;) {
+          for (; x && !x->empty(); x = &x->left()) {
+            as.push_back(x);
+          }
+          for (; y && !y->empty(); y = &y->left()) {
+            bs.push_back(y);
+          }
+          if (as.empty() || bs.empty()) {
+            return as.empty() && bs.empty();
+          }
+
+          x = as.back();
+          y = bs.back();
+          as.pop_back();
+          bs.pop_back();
+
+          if (*x == *y) {
+            x = y = 0;
+          }
+          else if (x->keyval() == y->keyval()) {
+            x = &x->right();
+            y = &y->right();
+          }
+          else {
+            return false;
+          }
+        }
+      }
+
+      template <typename Key>
+      std::size_t rank_key(Key const& v) const
+      {
+        static_assert(counted::value, "rank needs an augmentation that counts elements, such as size_augment");
+
+        std::size_t before = 0;
+        for (subtree t = *this; !t.empty();) {
+          if (key_less(t.keyval(), v)) {
+            before += count(t.left()) + 1;
+            t = t.right();
+          }
+          else {
+            t = t.left();
+          }
+        }
+        return before;
+      }
+
+      // never compares lo with hi, probes need only be comparable with keys
+      template <typename Key>
+      std::size_t count_range_key(Key const& lo, Key const& hi) const
+      {
+        std::size_t const after = rank_key(hi);
+        std::size_t const before = rank_key(lo);
+        return after > before ? after - before : 0;
+      }
+
+      // lo < hi needs no check: if not, no value is both at or after lo
+      // and before hi
+      template <typename Key>
+      summary_type aggregate_key(Key const& lo, Key const& hi) const
+      {
+        for (subtree t = *this; !t.empty();) {
+          if (key_less(t.keyval(), lo)) {
+            t = t.right();
+          }
+          else if (!key_less(t.keyval(), hi)) {
+            t = t.left();
+          }
+          else {
+            return Augment::summarize(t.left().fold_from(lo), t.keyval(), t.right().fold_before(hi));
+          }
+        }
+        return Augment::identity();
+      }
+
+      static rb_tree blacken(rb_tree t)
+      {
+        return t.color() == BLACK ? std::move(t) : with_color(t, BLACK);
+      }
+
+      // Join and split keep the black depth of each tree at hand, as
+      // bdepth() walks down a spine; a subtree has that of its parent less
+      // one if the parent is black.
+      typedef std::pair<std::size_t, rb_tree> bdepthtree_t;
+
+      std::size_t child_bdepth(std::size_t bdepth) const {
+        return bdepth - (color() == BLACK ? 1 : 0);
+      }
+
+      // Makers for the node that join puts between two trees, called with
+      // its children and color: one from a new key/value, one from the
+      // key/value of an existing node.
+      struct value_mid
+      {
+        value_mid(subtree_ref const& like, key_value_type& v) : like(like), v(v) {}
+
+        rb_tree operator()(rb_tree left, rb_tree right, rb_color_t color) const {
+          return rb_tree::branch(like, std::move(v), std::move(left), std::move(right), color);
+        }
+
+        subtree_ref like;
+        key_value_type& v;
+      };
+
+      struct node_mid
+      {
+        explicit node_mid(subtree_ref const& node) : node(node) {}
+
+        rb_tree operator()(rb_tree left, rb_tree right, rb_color_t color) const {
+          return with_left_right_color(node, std::move(left), std::move(right), color);
+        }
+
+        subtree_ref node;
+      };
+
+      // join given the black depths of left and right; the result may have
+      // a red root
+      template <typename Mid>
+      static bdepthtree_t join_impl(bdepthtree_t const& left, Mid const& mid, bdepthtree_t const& right)
+      {
+        if (left.first > right.first) {
+          rb_tree t = join_right<rhs_ops>(left.second, left.first, mid, right.second, right.first);
+          if (t.color() == RED && t.right().color() == RED) {
+            return bdepthtree_t(left.first + 1, with_color(t, BLACK));
+          }
+          return bdepthtree_t(left.first, std::move(t));
+        }
+        else if (right.first > left.first) {
+          rb_tree t = join_right<lhs_ops>(right.second, right.first, mid, left.second, left.first);
+          if (t.color() == RED && t.left().color() == RED) {
+            return bdepthtree_t(right.first + 1, with_color(t, BLACK));
+          }
+          return bdepthtree_t(right.first, std::move(t));
+        }
+        else if (left.second.color() == BLACK && right.second.color() == BLACK) {
+          return bdepthtree_t(left.first, mid(left.second, right.second, RED));
+        }
+        else {
+          return bdepthtree_t(left.first + 1, mid(left.second, right.second, BLACK));
+        }
+      }
+
+      // Walks down the right spine of the taller tree to a black subtree as
+      // black deep as the shorter one, puts a red node joining the two in
+      // its place and repairs red-red links on the way back up. Only the
+      // root returned can be left red with a red right child.
+      template <typename Ops, typename Mid>
+      static rb_tree join_right(subtree const& tall, std::size_t tall_bdepth, Mid const& mid, rb_tree const& shorter, std::size_t shorter_bdepth)
+      {
+        if (tall.color() == BLACK && tall_bdepth == shorter_bdepth) {
+          return Ops::join_node(mid, tall, shorter, RED);
+        }
+
+        rb_tree t = Ops::with_right(tall, join_right<Ops>(Ops::right(tall), tall.child_bdepth(tall_bdepth), mid, shorter, shorter_bdepth));
+
+        subtree const r = Ops::right(t);
+        if (tall.color() == BLACK && r.color() == RED && Ops::right(r).color() == RED) {
+          // (T{B} A (R{R} B C{R})) -> (R{R} (T{B} A B) C{B})
+          return Ops::with_left_right(r,
+                                      Ops::with_right(t, Ops::left(r)),
+                                      with_color(Ops::right(r), BLACK));
+        }
+
+        return t;
+      }
+
+      static bdepthtree_t join_at(bdepthtree_t const& left, subtree const& node, bdepthtree_t const& right)
+      {
+        return join_impl(left, node_mid(node), right);
+      }
+
+      // join without a key/value between: the last node of left goes there
+      static bdepthtree_t join2(bdepthtree_t const& left, bdepthtree_t const& right)
+      {
+        if (left.second.empty()) {
+          return right;
+        }
+        if (right.second.empty()) {
+          return left;
+        }
+
+        std::pair<bdepthtree_t, rb_tree> const rest_last = split_last(left);
+        return join_at(rest_last.first, rest_last.second, right);
+      }
+
+      // t without its last node, and the subtree rooted at that node
+      static std::pair<bdepthtree_t, rb_tree> split_last(bdepthtree_t const& t)
+      {
+        std::size_t const child_bdepth = t.second.child_bdepth(t.first);
+
+        if (t.second.right().empty()) {
+          return std::make_pair(bdepthtree_t(child_bdepth, t.second.left()), t.second);
+        }
+
+        std::pair<bdepthtree_t, rb_tree> const rest_last = split_last(bdepthtree_t(child_bdepth, t.second.right()));
+        return std::make_pair(join_at(bdepthtree_t(child_bdepth, t.second.left()), t.second, rest_last.first), rest_last.second);
+      }
+
+      struct bdepth_split_t
+      {
+        bdepthtree_t left;
+        rb_tree found;
+        bdepthtree_t right;
+      };
+
+      template <typename Key>
+      split_t split_key(Key const& v) const
+      {
+        bdepth_split_t s = subtree(*this).split_impl(v, bdepth());
+        return split_t{ blacken(std::move(s.left.second)), std::move(s.found), blacken(std::move(s.right.second)) };
+      }
+
+      // the tree is split at lo and hi and the outer parts joined
+      template <typename Key>
+      std::pair<rb_tree, rb_tree> extract_range_key(Key const& lo, Key const& hi) const
+      {
+        std::pair<bdepthtree_t, bdepthtree_t> const below_from = subtree(*this).split_before(lo, bdepth());
+        std::pair<bdepthtree_t, bdepthtree_t> const inside_above = subtree(below_from.second.second).split_before(hi, below_from.second.first);
+
+        if (inside_above.first.second.empty()) {
+          return std::make_pair(*this, rb_tree::empty_like(*this));
+        }
+
+        return std::make_pair(blacken(join2(below_from.first, inside_above.second).second), blacken(inside_above.first.second));
+      }
+
+      // How set_union joins the two sides around equivalent elements, t of
+      // lhs and found of rhs: over the node of t, or over one new node
+      // holding the merged key/value.
+      struct keep_left
+      {
+        bdepthtree_t operator()(bdepthtree_t const& left, rb_tree const& t, rb_tree const&, bdepthtree_t const& right) const {
+          return join_at(left, t, right);
+        }
+      };
+
+      template <typename Merge>
+      struct merge_mid
+      {
+        explicit merge_mid(Merge const& merge) : merge(merge) {}
+
+        bdepthtree_t operator()(bdepthtree_t const& left, rb_tree const& t, rb_tree const& found, bdepthtree_t const& right) const {
+          key_value_type v(merge(t.keyval(), found.keyval()));
+          return join_impl(left, value_mid(t, v), right);
+        }
+
+        Merge merge;
+      };
+
+      // How the set operations recurse on the two sides of a split: one
+      // after the other, or on a pool while the inputs hold at least grain
+      // elements; a tree of black depth b holds at least 2^(b-1) - 1.
+      struct serial_fork
+      {
+        template <typename F, typename G>
+        void operator()(std::size_t, std::size_t, F&& f, G&& g) const {
+          f();
+          g();
+        }
+      };
+
+      struct pool_fork
+      {
+        pool_fork(parallel::work_stealing_pool& pool, std::size_t grain) : pool(pool), grain(grain) {}
+
+        template <typename F, typename G>
+        void operator()(std::size_t lhs_bdepth, std::size_t rhs_bdepth, F&& f, G&& g) const
+        {
+          if (min_size(lhs_bdepth) + min_size(rhs_bdepth) >= grain) {
+            pool.fork_join(std::forward<F>(f), std::forward<G>(g));
+          }
+          else {
+            f();
+            g();
+          }
+        }
+
+        static std::size_t min_size(std::size_t bdepth) {
+          return bdepth >= 8 * sizeof(std::size_t) ? ~std::size_t(0) / 2 : (std::size_t(1) << (bdepth - 1)) - 1;
+        }
+
+        parallel::work_stealing_pool& pool;
+        std::size_t grain;
+      };
+
+      // Splits rhs at the root of lhs and recurses on both sides, so each
+      // node of the smaller tree costs O(log(n/m + 1)) on average.
+      template <typename Keep, typename Fork>
+      static bdepthtree_t union_impl(bdepthtree_t const& lhs, bdepthtree_t const& rhs, Keep const& keep, Fork const& fork)
+      {
+        if (lhs.second.empty()) {
+          return rhs;
+        }
+        if (rhs.second.empty()) {
+          return lhs;
+        }
+
+        rb_tree const& t = lhs.second;
+        std::size_t const child_bdepth = t.child_bdepth(lhs.first);
+        bdepth_split_t const s = subtree(rhs.second).split_impl(t.keyval(), rhs.first);
+        bdepthtree_t left(0, t), right(0, t);
+        fork(lhs.first, rhs.first,
+             [&] { left = union_impl(bdepthtree_t(child_bdepth, t.left()), s.left, keep, fork); },
+             [&] { right = union_impl(bdepthtree_t(child_bdepth, t.right()), s.right, keep, fork); });
+
+        return s.found.empty() ? join_at(left, t, right) : keep(left, t, s.found, right);
+      }
+
+      template <typename Fork>
+      static bdepthtree_t intersection_impl(bdepthtree_t const& lhs, bdepthtree_t const& rhs, Fork const& fork)
+      {
+        if (lhs.second.empty()) {
+          return lhs;
+        }
+        if (rhs.second.empty()) {
+          return bdepthtree_t(1, rb_tree::empty_like(lhs.second));
+        }
+
+        rb_tree const& t = lhs.second;
+        std::size_t const child_bdepth = t.child_bdepth(lhs.first);
+        bdepth_split_t const s = subtree(rhs.second).split_impl(t.keyval(), rhs.first);
+        bdepthtree_t left(0, t), right(0, t);
+        fork(lhs.first, rhs.first,
+             [&] { left = intersection_impl(bdepthtree_t(child_bdepth, t.left()), s.left, fork); },
+             [&] { right = intersection_impl(bdepthtree_t(child_bdepth, t.right()), s.right, fork); });
+
+        return s.found.empty() ? join2(left, right) : join_at(left, t, right);
+      }
+
+      template <typename Fork>
+      static bdepthtree_t difference_impl(bdepthtree_t const& lhs, bdepthtree_t const& rhs, Fork const& fork)
+      {
+        if (lhs.second.empty() || rhs.second.empty()) {
+          return lhs;
+        }
+
+        rb_tree const& t = lhs.second;
+        std::size_t const child_bdepth = t.child_bdepth(lhs.first);
+        bdepth_split_t const s = subtree(rhs.second).split_impl(t.keyval(), rhs.first);
+        bdepthtree_t left(0, t), right(0, t);
+        fork(lhs.first, rhs.first,
+             [&] { left = difference_impl(bdepthtree_t(child_bdepth, t.left()), s.left, fork); },
+             [&] { right = difference_impl(bdepthtree_t(child_bdepth, t.right()), s.right, fork); });
+
+        return s.found.empty() ? join_at(left, t, right) : join2(left, right);
+      }
+
+      // stable sort, then the last of each run of equivalent values
+      void sort_batch(std::vector<key_value_type>& batch) const
+      {
+        auto const less = [this](key_value_type const& lhs, key_value_type const& rhs) { return key_less(lhs, rhs); };
+        std::stable_sort(batch.begin(), batch.end(), less);
+
+        auto out = batch.begin();
+        for (auto i = batch.begin(); i != batch.end(); ++i) {
+          if (i + 1 == batch.end() || less(*i, *(i + 1))) {
+            if (out != i) {
+              *out = std::move(*i);
+            }
+            ++out;
+          }
+        }
+        batch.erase(out, batch.end());
+      }
+
+      typedef typename std::vector<key_value_type>::iterator batch_iterator;
+
+      static bdepthtree_t with_bdepth(rb_tree const& t) {
+        return bdepthtree_t(t.bdepth(), t);
+      }
+
+      // levels of a tree of n nodes that can be filled completely,
+      // floor(log2(n + 1))
+      static std::size_t full_levels(std::size_t n)
+      {
+        std::size_t full = 0;
+        while ((std::size_t(2) << full) - 1 <= n) {
+          ++full;
+        }
+        return full;
+      }
+
+      // the next n elements of it as a subtree rooted at depth; prev is
+      // the element before them, if any, for checking the order
+      template <typename It>
+      static rb_tree build_sorted(subtree_ref const& like, It& it, std::size_t n, std::size_t depth, std::size_t red_depth, key_value_type const*& prev)
+      {
+        if (n == 0) {
+          return rb_tree::empty_like(like);
+        }
+
+        std::size_t const left_n = (n - 1) / 2;
+        rb_tree left = build_sorted(like, it, left_n, depth + 1, red_depth, prev);
+
+        key_value_type v(*it);
+        ++it;
+        assert((!prev || like.key_less(*prev, v)) && "from_sorted: input is not strictly ascending");
+        prev = &v;
+
+        rb_tree right = build_sorted(like, it, n - 1 - left_n, depth + 1, red_depth, prev);
+        rb_tree t = rb_tree::branch(like, std::move(v), std::move(left), std::move(right), depth == red_depth ? RED : BLACK);
+        if (n - 1 - left_n == 0) {
+          prev = &t.keyval();
+        }
+        return t;
+      }
+
+      template <typename RandomIt>
+      static rb_tree build_sorted_parallel(subtree_ref const& like, RandomIt begin, std::size_t n, std::size_t depth, std::size_t red_depth, std::size_t fork_depth)
+      {
+        // not worth a thread
+        if (depth >= fork_depth || n < 4096) {
+          key_value_type const* prev = 0;
+          return build_sorted(like, begin, n, depth, red_depth, prev);
+        }
+
+        std::size_t const left_n = (n - 1) / 2;
+        rb_tree left = rb_tree::empty_like(like);
+        rb_tree right = rb_tree::empty_like(like);
+
+        parallel::fork_join(true,
+                            [&] { left = build_sorted_parallel(like, begin, left_n, depth + 1, red_depth, fork_depth); },
+                            [&] { right = build_sorted_parallel(like, begin + static_cast<std::ptrdiff_t>(left_n + 1), n - 1 - left_n, depth + 1, red_depth, fork_depth); });
+
+        return rb_tree::branch(like, key_value_type(begin[static_cast<std::ptrdiff_t>(left_n)]), std::move(left), std::move(right), depth == red_depth ? RED : BLACK);
+      }
+
+      enum rb_shape_t { BBB, BBR, BRB, BRR, RBB, RBR, RRB, RRR }; /* RRR can't happen as we change one subtree at a time */
+
+      static rb_shape_t rb_mk_shape(rb_color_t parent, rb_color_t left, rb_color_t right) {
+        return static_cast<rb_shape_t>(4 * parent + 2 * left + right);
+      }
+
+      struct rhs_ops
+      {
+        static rb_shape_t shape_RRB() { return RRB; }
+        static rb_shape_t shape_RBR() { return RBR; }
+
+        static rb_shape_t rb_mk_shape(rb_color_t parent, rb_color_t left, rb_color_t right) {
+          return rb_tree::rb_mk_shape(parent, left, right);
+        }
+
+        static int key_order(subtree const& t, typename rb_tree::key_value_type const& lhs, typename rb_tree::key_value_type const& rhs) {
+          return t.key_order(lhs, rhs);
+        }
+        
+        static rb_tree with_left(subtree const& orig, rb_tree left) {
+          return rb_tree::with_left(orig, std::move(left));
+        }
+
+        static rb_tree with_right(subtree const& orig, rb_tree right) {
+          return rb_tree::with_right(orig, std::move(right));
+        }
+
+        static rb_tree with_left_right(subtree const& orig, rb_tree left, rb_tree right) {
+          return rb_tree::with_left_right(orig, std::move(left), std::move(right));
+        }
+
+        template <typename Mid>
+        static rb_tree join_node(Mid const& mid, rb_tree left, rb_tree right, rb_color_t color) {
+          return mid(std::move(left), std::move(right), color);
+        }
+
+        static subtree left(subtree const& t) {
+          return t.left();
+        }
+
+        static subtree right(subtree const& t) {
+          return t.right();
+        }
+
+        static rb_tree with_left_right_color(subtree const& t, rb_tree left, rb_tree right, rb_color_t color) {
+          return rb_tree::with_left_right_color(t, std::move(left), std::move(right), color);
+        }
+      };
+
+      struct lhs_ops
+      {
+        static rb_shape_t shape_RRB() { return RBR; }
+        static rb_shape_t shape_RBR() { return RRB; }
+
+        static rb_shape_t rb_mk_shape(rb_color_t parent, rb_color_t left, rb_color_t right) {
+          return rb_tree::rb_mk_shape(parent, right, left);
+        }
+
+        static int key_order(subtree const& t, typename rb_tree::key_value_type const& lhs, typename rb_tree::key_value_type const& rhs) {
+          return t.key_order(rhs, lhs);
+        }
+
+        static rb_tree with_left(subtree const& orig, rb_tree left) {
+          return rb_tree::with_right(orig, std::move(left));
+        }
+
+        static rb_tree with_right(subtree const& orig, rb_tree right) {
+          return rb_tree::with_left(orig, std::move(right));
+        }
+
+        static rb_tree with_left_right(subtree const& orig, rb_tree left, rb_tree right) {
+          return rb_tree::with_left_right(orig, std::move(right), std::move(left));
+        }
+
+        template <typename Mid>
+        static rb_tree join_node(Mid const& mid, rb_tree left, rb_tree right, rb_color_t color) {
+          return mid(std::move(right), std::move(left), color);
+        }
+
+        static subtree left(subtree const& t) {
+          return t.right();
+        }
+
+        static subtree right(subtree const& t) {
+          return t.left();
+        }
+
+        static rb_tree with_left_right_color(subtree const& t, rb_tree left, rb_tree right, rb_color_t color) {
+          return rb_tree::with_left_right_color(t, std::move(right), std::move(left), color);
+        }
+      };
+
+      typedef std::pair<int, rb_tree> deltatree_t;
+
+      template <typename Ops>
+      static deltatree_t black_fixup_right_impl(subtree const& parent/*_with_new_right*/)
+      {
+        assert(parent.color() == BLACK);
+        assert(Ops::right(parent).color() == BLACK);
+
+        subtree const left = Ops::left(parent);
+
+        if (left.color() == RED)
+        {
+          subtree const left_r = Ops::right(left);
+          subtree const left_r_r = Ops::right(left_r);
+
+          if (left_r_r.color() == BLACK)
+          {
+            // (P{B} (L{R} LL{B} (LR{B} LRL{?} LRR{B})) R{B}) -> (L{B} LL{B} (LR{B} LRL{?} (P{R} LRR{B} R{B})))
+            return std::make_pair(0,
+                                  Ops::with_left_right_color(left,
+                                                             Ops::left(left),
+                                                             Ops::with_right(left_r,
+                                                                             Ops::with_left_right_color(parent,
+                                                                                                        left_r_r,
+                                                                                                        Ops::right(parent),
+                                                                                                        RED)),
+                                                             BLACK));
+          }
+          else
+          {
+            // (P{B} (L{R} LL{B} (LR{B} LRL{?} LRR{R})) R{B}) -> (L{B} LL{B} (LRR{B} (LR{B} LRL{?} LRRL{B}) (P{B} (LRRR{B}, R{B}))))
+            assert(left_r_r.color() == RED);
+            return std::make_pair(0,
+                                  Ops::with_left_right_color(left,
+                                                             Ops::left(left),
+                                                             Ops::with_left_right(left_r_r,
+                                                                                  Ops::with_right(left_r,
+                                                                                                  Ops::left(left_r_r)),
+                                                                                  Ops::with_left(parent,
+                                                                                                 Ops::right(left_r_r))),
+                                                             BLACK));
+          }
+        }
+        else
+        {
+          assert(left.color() == BLACK);
+
+          subtree const left_l = Ops::left(left);
+          subtree const left_r = Ops::right(left);
+
+          if (left_l.color() == RED)
+          {
+            // (P{B} (L{B} LL{R} LR{?}) R{B}) -> (L{B} LL{B} (P{B} LR{?} R{B}))
+            return std::make_pair(0,
+                                  Ops::with_left_right(left,
+                                                       with_color(left_l, BLACK),
+                                                       Ops::with_left(parent,
+                                                                      left_r)));
+          }
+          else if (left_r.color() == RED)
+          {
+            // (P{B} (L{B} LL{B} LR{R}) R{B}) -> (LR{B} (L{B} LL{B} LRL{B})) (P{B} LRR{B} R{B})
+            assert(left_l.color() == BLACK);
+            return std::make_pair(0,
+                                  Ops::with_left_right_color(left_r,
+                                                             Ops::with_right(left,
+                                                                             Ops::left(left_r)),
+                                                             Ops::with_left(parent,
+                                                                            Ops::right(left_r)),
+                                                             BLACK));
+          }
+          else
+          {
+            // (P{B} (L{B} LL{B} LR{B}) R{B}) -> (P{B} (L{R} LL{B} LR{B}) R{B})
+            // still -1
+            assert(left_l.color() == BLACK);
+            assert(left_r.color() == BLACK);
+            return std::make_pair(-1,
+                                  Ops::with_left(parent,
+                                                 with_color(left, RED)));
+          }
+        }
+      }
+
+      static deltatree_t black_fixup_left(subtree const& new_parent) {
+        return black_fixup_right_impl<lhs_ops>(new_parent);
+      }
+
+      template <typename Ops>
+      static deltatree_t red_fixup_right_impl(subtree const& parent/*_with_new_right*/)
+      {
+        assert(parent.color() == RED);
+        assert(Ops::left(parent).color() == BLACK);
+        assert(Ops::right(parent).color() == BLACK);
+
+        subtree const left = Ops::left(parent);
+        subtree const left_l = Ops::left(left);
+        subtree const left_r = Ops::right(left);
+
+        if (left_l.color() == RED)
+        {
+          // (P{R} (L{B} LL{R} LR{?}) R{B}) -> (L{R} LL{B} (P{B} LR{?} R{B}))
+          return std::make_pair(0,
+                                Ops::with_left_right_color(left,
+                                                           with_color(left_l, BLACK),
+                                                           Ops::with_left_right_color(parent,
+                                                                                      left_r,
+                                                                                      Ops::right(parent),
+                                                                                      BLACK),
+                                                           RED));
+        }
+        else if (left_r.color() == RED)
+        {
+          // (P{R} (L{B} LL{?} LR{R}) R{B}) -> (LR{R} (L{B} LL{?} LRL{B}) (P{B} LRR{B} R{B}))
+          return std::make_pair(0,
+                                Ops::with_left_right(left_r,
+                                                     Ops::with_right(left,
+                                                                     Ops::left(left_r)),
+                                                     Ops::with_left_right_color(parent,
+                                                                                Ops::right(left_r),
+                                                                                Ops::right(parent),
+                                                                                BLACK)));
+        }
+        else
+        {
+          // (P{R} (L{B} LL{B} LR{B}) R{B}) -> (P{B} L{R} R{B})
+          return std::make_pair(0,
+                                Ops::with_left_right_color(parent,
+                                                           with_color(left, RED),
+                                                           Ops::right(parent),
+                                                           BLACK));
+        }
+      }
+
+      static deltatree_t red_fixup_left(subtree const& new_parent) {
+        return red_fixup_right_impl<lhs_ops>(new_parent);
+      }
+
+      typedef std::pair<rb_shape_t, rb_tree> shapetree_t;
+
+      static rb_color_t rb_shape_parent(rb_shape_t s)
+      {
+        return static_cast<rb_color_t>(!!(s & 4));
+      }
+
+      static rb_color_t rb_shape_left(rb_shape_t s)
+      {
+        return static_cast<rb_color_t>(!!(s & 2));
+      }
+
+      static rb_color_t rb_shape_right(rb_shape_t s)
+      {
+        return static_cast<rb_color_t>(!!(s & 1));
+      }
+
+      static bool rb_check_shape(rb_shape_t s, rb_tree const& t)
+      {
+        if (t.empty())
+          return s == BBB;
+
+        return rb_shape_parent(s) == t.color() && rb_shape_left(s) == t.left().color() && rb_shape_right(s) == t.right().color();
+      }
+
+      static shapetree_t shape_checked(shapetree_t st)
+      {
+        assert(rb_check_shape(st.first, st.second));
+        return st;
+      }
+
+    public:
+      // A subtree of some rb_tree, what left() and right() return and the
+      // recursive algorithms walk, see bst_base::subtree_ref. Walking one
+      // touches no reference counts; a subtree kept becomes an rb_tree.
+      class subtree : public subtree_ref
+      {
+      public:
+        subtree(rb_tree const& t) : subtree_ref(t) {}
+        subtree(rb_tree const& cx, link const& l) : subtree_ref(cx, l) {}
+
+        using subtree_ref::empty;
+        using subtree_ref::keyval;
+        using subtree_ref::summary;
+        using subtree_ref::key_less;
+        using subtree_ref::key_order;
+
+        subtree left() const { return subtree(*this->cx, this->l->left()); }
+        subtree right() const { return subtree(*this->cx, this->l->right()); }
+
+        rb_color_t color() const { return static_cast<rb_color_t>(this->tag()); }
+
+        std::size_t bdepth() const
+        {
+          return empty() ? 1 : (left().bdepth() + (color() == BLACK ? 1 : 0));
+        }
+
+        std::size_t child_bdepth(std::size_t bdepth) const {
+          return bdepth - (color() == BLACK ? 1 : 0);
+        }
+
+      private:
+        friend struct rb_tree;
+
+        // the summaries of the values from lo on and of those before hi
+        template <typename Key>
+        summary_type fold_from(Key const& lo) const
+        {
+          if (empty()) {
+            return Augment::identity();
+          }
+          if (key_less(keyval(), lo)) {
+            return right().fold_from(lo);
+          }
+          return Augment::summarize(left().fold_from(lo), keyval(), right().summary());
+        }
+
+        template <typename Key>
+        summary_type fold_before(Key const& hi) const
+        {
+          if (empty()) {
+            return Augment::identity();
+          }
+          if (!key_less(keyval(), hi)) {
+            return left().fold_before(hi);
+          }
+          return Augment::summarize(left().summary(), keyval(), right().fold_before(hi));
+        }
+
+        template <typename Key>
+        bdepth_split_t split_impl(Key const& v, std::size_t bdepth) const
+        {
+          if (empty()) {
+            return bdepth_split_t{ bdepthtree_t(bdepth, *this), *this, bdepthtree_t(bdepth, *this) };
+          }
+
+          bdepthtree_t const l(child_bdepth(bdepth), left());
+          bdepthtree_t const r(child_bdepth(bdepth), right());
+
+          int const order = key_order(v, keyval());
+          if (order < 0) {
+            bdepth_split_t s = left().split_impl(v, l.first);
+            s.right = join_at(s.right, *this, r);
+            return s;
+          }
+          else if (order > 0) {
+            bdepth_split_t s = right().split_impl(v, r.first);
+            s.left = join_at(l, *this, s.left);
+            return s;
+          }
+          else {
+            return bdepth_split_t{ l, *this, r };
+          }
+        }
+
+        // the values before v, and the others
+        template <typename Key>
+        std::pair<bdepthtree_t, bdepthtree_t> split_before(Key const& v, std::size_t bdepth) const
+        {
+          bdepth_split_t const s = split_impl(v, bdepth);
+          if (s.found.empty()) {
+            return std::make_pair(s.left, s.right);
+          }
+          return std::make_pair(s.left, join_at(bdepthtree_t(1, rb_tree::empty_like(*this)), s.found, s.right));
+        }
+
+        // [first, last) split around the key of this node: before it, and
+        // from the first value not before it; the value equivalent to the
+        // key, if any, is at the latter
+        template <typename It>
+        It split_batch(It first, It last) const
+        {
+          typedef typename std::iterator_traits<It>::value_type probe_type;
+          return std::lower_bound(first, last, keyval(), [this](probe_type const& lhs, key_value_type const& rhs) { return key_less(lhs, rhs); });
+        }
+
+        bdepthtree_t insert_batch_impl(std::size_t bdepth, batch_iterator first, batch_iterator last) const
+        {
+          if (first == last) {
+            return bdepthtree_t(bdepth, *this);
+          }
+          if (empty()) {
+            key_value_type const* prev = 0;
+            auto it = std::make_move_iterator(first);
+            std::size_t const n = static_cast<std::size_t>(last - first);
+            return with_bdepth(build_sorted(*this, it, n, 0, full_levels(n), prev));
+          }
+
+          batch_iterator const mid = split_batch(first, last);
+          bool const found = mid != last && !key_less(keyval(), *mid);
+
+          bdepthtree_t const l = left().insert_batch_impl(child_bdepth(bdepth), first, mid);
+          bdepthtree_t const r = right().insert_batch_impl(child_bdepth(bdepth), found ? mid + 1 : mid, last);
+
+          return found ? join_impl(l, value_mid(*this, *mid), r) : join_at(l, *this, r);
+        }
+
+        template <typename It, typename Fork>
+        bdepthtree_t erase_batch_impl(std::size_t bdepth, It first, It last, Fork const& fork) const
+        {
+          if (first == last || empty()) {
+            return bdepthtree_t(bdepth, *this);
+          }
+
+          It const mid = split_batch(first, last);
+          bool const found = mid != last && !key_less(keyval(), *mid);
+
+          std::size_t const child = child_bdepth(bdepth);
+          bdepthtree_t l(0, *this), r(0, *this);
+          fork(bdepth, 1,
+               [&] { l = left().erase_batch_impl(child, first, mid, fork); },
+               [&] { r = right().erase_batch_impl(child, found ? mid + 1 : mid, last, fork); });
+
+          if (found) {
+            return join2(l, r);
+          }
+          if (l.second.root_link() == left().root_link() && r.second.root_link() == right().root_link()) {
+            return bdepthtree_t(bdepth, *this);
+          }
+          return join_at(l, *this, r);
+        }
+
+        template <typename Key>
+        deltatree_t erase_impl(Key const& v) const
+        {
+          if (empty()) {
+            return std::make_pair(0, *this);
+          }
+          else if (color() == BLACK) {
+            return black_erase_impl(v);
+          }
+          else {
+            return red_erase_impl(v);
+          }
+        }
+
+        template <typename Ops, typename Key>
+        deltatree_t black_erase_right_impl(Key const& v) const
+        {
+          auto new_right = Ops::right(*this).erase_impl(v);
+
+          if (new_right.first == 0)
+          {
+            return std::make_pair(0, Ops::with_right(*this,
+                                                     std::move(new_right.second)));
+          }
+          else
+          {
+            return black_fixup_right_impl<Ops>(Ops::with_right(*this,
+                                                               std::move(new_right.second)));
+          }
+        }
+
+        template <typename Key>
+        deltatree_t black_erase_impl(Key const& v) const
+        {
+          assert(color() == BLACK);
+
+          int const order = key_order(v, keyval());
+          if (order < 0)
+          {
+            return black_erase_right_impl<lhs_ops>(v);
+          }
+          else if (order > 0)
+          {
+            return black_erase_right_impl<rhs_ops>(v);
+          }
+          else
+          {
+            if (left().empty())
+            {
+              if (right().empty())
+              {
+                return std::make_pair(-1, rb_tree::empty_like(*this));
+              }
+              else
+              {
+                // Since empty(left), right must be a red leaf. No change in black depth.
+                return std::make_pair(0, with_color(right(), BLACK));
+              }
+            }
+            else if (right().empty())
+            {
+              assert(!left().empty());
+              // Since empty(right), left must be a red leaf. No change in black depth.
+              return std::make_pair(0, with_color(left(), BLACK));
+            }
+            else
+            {
+              assert(!left().empty() && !right().empty());
+              auto predecessor_kv = left().find_max();
+              auto new_left = left().erase_impl(*predecessor_kv);
+              auto relabeled_t = rb_tree::with_left_right_keyval(*this, std::move(new_left.second), rb_tree(right()), key_value_type(*predecessor_kv));
+              if (new_left.first == 0)
+              {
+                return std::make_pair(0, std::move(relabeled_t));
+              }
+              else
+              {
+                return black_fixup_left(relabeled_t);
+              }
+            }
+          }
+        }
+
+        template <typename Ops, typename Key>
+        deltatree_t red_erase_right_impl(Key const& v) const
+        {
+          auto new_right = Ops::right(*this).erase_impl(v);
+
+          if (new_right.first == 0)
+          {
+            return std::make_pair(0, Ops::with_right(*this,
+                                                     std::move(new_right.second)));
+          }
+          else
+          {
+            return red_fixup_right_impl<Ops>(Ops::with_right(*this,
+                                                             std::move(new_right.second)));
+          }
+        }
+
+        template <typename Key>
+        deltatree_t red_erase_impl(Key const& v) const
+        {
+          int const order = key_order(v, keyval());
+          if (order < 0)
+          {
+            return red_erase_right_impl<lhs_ops>(v);
+          }
+          else if (order > 0)
+          {
+            return red_erase_right_impl<rhs_ops>(v);
+          }
+          else
+          {
+            // deleting t
+            if (left().empty())
+            {
+              assert(right().empty());
+              return std::make_pair(0, rb_tree::empty_like(*this));
+            }
+            else
+            {
+              assert(!right().empty());
+              auto predecessor_kv = left().find_max();
+              auto new_left = left().erase_impl(*predecessor_kv);
+              auto relabeled_t = rb_tree::with_left_right_keyval(*this, std::move(new_left.second), rb_tree(right()), key_value_type(*predecessor_kv));
+              if (new_left.first == 0)
+              {
+                return std::make_pair(0, std::move(relabeled_t));
+              }
+              else
+              {
+                return red_fixup_left(relabeled_t);
+              }
+            }
+          }
+        }
+
+        template <typename Ops>
+        shapetree_t insert_impl(key_value_type&& v, rb_color_t sibling_color) const
+        {
+          if (empty())
+          {
+            return std::make_pair(RBB,
+                                  rb_tree::leaf(*this, std::move(v), RED));
+          }
+
+          // paranoid? use shape_checked(..._insert_impl(...)) below.
+
+          if (color() == BLACK)
+          {
+            return black_insert_impl(std::move(v));
+          }
+          else
+          {
+            return red_insert_impl<Ops>(std::move(v), sibling_color);
+          }
+        }
+
+        // special case for red parent nodes
+        shapetree_t black_or_empty_insert_impl(key_value_type&& v) const
+        {
+          return empty() ?
+            std::make_pair(RBB, rb_tree::leaf(*this, std::move(v), RED)) :
+            black_insert_impl(std::move(v));
+        }
+
+        template <typename Ops>
+        shapetree_t black_insert_right_impl(key_value_type&& v) const
+        {
+          auto left_color = Ops::left(*this).color();
+          auto new_right = Ops::right(*this).template insert_impl<Ops>(std::move(v), left_color);
+
+          if (new_right.first == Ops::shape_RRB())
+          {
+            // child will rotate RRB to RBR if sibling_color (left_color here) is black
+            assert(left_color == RED);
+            // (T{B} L{R} R{?})
+            // (T{B} L{R} (R*{R} RL*{R} RR*{B})) -> (T{R} L{B} R*{B})
+            return std::make_pair(RBB,
+                                  Ops::with_left_right_color(*this,
+                                                             with_color(Ops::left(*this), BLACK),
+                                                             // FIXME: move new_right?
+                                                             with_color(new_right.second, BLACK),
+                                                             RED));
+          }
+          else if (new_right.first == Ops::shape_RBR())
+          {
+            // (T{B} L{?} R{?}
+            if (left_color == BLACK)
+            {
+              // (T{B} L{B} (R*{R} RL*{B} RR*{R})) -> (R*{B} (T{R} L RL*) RR*)
+              return std::make_pair(BRR,
+                                    // FIXME: move new_right
+                                    Ops::with_left_right_color(new_right.second,
+                                                               Ops::with_left_right_color(*this,
+                                                                                          Ops::left(*this),
+                                                                                          Ops::left(new_right.second),
+                                                                                RED),
+                                                               Ops::right(new_right.second),
+                                                               BLACK));
+            }
+            else
+            {
+              // (T{B} L{R} (R*{R} RL*{B} RR*{R})) -> (T{R} L{B} R*{B})
+              return std::make_pair(RBB,
+                                    Ops::with_left_right_color(*this,
+                                                               with_color(Ops::left(*this), BLACK),
+                                                               with_color(new_right.second, BLACK),
+                                                               RED));
+            }
+          }
+          else
+          {
+            // (T{B} L{?} R{?})
+            // (T L R*) -> (T L R*)
+            return std::make_pair(Ops::rb_mk_shape(BLACK, left_color, rb_shape_parent(new_right.first)),
+                                  Ops::with_right(*this, std::move(new_right.second)));
+          }
+        }
+
+        shapetree_t black_insert_impl(key_value_type&& v) const
+        {
+          int const order = key_order(v, keyval());
+          if (order < 0)
+          {
+            return black_insert_right_impl<lhs_ops>(std::move(v));
+          }
+          else if (order > 0)
+          {
+            return black_insert_right_impl<rhs_ops>(std::move(v));
+          }
+          else
+          {
+            // (T{B} L{?} R{?}) -> (T{val = v} L R)
+            return std::make_pair(rb_mk_shape(BLACK, left().color(), right().color()),
+                                  rb_tree::with_keyval(*this, std::move(v)));
+          }
+        }
+
+        template <typename Ops>
+        shapetree_t red_insert_impl(key_value_type&& v, rb_color_t sibling_color) const
+        {
+          // (T{R} L{B} R{B})
+          assert(color() == RED);
+
+          int const order = Ops::key_order(*this, v, keyval());
+          if (order < 0)
+          {
+            // As t is red, t.left() is black ...
+            auto new_left = Ops::left(*this).black_or_empty_insert_impl(std::move(v));
+
+            // no change causes three consecutive RED nodes, only have to consider these cases
+            assert(rb_shape_parent(new_left.first) == BLACK || new_left.first == RBB);
+
+            if (new_left.first == RBB && sibling_color == BLACK)
+            {
+                // (T{R} (L*{R} LL*{B} LR*{B}) R{B}) -> (L*{R} LL*{B} (T{R} LR*{B} R{B}))
+              // FIXME: new_left.second moved? steal keyval...
+              return std::make_pair(Ops::shape_RBR(),
+                                    Ops::with_right(new_left.second,
+                                                    Ops::with_left(*this, Ops::right(new_left.second))));
+            }
+            else
+            {
+              // (T{R} L*{R} R{B}) -> (T{R} L*{R} R{B}) - new_left.first == RBB && sibling_color == RED
+              // or
+              // (T{R} L*{B} R{B}) -> (T{R} L*{B} R{B}) - rb_shape_parent(new_left.first) == BLACK
+              return std::make_pair(Ops::rb_mk_shape(RED, rb_shape_parent(new_left.first), BLACK),
+                                    Ops::with_left(*this, std::move(new_left.second)));
+            }
+          }
+          else if (order > 0)
+          {
+            // As t is red, t.right() is black ...
+            auto new_right = Ops::right(*this).black_or_empty_insert_impl(std::move(v));
+
+            // no change causes three consecutive RED nodes, only have to consider these cases
+            assert(rb_shape_parent(new_right.first) == BLACK || new_right.first == RBB);
+
+            // (T{R} L{B} R*{R}) -> (T{R} L{B} R*{R})
+            // or
+            // (T{R} L{B} R*{B}) -> (T{R} L{B} R*{B})
+            return std::make_pair(Ops::rb_mk_shape(RED, BLACK, rb_shape_parent(new_right.first)),
+                                  Ops::with_right(*this, std::move(new_right.second)));
+          }
+          else
+          {
+            // (T{R} L{B} R{B}) -> (T{R, val = v}, L{B} R{B})
+            return std::make_pair(RBB,
+                                  rb_tree::with_keyval(*this, std::move(v)));
+          }
+        }
+      };
+
+    protected:
+      static rb_tree with_color(subtree_ref const& t, rb_color_t color) {
+        return base_type::with_tag(t, color);
+      }
+
+      static rb_tree with_left_right_color(subtree_ref const& t, rb_tree left, rb_tree right, rb_color_t color) {
+        return base_type::with_left_right_tag(t, std::move(left), std::move(right), color);
+      }
+    };
+  }
+}
+
+#endif // PST_TREE_H__
+
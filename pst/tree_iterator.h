@@ -1,120 +1,215 @@
-#pragma once
-
-#ifndef PST_TREE_ITERATOR_H__
-#define PST_TREE_ITERATOR_H__
-
-#include <iterator>
-#include <vector>
-
-namespace pst
-{
-  namespace tree
-  {
-    template <typename Tree>
-    struct tree_iterator : public std::iterator<std::forward_iterator_tag, typename Tree::key_value_type const>
-    {
-      tree_iterator() {}
-
-      tree_iterator(tree_iterator const& ti)
-        : path(ti.path)
-      {}
-
-      tree_iterator(Tree const& t)
-      {
-        descend_left(t);
-      }
-
-      tree_iterator& operator=(tree_iterator const& other) {
-        path = other.path;
-        return *this;
-      }
-
-      friend bool operator==(tree_iterator const& lhs, tree_iterator const& rhs) {
-        lhs.path == rhs.path;
-      }
-
-      friend bool operator!=(tree_iterator const& lhs, tree_iterator const& rhs) {
-        return !(lhs == rhs);
-      }
-
-      value_type operator*() const {
-        return tree().keyval();
-      }
-
-      tree_iterator& operator++()
-      {
-        if (!tree().right().empty()) {
-          descend_left(tree().right());
-        }
-        else {
-          bool from_left = false;
-          do {
-            if (!has_parent()) {
-              path.clear();
-              break;
-            }
-
-            from_left = is_left_child();
-            ascend();
-          } while (!from_left);
-        }
-
-        return *this;
-      }
-
-      tree_iterator operator++(int)
-      {
-        tree_iterator here(*this);
-        ++*this;
-        return here;
-      }
-
-    private:
-      bool has_parent() const
-      {
-        return 1 < path.size();
-      }
-
-      Tree const& parent() const
-      {
-        assert(has_parent());
-        return *path[path.size() - 2];
-      }
-
-      bool is_left_child() const
-      {
-        assert(has_parent());
-        return parent().left() == tree();
-      }
-
-      Tree const& tree() const
-      {
-        return *path.back();
-      }
-
-      bool has_left_child() const
-      {
-        return !tree().left().empty();
-      }
-
-      void ascend()
-      {
-        assert(has_parent());
-        path.pop_back();
-      }
-
-      void descend_left(Tree const& t)
-      {
-        if (!t.empty()) {
-          path.push_back(&t);
-          descend_left(tree().left());
-        }
-      }
-
-    private:
-      std::vector<Tree const*> path;
-    };
-  }
-}
-
-#endif // PST_TREE_ITERATOR_H__
+#pragma once
+
+#ifndef PST_TREE_ITERATOR_H__
+#define PST_TREE_ITERATOR_H__
+
+#include <algorithm> // copy
+#include <cassert>
+#include <cstddef> // size_t, ptrdiff_t
+#include <iterator>
+#include <stdexcept> // length_error
+
+namespace pst
+{
+  namespace tree
+  {
+    // In-order iterator over a tree. The trees have no parent links, so it
+    // keeps the path from the root to its value, in a fixed array inside
+    // the iterator: iterating allocates nothing. A red-black tree of n
+    // values is at most 2 log2(n + 1) deep, which bounds the path for any
+    // size that fits in memory; on a bs_tree deeper than that the
+    // iterator throws std::length_error.
+    //
+    // The iterator points into the tree handle it was made from and is
+    // valid while that handle is, values are returned by reference.
+    template <typename Tree>
+    struct tree_iterator
+    {
+      typedef std::bidirectional_iterator_tag iterator_category;
+      typedef typename Tree::key_value_type value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef value_type const* pointer;
+      typedef value_type const& reference;
+      typedef typename Tree::link link;
+
+      static std::size_t const max_depth = 2 * 8 * sizeof(std::size_t);
+
+      // equal to the end of any tree
+      tree_iterator() : root(0), depth(0) {}
+
+      // at the first value of t
+      tree_iterator(Tree const& t) : root(&t), depth(0)
+      {
+        descend_left(t.root_link());
+      }
+
+      // past the last value of t, where -- finds the last one
+      static tree_iterator end_of(Tree const& t)
+      {
+        tree_iterator it;
+        it.root = &t;
+        return it;
+      }
+
+      // At the first value of t for which at holds, at being false for
+      // the values before some point and true from there on; the end
+      // iterator if it holds for none. One descent, and the path to the
+      // value is what the iterator keeps, so it needs no second one.
+      template <typename Pred>
+      static tree_iterator first_where(Tree const& t, Pred at)
+      {
+        tree_iterator it = end_of(t);
+        std::size_t found = 0;
+        for (link const* n = &t.root_link(); !n->empty();) {
+          it.push(n);
+          if (at(n->keyval())) {
+            found = it.depth;
+            n = &n->left();
+          }
+          else {
+            n = &n->right();
+          }
+        }
+        it.depth = found;
+        return it;
+      }
+
+      // At the last value of t for which at holds, at being true for the
+      // values before some point and false from there on.
+      template <typename Pred>
+      static tree_iterator last_where(Tree const& t, Pred at)
+      {
+        tree_iterator it = end_of(t);
+        std::size_t found = 0;
+        for (link const* n = &t.root_link(); !n->empty();) {
+          it.push(n);
+          if (at(n->keyval())) {
+            found = it.depth;
+            n = &n->right();
+          }
+          else {
+            n = &n->left();
+          }
+        }
+        it.depth = found;
+        return it;
+      }
+
+      // copies only the part of the path in use
+      tree_iterator(tree_iterator const& other) : root(other.root), depth(other.depth)
+      {
+        std::copy(other.path, other.path + depth, path);
+      }
+
+      tree_iterator& operator=(tree_iterator const& other)
+      {
+        root = other.root;
+        depth = other.depth;
+        std::copy(other.path, other.path + depth, path);
+        return *this;
+      }
+
+      // for iterators into the same tree, by the node they are at
+      friend bool operator==(tree_iterator const& lhs, tree_iterator const& rhs) {
+        return lhs.depth == rhs.depth && (lhs.depth == 0 || lhs.path[lhs.depth - 1] == rhs.path[rhs.depth - 1]);
+      }
+
+      friend bool operator!=(tree_iterator const& lhs, tree_iterator const& rhs) {
+        return !(lhs == rhs);
+      }
+
+      reference operator*() const {
+        return tree().keyval();
+      }
+
+      pointer operator->() const {
+        return &tree().keyval();
+      }
+
+      // up to the first ancestor entered from its left, if not right down
+      tree_iterator& operator++()
+      {
+        assert(depth > 0);
+        if (!tree().right().empty()) {
+          descend_left(tree().right());
+        }
+        else {
+          link const* child;
+          do {
+            child = path[--depth];
+          } while (depth > 0 && &path[depth - 1]->left() != child);
+        }
+        return *this;
+      }
+
+      tree_iterator& operator--()
+      {
+        if (depth == 0) {
+          assert(root);
+          descend_right(root->root_link());
+        }
+        else if (!tree().left().empty()) {
+          descend_right(tree().left());
+        }
+        else {
+          link const* child;
+          do {
+            child = path[--depth];
+          } while (depth > 0 && &path[depth - 1]->right() != child);
+        }
+        return *this;
+      }
+
+      tree_iterator operator++(int)
+      {
+        tree_iterator here(*this);
+        ++*this;
+        return here;
+      }
+
+      tree_iterator operator--(int)
+      {
+        tree_iterator here(*this);
+        --*this;
+        return here;
+      }
+
+    private:
+      link const& tree() const
+      {
+        assert(depth > 0);
+        return *path[depth - 1];
+      }
+
+      void push(link const* t)
+      {
+        if (depth == max_depth) {
+          throw std::length_error("tree_iterator: tree too deep");
+        }
+        path[depth++] = t;
+      }
+
+      void descend_left(link const& t)
+      {
+        for (link const* n = &t; !n->empty(); n = &n->left()) {
+          push(n);
+        }
+      }
+
+      void descend_right(link const& t)
+      {
+        for (link const* n = &t; !n->empty(); n = &n->right()) {
+          push(n);
+        }
+      }
+
+      Tree const* root;
+      std::size_t depth;
+      link const* path[max_depth];
+    };
+
+    template <typename Tree> std::size_t const tree_iterator<Tree>::max_depth;
+  }
+}
+
+#endif // PST_TREE_ITERATOR_H__
@@ -1,77 +1,111 @@
-#pragma once
-
-#ifndef PST_TREE_SANE_H__
-#define PST_TREE_SANE_H__
-
-#include "tree.h"
-
-namespace pst
-{
-  namespace tree
-  {
-    namespace detail
-    {
-      template <typename T, typename L, typename E>
-      bool do_check(rb_tree<T, L, E> const& t)
-      {
-        if (t.empty())
-        {
-          return true;
-        }
-
-        auto l = t.left(), r = t.right();
-
-        if (t.color() == RED && (l.color() == RED || r.color() == RED))
-        {
-          return false;
-        }
-
-        if (!l.empty() && !rb_tree<T, L, E>::key_less(l.keyval(), t.keyval()))
-        {
-          return false;
-        }
-
-        if (!r.empty() && !rb_tree<T, L, E>::key_less(t.keyval(), r.keyval()))
-        {
-          return false;
-        }
-
-        if (l.bdepth() != r.bdepth())
-        {
-          return false;
-        }
-
-        return do_check(l) && do_check(r);
-      }
-    }
-
-    template <typename T, typename L, typename E>
-    bool check(bs_tree<T, L, E> const& t)
-    {
-      if (t.empty())
-        return true;
-
-      auto l = t.left(), r = t.right();
-
-      if (!l.empty() && !bs_tree<T, L, E>::key_less(l.keyval(), t.keyval()))
-      {
-        return false;
-      }
-
-      if (!r.empty() && !bs_tree<T, L, E>::key_less(t.keyval(), r.keyval()))
-      {
-        return false;
-      }
-
-      return check(l) && check(r);
-    }
-
-    template <typename T, typename L, typename E>
-    bool check(rb_tree<T, L, E> const& t)
-    {
-      return t.color() == BLACK && detail::do_check(t);
-    }
-  }
-}
-
-#endif // PST_TREE_SANE_H__
+#pragma once
+
+#ifndef PST_TREE_SANE_H__
+#define PST_TREE_SANE_H__
+
+#include "tree.h"
+#include <type_traits>
+#include <utility> // declval
+
+namespace pst
+{
+  namespace tree
+  {
+    namespace detail
+    {
+      template <typename T, typename = void>
+      struct equality_comparable : std::false_type {};
+
+      template <typename T>
+      struct equality_comparable<T, typename pst::detail::always_void<decltype(std::declval<T const&>() == std::declval<T const&>())>::type> : std::true_type {};
+
+      // a summary must be that of its node and children, where summaries
+      // can be compared
+      template <typename Augment, typename Subtree>
+      bool check_summary(Subtree const& t, std::true_type)
+      {
+        return t.summary() == Augment::summarize(t.left().summary(), t.keyval(), t.right().summary());
+      }
+
+      template <typename Augment, typename Subtree>
+      bool check_summary(Subtree const&, std::false_type)
+      {
+        return true;
+      }
+
+      template <typename Tree>
+      bool do_check(typename Tree::subtree const& t)
+      {
+        if (t.empty())
+        {
+          return true;
+        }
+
+        auto l = t.left(), r = t.right();
+
+        if (t.color() == RED && (l.color() == RED || r.color() == RED))
+        {
+          return false;
+        }
+
+        if (!l.empty() && !t.key_less(l.keyval(), t.keyval()))
+        {
+          return false;
+        }
+
+        if (!r.empty() && !t.key_less(t.keyval(), r.keyval()))
+        {
+          return false;
+        }
+
+        if (l.bdepth() != r.bdepth())
+        {
+          return false;
+        }
+
+        typedef typename Tree::augment_policy augment_policy;
+        if (!check_summary<augment_policy>(t, equality_comparable<typename Tree::summary_type>()))
+        {
+          return false;
+        }
+
+        return do_check<Tree>(l) && do_check<Tree>(r);
+      }
+
+      template <typename Tree>
+      bool do_check_bs(typename Tree::subtree const& t)
+      {
+        if (t.empty())
+          return true;
+
+        auto l = t.left(), r = t.right();
+
+        if (!l.empty() && !t.key_less(l.keyval(), t.keyval()))
+        {
+          return false;
+        }
+
+        if (!r.empty() && !t.key_less(t.keyval(), r.keyval()))
+        {
+          return false;
+        }
+
+        return do_check_bs<Tree>(l) && do_check_bs<Tree>(r);
+      }
+    }
+
+    template <typename T, typename L, typename A, typename R, typename S>
+    bool check(bs_tree<T, L, A, R, S> const& t)
+    {
+      return detail::do_check_bs<bs_tree<T, L, A, R, S>>(t);
+    }
+
+    template <typename T, typename L, typename A, typename R, typename S, typename G>
+    bool check(rb_tree<T, L, A, R, S, G> const& t)
+    {
+      return t.color() == BLACK && detail::do_check<rb_tree<T, L, A, R, S, G>>(t);
+    }
+  }
+}
+
+#endif // PST_TREE_SANE_H__
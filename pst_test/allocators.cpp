@@ -0,0 +1,425 @@
+#include "allocators.h"
+#include "rand.h"
+#include <pst/pool_allocator.h>
+#include <pst/arena.h>
+#include <pst/slab_allocator.h>
+#include <pst/tree.h>
+#include <pst/tree_sane.h>
+#include <pst/list.h>
+#include <pst/set.h>
+#include <pst/map.h>
+#include <cassert>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  typedef pst::tree::rb_tree<int, std::less<int>, pst::pool_allocator<int> > pool_rb_tree;
+
+  void pool_rb_tree_test()
+  {
+    auto t = pool_rb_tree::empty_tree();
+    std::set<int> ints;
+
+    for (int i = 0; i < 2000; ++i)
+    {
+      int r = rand_int() % 1000;
+
+      if (i % 3 == 2) {
+        ints.erase(r);
+        t = t.erase(r);
+      }
+      else {
+        ints.insert(r);
+        t = t.insert(r);
+      }
+    }
+
+    assert(check(t));
+    assert(t.size() == ints.size());
+
+    for (auto i = begin(ints); i != end(ints); ++i)
+      assert(t.find(*i));
+  }
+
+  void pool_cross_thread_test()
+  {
+    // nodes built on one thread, dropped on others, then reused there
+    std::vector<pool_rb_tree> trees(4);
+
+    for (std::size_t i = 0; i < trees.size(); ++i)
+      for (int j = 0; j < 1000; ++j)
+        trees[i] = trees[i].insert(j * 4 + static_cast<int>(i));
+
+    std::vector<std::thread> threads;
+
+    for (std::size_t i = 0; i < trees.size(); ++i)
+    {
+      threads.push_back(std::thread([&trees, i] {
+        pool_rb_tree t;
+        std::swap(t, trees[i]);
+        t = pool_rb_tree::empty_tree();
+
+        for (int j = 0; j < 1000; ++j)
+          t = t.insert(j);
+
+        assert(check(t));
+        assert(t.size() == 1000);
+      }));
+    }
+
+    for (auto& t : threads)
+      t.join();
+  }
+
+  void slab_cross_thread_test()
+  {
+    typedef pst::tree::rb_tree<int, std::less<int>, pst::slab_allocator<int> > slab_rb_tree;
+
+    // indices freed on other threads are handed back out there
+    std::vector<slab_rb_tree> trees(4);
+
+    for (std::size_t i = 0; i < trees.size(); ++i)
+      for (int j = 0; j < 3000; ++j)
+        trees[i] = trees[i].insert(j * 4 + static_cast<int>(i));
+
+    std::vector<std::thread> threads;
+
+    for (std::size_t i = 0; i < trees.size(); ++i)
+    {
+      threads.push_back(std::thread([&trees, i] {
+        slab_rb_tree t;
+        std::swap(t, trees[i]);
+        t = slab_rb_tree::empty_tree();
+
+        for (int j = 0; j < 3000; ++j)
+          t = t.insert(j);
+
+        assert(check(t));
+        assert(t.size() == 3000);
+      }));
+    }
+
+    for (auto& t : threads)
+      t.join();
+  }
+
+  // a thread_local tree made before the thread's first allocation is
+  // destroyed after the thread's free list cache
+  template <typename Tree>
+  void thread_exit_test()
+  {
+    std::thread([] {
+      static thread_local Tree t;
+      for (int j = 0; j < 1000; ++j)
+        t = t.insert(j);
+    }).join();
+
+    // what it freed on the way out is handed out again
+    auto t = Tree::empty_tree();
+    for (int j = 0; j < 3000; ++j)
+      t = t.insert(j);
+    assert(check(t));
+  }
+
+  void pool_slist_test()
+  {
+    auto lst = pst::list::empty_slist<int, pst::pool_allocator<int>, pst::atomic_refcount>();
+
+    for (int i = 0; i < 1000; ++i)
+      lst = cons(i, lst);
+
+    assert(car(lst) == 999);
+  }
+
+  // counts what goes through the allocator instance a tree was created with
+  struct alloc_counts
+  {
+    alloc_counts() : allocs(0), deallocs(0) {}
+    int allocs, deallocs;
+  };
+
+  template <typename T>
+  struct counting_allocator
+  {
+    typedef T value_type;
+
+    template <typename U> struct rebind { typedef counting_allocator<U> other; };
+
+    explicit counting_allocator(alloc_counts& c) : counts(&c) {}
+    template <typename U> counting_allocator(counting_allocator<U> const& other) : counts(other.counts) {}
+
+    T* allocate(std::size_t n) { ++counts->allocs; return std::allocator<T>().allocate(n); }
+    void deallocate(T* p, std::size_t n) { ++counts->deallocs; std::allocator<T>().deallocate(p, n); }
+
+    friend bool operator==(counting_allocator const& lhs, counting_allocator const& rhs) { return lhs.counts == rhs.counts; }
+    friend bool operator!=(counting_allocator const& lhs, counting_allocator const& rhs) { return lhs.counts != rhs.counts; }
+
+    alloc_counts* counts;
+  };
+
+  // orders either way, chosen at run time
+  struct flip_less
+  {
+    explicit flip_less(bool descending = false) : descending(descending) {}
+    bool operator()(int lhs, int rhs) const { return descending ? rhs < lhs : lhs < rhs; }
+    bool descending;
+  };
+
+  // n keys 0, step, 2 * step, ... built in linear time into a tree
+  // allocating from a
+  template <typename Tree>
+  Tree sorted_tree(std::size_t n, int step, alloc_counts& a)
+  {
+    std::vector<int> keys(n);
+    for (std::size_t i = 0; i < n; ++i)
+      keys[i] = static_cast<int>(i) * step;
+    return Tree::from_sorted(begin(keys), end(keys), std::less<int>(), counting_allocator<int>(a));
+  }
+
+  void counting_allocator_test()
+  {
+    typedef pst::tree::rb_tree<int, std::less<int>, counting_allocator<int> > counted_tree;
+
+    alloc_counts a, b;
+    {
+      auto t = counted_tree::empty_tree(std::less<int>(), counting_allocator<int>(a));
+      auto u = counted_tree::empty_tree(std::less<int>(), counting_allocator<int>(b));
+
+      for (int i = 0; i < 500; ++i) {
+        t = t.insert(i);
+        if (i % 2)
+          t = t.erase(i / 2);
+        u = u.insert(-i);
+      }
+
+      assert(check(t) && check(u));
+      assert(t.get_allocator() == counting_allocator<int>(a));
+
+      // assignment hands over the allocator along with the nodes
+      counted_tree v = t;
+      t = u;
+      assert(t.get_allocator() == counting_allocator<int>(b));
+      assert(v.get_allocator() == counting_allocator<int>(a));
+      assert(v.insert(1000).get_allocator() == counting_allocator<int>(a));
+    }
+    assert(a.allocs > 0 && a.allocs == a.deallocs);
+    assert(b.allocs > 0 && b.allocs == b.deallocs);
+  }
+
+  void transient_allocation_test()
+  {
+    typedef pst::tree::rb_tree<int, std::less<int>, counting_allocator<int> > counted_tree;
+
+    alloc_counts a;
+    {
+      counted_tree::transient tr(counted_tree::empty_tree(std::less<int>(), counting_allocator<int>(a)));
+
+      // nodes the transient owns are reused, one allocation per new key
+      for (int i = 0; i < 1000; ++i)
+        tr.insert(i);
+      assert(a.allocs == 1000);
+
+      auto frozen = tr.persistent();
+
+      // after a snapshot the path to each change is copied once
+      tr.insert(1000);
+      int const copied = a.allocs - 1001;
+      assert(copied > 0 && copied <= 2 * 11);
+
+      tr.insert(1001);
+      assert(a.allocs <= 1001 + copied + 1 + 2);
+      assert(frozen.size() == 1000);
+    }
+    assert(a.allocs == a.deallocs);
+  }
+
+  void batch_allocation_test()
+  {
+    typedef pst::tree::rb_tree<int, std::less<int>, counting_allocator<int> > counted_tree;
+
+    alloc_counts a;
+    {
+      auto const t = sorted_tree<counted_tree>(100000, 2, a);
+
+      // 1000 new keys close together
+      std::vector<int> batch;
+      for (int i = 0; i < 1000; ++i)
+        batch.push_back(50001 + 2 * i);
+
+      int const before = a.allocs;
+      auto one_by_one = t;
+      for (int i : batch)
+        one_by_one = one_by_one.insert(i);
+      int const sequential = a.allocs - before;
+
+      auto const batched = t.insert_batch(batch);
+      int const together = a.allocs - before - sequential;
+
+      assert(check(batched) && batched.size() == one_by_one.size());
+      assert(together * 4 < sequential);
+
+      // erasing what is not there copies nothing
+      int const before_erase = a.allocs;
+      assert(batched.erase_batch(std::vector<int>{ 1, 3, 5 }) == batched);
+      assert(a.allocs == before_erase);
+
+      auto const erased = batched.erase_batch(batch);
+      assert(check(erased) && erased.size() == t.size());
+    }
+    assert(a.allocs == a.deallocs);
+  }
+
+  void zipper_allocation_test()
+  {
+    typedef pst::tree::rb_tree<int, std::less<int>, counting_allocator<int> > counted_tree;
+
+    alloc_counts a;
+    {
+      auto const t = sorted_tree<counted_tree>(100000, 2, a);
+
+      // 1000 edits close together: new keys, changed ones and erased ones
+      int const before = a.allocs;
+      auto one_by_one = t;
+      for (int i = 0; i < 1000; ++i)
+        one_by_one = i % 3 == 2 ? one_by_one.erase(50000 + 2 * i) : one_by_one.insert(50001 + 2 * i);
+      int const sequential = a.allocs - before;
+
+      counted_tree::zipper z(t, 50000);
+      for (int i = 0; i < 1000; ++i)
+      {
+        if (i % 3 == 2)
+          z.erase(50000 + 2 * i);
+        else
+          z.insert(50001 + 2 * i);
+      }
+      auto const zipped = z.close();
+      int const together = a.allocs - before - sequential;
+
+      assert(check(zipped) && zipped.size() == one_by_one.size());
+      assert(std::equal(zipped.begin(), zipped.end(), one_by_one.begin()));
+      assert(together * 4 < sequential);
+    }
+    assert(a.allocs == a.deallocs);
+  }
+
+  void range_allocation_test()
+  {
+    typedef pst::tree::rb_tree<int, std::less<int>, counting_allocator<int> > counted_tree;
+
+    alloc_counts a;
+    {
+      auto const t = sorted_tree<counted_tree>(100000, 1, a);
+
+      // new nodes only along the cuts, none for the 50000 taken out
+      int const before = a.allocs;
+      auto const parts = t.extract_range(20000, 70000);
+      assert(a.allocs - before < 200);
+      assert(check(parts.first) && parts.first.size() == 50000);
+      assert(check(parts.second) && parts.second.size() == 50000);
+    }
+    assert(a.allocs == a.deallocs);
+  }
+
+  void from_sorted_allocation_test()
+  {
+    typedef pst::set::rb_set<int, std::less<int>, counting_allocator<int> > counted_set;
+
+    alloc_counts a;
+    {
+      auto s = sorted_tree<counted_set>(100000, 2, a);
+      assert(a.allocs == 100000);
+      assert(s.member(0) && s.member(199998) && !s.member(1));
+    }
+    assert(a.allocs == a.deallocs);
+  }
+
+  void stateful_compare_test()
+  {
+    typedef pst::tree::rb_tree<int, flip_less> flip_tree;
+
+    // the comparator stays in the handles, a node's child links are a word
+    static_assert(sizeof(flip_tree::link) == sizeof(void*), "child links carry the comparator");
+
+    auto up = flip_tree::empty_tree(flip_less(false));
+    auto down = flip_tree::empty_tree(flip_less(true));
+
+    for (int i = 0; i < 100; ++i) {
+      up = up.insert(i);
+      down = down.insert(i);
+    }
+
+    down = down.erase(99).erase(0);
+
+    assert(check(up) && check(down));
+    assert(*up.find_min() == 0 && *up.find_max() == 99);
+    assert(*down.find_min() == 98 && *down.find_max() == 1);
+
+    auto m = pst::map::rb_map<int, int, flip_less>::empty_map(flip_less(true)).insert(1, 10).insert(2, 20);
+    assert(m.key_comp().descending && m.find(2)->second == 20);
+  }
+
+  void arena_test()
+  {
+    typedef pst::tree::rb_tree<int, std::less<int>, pst::arena_allocator<int> > arena_tree;
+    static_assert(sizeof(arena_tree::link) == sizeof(void*), "child links carry the allocator");
+
+    pst::arena a(4096);
+    std::vector<arena_tree> versions;
+    std::set<int> ints;
+
+    auto t = arena_tree::empty_tree(std::less<int>(), pst::arena_allocator<int>(a));
+
+    for (int i = 0; i < 2000; ++i) {
+      int r = rand_int() % 1000;
+      ints.insert(r);
+      t = t.insert(r);
+      if (i % 100 == 0)
+        versions.push_back(t);
+    }
+
+    assert(check(t));
+    assert(t.size() == ints.size());
+    assert(versions.front().size() == 1);
+    assert(a.bytes_allocated() > 0);
+
+    auto s = pst::set::rb_set<int, std::less<int>, pst::arena_allocator<int> >::empty_set(std::less<int>(), pst::arena_allocator<int>(a));
+    s = s.insert(3).insert(1).insert(2);
+    assert(s.member(2) && s.get_allocator() == pst::arena_allocator<int>(a));
+  }
+}
+
+void test_pool_allocator()
+{
+  pool_rb_tree_test();
+  pool_cross_thread_test();
+  thread_exit_test<pool_rb_tree>();
+  pool_slist_test();
+
+  auto s = pst::set::rb_set<int, std::less<int>, pst::pool_allocator<int> >::from({ 1, 2, 3 });
+  assert(s.member(2));
+}
+
+void test_slab_allocator()
+{
+  slab_cross_thread_test();
+  thread_exit_test<pst::tree::rb_tree<int, std::less<int>, pst::slab_allocator<int> > >();
+
+  auto s = pst::set::rb_set<int, std::less<int>, pst::slab_allocator<int> >::from({ 3, 1, 2 });
+  assert(s.member(2) && !s.member(4));
+  s = s.erase(2);
+  assert(!s.member(2));
+}
+
+void test_stateful_allocator()
+{
+  counting_allocator_test();
+  transient_allocation_test();
+  batch_allocation_test();
+  zipper_allocation_test();
+  range_allocation_test();
+  from_sorted_allocation_test();
+  stateful_compare_test();
+  arena_test();
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#ifndef PST_TEST_ALLOCATORS_H__
+#define PST_TEST_ALLOCATORS_H__
+
+void test_pool_allocator();
+void test_slab_allocator();
+void test_stateful_allocator();
+
+#endif // PST_TEST_ALLOCATORS_H__
@@ -0,0 +1,114 @@
+#include "intervals.h"
+#include "rand.h"
+#include <pst/interval_map.h>
+#include <cassert>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  typedef pst::interval::rb_interval_map<int, int> lease_map;
+  typedef std::map<std::pair<int, int>, int> flat_map;
+
+  // the entries of expected meeting [lo, hi), scanned
+  std::vector<std::pair<int, int>> scan(flat_map const& expected, int lo, int hi)
+  {
+    std::vector<std::pair<int, int>> found;
+    for (auto const& kv : expected)
+    {
+      if (kv.first.first < hi && lo < kv.first.second)
+        found.push_back(kv.first);
+    }
+    return found;
+  }
+
+  std::vector<std::pair<int, int>> intervals(std::vector<lease_map::value_type const*> const& entries)
+  {
+    std::vector<std::pair<int, int>> found;
+    for (auto kv : entries)
+      found.push_back(kv->first);
+    return found;
+  }
+
+  void interval_rand_test()
+  {
+    auto m = lease_map::empty_map();
+    flat_map expected;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+      int const start = rand_int() % 1000;
+      int const end = start + 1 + rand_int() % 50;
+      if (rand_int() % 4 == 0 && !expected.empty())
+      {
+        auto const victim = expected.begin()->first;
+        m = m.erase(victim.first, victim.second);
+        expected.erase(victim);
+      }
+      m = m.insert(start, end, i);
+      expected[std::make_pair(start, end)] = i;
+    }
+    assert(m.size() == expected.size());
+
+    for (int lo = -10; lo < 1060; lo += 13)
+    {
+      for (int hi = lo + 1; hi < lo + 100; hi += 17)
+        assert(intervals(m.overlapping(lo, hi)) == scan(expected, lo, hi));
+      assert(intervals(m.containing(lo)) == scan(expected, lo, lo + 1));
+    }
+    assert(m.overlapping(10, 10).empty());
+  }
+
+  // no default constructor, lookups by interval must not need one
+  struct tenant
+  {
+    explicit tenant(std::string name) : name(std::move(name)) {}
+    std::string name;
+  };
+
+  void interval_key_test()
+  {
+    typedef pst::interval::rb_interval_map<int, tenant> tenancy_map;
+
+    auto flats = tenancy_map::empty_map().insert(1, 5, tenant("ada")).insert(5, 9, tenant("bo")).insert(1, 3, tenant("cy"));
+    assert(flats.find(1, 5) && flats.find(1, 5)->second.name == "ada");
+    assert(!flats.find(1, 4));
+
+    auto moved_out = flats.erase(1, 5);
+    assert(moved_out.size() == 2 && !moved_out.find(1, 5) && flats.find(1, 5));
+
+    tenancy_map::transient tr(moved_out);
+    tr.erase(5, 9);
+    assert(!tr.find(5, 9) && tr.find(1, 3));
+    assert(tr.persistent().size() == 1);
+  }
+}
+
+void test_rb_interval_map()
+{
+  typedef pst::interval::rb_interval_map<int, std::string> booking_map;
+
+  auto rooms = booking_map::from({ { { 9, 12 }, "standup" }, { { 10, 11 }, "review" }, { { 13, 17 }, "offsite" } });
+  auto later = rooms.insert(11, 14, "lunch").erase(10, 11);
+
+  assert(rooms.containing(10).size() == 2);
+  assert(rooms.containing(12).empty());
+  assert(later.containing(12).size() == 1 && later.containing(12)[0]->second == "lunch");
+  assert(later.overlapping(0, 24).size() == 3);
+  assert(rooms.find(10, 11) && !later.find(10, 11));
+  assert(!rooms.find(10, 12));
+
+  booking_map::transient tr(later);
+  tr.insert(16, 18, "drinks");
+  tr.erase(9, 12);
+  auto edited = tr.persistent();
+
+  assert(edited.overlapping(0, 13).size() == 1);
+  assert(edited.containing(16).size() == 2);
+  assert(later.containing(16).size() == 1);
+
+  interval_rand_test();
+  interval_key_test();
+}
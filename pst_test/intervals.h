@@ -0,0 +1,8 @@
+#pragma once
+
+#ifndef PST_TEST_INTERVALS_H__
+#define PST_TEST_INTERVALS_H__
+
+void test_rb_interval_map();
+
+#endif // PST_TEST_INTERVALS_H__
@@ -1,12 +1,29 @@
-#include "lists.h"
-#include <pst/list.h>
-
-void test_slist()
-{
-  auto sl = pst::list::cons<int, int>(1);
-  auto e = pst::list::empty_slist<int>();
-  auto lst = cons(1, cons(2, cons(3, e)));
-  auto lst2 = append(lst, lst);
-  auto lst3 = update(lst2, 2, 4711);
-  auto lst4 = suffixes(lst2);
-}
+#include "lists.h"
+#include <pst/list.h>
+#include <cassert>
+#include <memory>
+
+void test_slist()
+{
+  auto sl = pst::list::cons<int, int>(1);
+  auto e = pst::list::empty_slist<int>();
+  auto lst = cons(1, cons(2, cons(3, e)));
+  auto lst2 = append(lst, lst);
+  auto lst3 = update(lst2, 2, 4711);
+  auto lst4 = suffixes(lst2);
+
+  assert(car(cdr(cdr(lst3))) == 4711);
+  assert(car(cdr(cdr(lst2))) == 3);
+
+  typedef pst::list::slist<int, std::allocator<int>, pst::local_refcount> local_slist;
+  auto local = pst::list::empty_slist<int, std::allocator<int>, pst::local_refcount>();
+
+  // long enough to overflow the stack if nodes were released recursively
+  for (int i = 0; i < 1000000; ++i)
+    local = cons(i, local);
+
+  local_slist head = local;
+  local = cdr(local);
+  assert(car(head) == 999999);
+  assert(car(local) == 999998);
+}
@@ -1,8 +1,8 @@
-#pragma once
-
-#ifndef PST_TEST_LIST_H__
-#define PST_TEST_LIST_H__
-
-void test_slist();
-
-#endif // PST_TEST_LIST_H__
+#pragma once
+
+#ifndef PST_TEST_LIST_H__
+#define PST_TEST_LIST_H__
+
+void test_slist();
+
+#endif // PST_TEST_LIST_H__
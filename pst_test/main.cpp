@@ -1,20 +1,40 @@
-#include "trees.h"
-#include "lists.h"
-#include "sets.h"
-#include "maps.h"
-#include "rand.h"
-
-int main(int /*argc*/, char* /*argv*/ [])
-{
-  init_rand();
-
-  test_slist();
-  test_bs_tree();
-  test_rb_tree();
-  test_rb_set();
-  test_rb_map();
-  iterate_bs_tree();
-  iterate_rb_tree();
-
-  return 0;
-}
+#include "trees.h"
+#include "lists.h"
+#include "sets.h"
+#include "maps.h"
+#include "intervals.h"
+#include "allocators.h"
+#include "rand.h"
+#include <string>
+
+int main(int argc, char* argv [])
+{
+  init_rand();
+
+  test_slist();
+  test_bs_tree();
+  test_rb_tree();
+  test_rb_set();
+  test_rb_map();
+  test_rb_interval_map();
+  test_pool_allocator();
+  test_slab_allocator();
+  test_stateful_allocator();
+  iterate_bs_tree();
+  iterate_rb_tree();
+
+  if (argc > 1 && std::string(argv[1]) == "--time") {
+    time_bs_tree();
+    time_rb_tree();
+    time_parallel_build();
+    time_sorted_load();
+    time_set_algebra();
+    time_parallel_set_algebra();
+    time_batch_update();
+    time_diff();
+    time_iteration();
+    time_finger();
+  }
+
+  return 0;
+}
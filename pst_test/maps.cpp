@@ -1,45 +1,298 @@
-#include "maps.h"
-#include <pst/map.h>
-#include <cassert>
-#include <string>
-
-void test_rb_map()
-{
-  auto m = pst::map::rb_map<std::string, int>::empty_map();
-  assert(m.empty());
-
-  auto m2 = m.insert("three", 3);
-  assert(m2.find("three"));
-  assert(m2.find("three")->second == 3);
-
-  auto m3 = m2.erase("three");
-  assert(!m3.find("three"));
-
-  assert(m3.empty());
-
-  auto m4 = pst::map::rb_map<std::string, int>::from({
-      {"one", 1},
-      {"two", 2},
-      {"three", 3}
-    });
-
-  assert(m4.find("one")->second == 1);
-  assert(m4.find("two")->second == 2);
-  assert(m4.find("three")->second == 3);
-
-  auto vals = { "two", "three" };
-  m4 = m4.erase(begin(vals), end(vals));
-
-  assert(m4.find("one")->second == 1);
-  assert(!m4.find("two"));
-  assert(!m4.find("three"));
-
-  m4 = m4.insert("one", 111);
-
-  assert(m4.find("one")->second == 111);
-
-  m4 = m4.erase("unknown");
-
-  assert(m4.find("one")->second == 111);
-}
-
+#include "maps.h"
+#include <pst/map.h>
+#include "timer.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+void test_rb_map()
+{
+  auto m = pst::map::rb_map<std::string, int>::empty_map();
+  assert(m.empty());
+
+  auto m2 = m.insert("three", 3);
+  assert(m2.find("three"));
+  assert(m2.find("three")->second == 3);
+
+  auto m3 = m2.erase("three");
+  assert(!m3.find("three"));
+
+  assert(m3.empty());
+
+  auto m4 = pst::map::rb_map<std::string, int>::from({
+      {"one", 1},
+      {"two", 2},
+      {"three", 3}
+    });
+
+  assert(m4.find("one")->second == 1);
+  assert(m4.find("two")->second == 2);
+  assert(m4.find("three")->second == 3);
+
+  auto vals = { "two", "three" };
+  m4 = m4.erase(begin(vals), end(vals));
+
+  assert(m4.find("one")->second == 1);
+  assert(!m4.find("two"));
+  assert(!m4.find("three"));
+
+  m4 = m4.insert("one", 111);
+
+  assert(m4.find("one")->second == 111);
+
+  m4 = m4.erase("unknown");
+
+  assert(m4.find("one")->second == 111);
+
+  typedef pst::map::rb_map<std::string, std::string, std::less<std::string>, std::allocator<std::string>,
+                           pst::atomic_refcount, pst::shared_payload> shared_map;
+
+  auto m5 = shared_map::from({ { "a", "alpha" }, { "b", "beta" }, { "c", "gamma" } });
+  auto m6 = m5.insert("d", std::string("delta")).erase("a");
+
+  assert(m5.find("c") == m6.find("c")); // same payload in both versions
+  assert(m5.find("a") && !m6.find("a"));
+  assert(m6.find("d")->second == "delta");
+
+  std::pair<std::string, int> const sorted[] = { { "a", 1 }, { "b", 2 }, { "c", 3 }, { "d", 4 } };
+  auto m7 = pst::map::rb_map<std::string, int>::from_sorted(std::begin(sorted), std::end(sorted));
+
+  assert(m7.find("a")->second == 1);
+  assert(m7.find("d")->second == 4);
+  assert(!m7.find("e"));
+
+  pst::map::rb_map<int, std::string>::sorted_loader loader;
+  for (int i = 0; i < 100; ++i)
+    loader.push_back(2 * i, std::to_string(i));
+
+  auto m8 = loader.finish();
+  assert(m8.find(0)->second == "0");
+  assert(m8.find(198)->second == "99");
+  assert(!m8.find(99));
+
+  auto stock = pst::map::rb_map<std::string, int>::from({ { "apples", 3 }, { "pears", 2 } });
+  auto delivery = pst::map::rb_map<std::string, int>::from({ { "pears", 5 }, { "plums", 7 } });
+  auto merged = stock.merge_with(delivery, [](int mine, int theirs) { return mine + theirs; });
+
+  assert(merged.find("apples")->second == 3);
+  assert(merged.find("pears")->second == 7);
+  assert(merged.find("plums")->second == 7);
+  assert(stock.find("pears")->second == 2);
+
+  // expire a window of timestamps
+  auto events = pst::map::rb_map<int, std::string>::from({ { 100, "start" }, { 105, "ping" }, { 110, "ping" }, { 120, "stop" } });
+  auto expired = events.extract_range(100, 111);
+
+  assert(!expired.first.find(105) && expired.first.find(120));
+  assert(expired.second.find(100) && expired.second.find(110) && !expired.second.find(120));
+  assert(events.erase_range(0, 1000).empty());
+
+  // the median latency
+  typedef pst::map::rb_map<int, std::string, std::less<int>, std::allocator<std::string>,
+                           pst::atomic_refcount, pst::inline_payload, pst::size_augment> sized_map;
+  auto latencies = sized_map::from({ { 12, "a" }, { 7, "b" }, { 31, "c" }, { 9, "d" }, { 15, "e" } });
+
+  assert(latencies.size() == 5);
+  assert(latencies.select(latencies.size() / 2)->first == 12);
+  assert(latencies.rank(15) == 3 && latencies.count_range(8, 20) == 3);
+
+  // windowed sums and maxima of a series
+  typedef pst::map::rb_map<int, int, std::less<int>, std::allocator<int>, pst::atomic_refcount, pst::inline_payload,
+                           pst::monoid_augment<pst::max_monoid<int>, pst::mapped_value>> peak_map;
+  typedef pst::map::rb_map<int, int, std::less<int>, std::allocator<int>, pst::atomic_refcount, pst::inline_payload,
+                           pst::monoid_augment<pst::sum_monoid<int>, pst::mapped_value>> total_map;
+  auto peaks = peak_map::from({ { 0, 4 }, { 10, 9 }, { 20, 1 }, { 30, 7 } });
+  auto totals = total_map::from({ { 0, 4 }, { 10, 9 }, { 20, 1 }, { 30, 7 } });
+
+  assert(peaks.aggregate(0, 40) == 9 && peaks.aggregate(15, 40) == 7);
+  assert(peaks.aggregate(40, 50) == std::numeric_limits<int>::lowest());
+  assert(totals.aggregate(5, 31) == 17 && totals.erase(10).aggregate(0, 100) == 12);
+
+  // the fold keeps key order
+  struct concat
+  {
+    typedef std::string value_type;
+    static std::string identity() { return std::string(); }
+    static std::string combine(std::string const& a, std::string const& b) { return a + b; }
+  };
+  typedef pst::map::rb_map<int, std::string, std::less<int>, std::allocator<std::string>, pst::atomic_refcount, pst::inline_payload,
+                           pst::monoid_augment<concat, pst::mapped_value>> text_map;
+  auto words = text_map::from({ { 3, "c" }, { 1, "a" }, { 4, "d" }, { 2, "b" }, { 5, "e" } });
+
+  assert(words.aggregate(2, 5) == "bcd");
+
+  // entries compare and hash by key and value
+  typedef pst::map::rb_map<std::string, int, std::less<std::string>, std::allocator<int>, pst::atomic_refcount, pst::inline_payload,
+                           pst::hash_augment<>> hashed_map;
+  auto const prices = hashed_map::from({ { "apples", 3 }, { "pears", 2 } });
+
+  assert(prices == hashed_map::from({ { "pears", 2 }, { "apples", 3 } }));
+  assert(prices != prices.insert("pears", 4));
+  assert(std::hash<hashed_map>()(prices) == std::hash<hashed_map>()(prices.erase("pears").insert("pears", 2)));
+  assert(m4 == m4.erase("none") && m4 != m4.insert("four", 5));
+
+  // a change feed between two versions
+  auto const v1 = pst::map::rb_map<std::string, int>::from({ { "a", 1 }, { "b", 2 }, { "c", 3 }, { "d", 4 } });
+  auto const v2 = v1.erase("b").insert("c", 30).insert("e", 5);
+  std::string feed;
+  v1.for_each_difference(v2, [&feed](std::pair<std::string, int> const* before, std::pair<std::string, int> const* after) {
+    feed += before && after ? "~" + after->first : before ? "-" + before->first : "+" + after->first;
+  });
+
+  assert(feed == "-b~c+e");
+
+  // lookups by the key alone: a transparent comparator takes a literal
+  // without making a std::string, and the mapped type need not be default
+  // constructible
+  struct account
+  {
+    explicit account(int balance) : balance(balance) {}
+    int balance;
+  };
+  typedef pst::map::rb_map<std::string, account, std::less<>, std::allocator<account>, pst::atomic_refcount, pst::inline_payload,
+                           pst::size_augment> account_map;
+  auto const accounts = account_map::empty_map().insert("alice", account(10)).insert("bob", account(20)).insert("carol", account(30));
+
+  assert(accounts.find("bob")->second.balance == 20 && !accounts.find("dave"));
+  assert(accounts.find(std::string("carol"))->second.balance == 30);
+  assert(accounts.erase("bob").size() == 2 && !accounts.erase("bob").find("bob"));
+  assert(accounts.rank("bob") == 1 && accounts.count_range("b", "c") == 1 && accounts.count_range("c", "b") == 0);
+  assert(accounts.erase_range("a", "c").size() == 1);
+
+  // built on several threads, the last of repeated keys kept
+  std::vector<std::pair<std::string, account>> deposits;
+  for (int i = 0; i < 5000; ++i)
+    deposits.push_back(std::make_pair("a" + std::to_string(i % 3000), account(i)));
+  auto const ledger = account_map::from_parallel(deposits, 4);
+  assert(ledger.size() == 3000);
+  assert(ledger.find("a7")->second.balance == 3007 && ledger.find("a2999")->second.balance == 2999);
+
+  account_map::transient edits(accounts);
+  edits.erase("alice");
+  edits.erase("zed");
+  assert(!edits.find("alice") && edits.find("carol")->second.balance == 30);
+  assert(edits.persistent().size() == 2);
+
+  std::vector<std::string> const leavers = { "carol", "alice", "zed" };
+  assert(accounts.erase(leavers.begin(), leavers.end()).size() == 1);
+  assert(accounts.erase(leavers.begin(), leavers.end()).find("bob")->second.balance == 20);
+
+  // batch updates on a pool, small grain so that the splits fork
+  pst::parallel::work_stealing_pool pool(2);
+  std::vector<std::pair<int, int>> squares;
+  std::vector<int> odd_keys;
+  for (int i = 0; i < 1000; ++i)
+  {
+    squares.push_back(std::make_pair(i, i * i));
+    if (i % 2)
+      odd_keys.push_back(i);
+  }
+  std::reverse(squares.begin(), squares.end());
+  odd_keys.push_back(5000);
+
+  auto const table = pst::map::rb_map<int, int>::empty_map().insert_parallel(squares, pool, 4);
+  auto const evens = table.erase_parallel(odd_keys, pool, 4);
+  assert(table.size() == 1000 && table.find(999)->second == 998001);
+  assert(evens.size() == 500 && !evens.find(7) && evens.find(8)->second == 64);
+  assert(evens == table.erase(odd_keys.begin(), odd_keys.end()));
+
+  // the latest price at or before a time
+  auto const ticks = pst::map::rb_map<int, double>::from({ { 100, 1.5 }, { 160, 1.75 }, { 220, 1.25 } });
+
+  assert(ticks.floor(159)->second == 1.5 && ticks.floor(160)->second == 1.75 && ticks.floor(99) == ticks.end());
+  assert(ticks.ceiling(161)->first == 220 && ticks.upper_bound(220) == ticks.end());
+  assert(accounts.lower_bound("b")->first == "bob" && accounts.equal_range("carol").first->second.balance == 30);
+
+  // keys that are pairs themselves, (day, slot)
+  typedef std::pair<int, int> slot;
+  typedef pst::map::rb_map<slot, int, std::less<slot>, std::allocator<int>, pst::atomic_refcount, pst::inline_payload,
+                           pst::size_augment> slot_map;
+  typedef pst::map::rb_map<slot, int, std::less<slot>, std::allocator<int>, pst::atomic_refcount, pst::inline_payload,
+                           pst::monoid_augment<pst::sum_monoid<int>, pst::mapped_value>> slot_total_map;
+  auto const slots = slot_map::from({ { { 1, 9 }, 2 }, { { 1, 14 }, 3 }, { { 2, 9 }, 5 }, { { 3, 11 }, 7 } });
+  auto const slot_totals = slot_total_map::from({ { { 1, 9 }, 2 }, { { 1, 14 }, 3 }, { { 2, 9 }, 5 }, { { 3, 11 }, 7 } });
+
+  assert(slots.find(slot(2, 9))->second == 5 && !slots.find(slot(2, 10)));
+  assert(slots.lower_bound(slot(1, 10))->second == 3 && slots.upper_bound(slot(2, 9))->second == 7);
+  assert(slots.floor(slot(2, 0))->second == 3 && slots.ceiling(slot(2, 0))->second == 5);
+  assert(slots.equal_range(slot(1, 14)).first->second == 3);
+  assert(slots.rank(slot(2, 9)) == 2 && slots.count_range(slot(1, 10), slot(3, 0)) == 2);
+  assert(slot_totals.aggregate(slot(1, 10), slot(9, 0)) == 15);
+  assert(slots.erase(slot(1, 9)).size() == 3);
+
+  // range-for sees the entries in place, nothing is copied
+  std::string names;
+  for (auto const& kv : accounts)
+  {
+    assert(&kv == accounts.find(kv.first));
+    names += kv.first[0];
+  }
+  assert(names == "abc");
+  for (auto it = accounts.rbegin(); it != accounts.rend(); ++it)
+    names += it->first[0];
+  assert(names == "abccba");
+
+  int total = 0;
+  accounts.for_each([&total](std::pair<std::string, account> const& kv) { total += kv.second.balance; });
+  assert(total == 60);
+
+  // a burst of nearby lookups
+  auto const readings = pst::map::rb_map<int, int>::from({ { 1, 10 }, { 2, 20 }, { 4, 40 }, { 8, 80 } });
+  pst::map::rb_map<int, int>::finger near(readings);
+  int seen = 0;
+  for (int t = 0; t <= 9; ++t)
+    seen += near.find(t) ? near.find(t)->second : 0;
+  assert(seen == 150);
+
+  account_map::finger by_name(accounts);
+  assert(by_name.find("carol")->second.balance == 30 && by_name.find("bob")->second.balance == 20 && !by_name.find("ann"));
+
+  // a burst of edits to one stretch of time
+  pst::map::rb_map<int, int>::zipper edit(readings, 4);
+  edit.insert(3, 30);
+  edit.insert(4, 44);
+  edit.erase(2);
+  assert(edit.find(3)->second == 30 && edit.find(8)->second == 80 && !edit.find(2));
+
+  auto const revised = edit.close();
+  assert(revised.find(4)->second == 44 && !revised.find(2) && revised.find(1)->second == 10);
+  assert(readings.find(4)->second == 40 && readings.find(2));
+}
+
+void time_sorted_load()
+{
+  char const* path = "pst_sorted_load.txt";
+  int const n = 5000000;
+
+  {
+    std::ofstream out(path);
+    for (int i = 0; i < n; ++i)
+      out << i << ' ' << 3 * i << '\n';
+  }
+
+  timed("rb_map<int, int> sorted_loader, 5M lines from a file", [&] {
+    std::ifstream in(path);
+    pst::map::rb_map<int, int>::sorted_loader loader;
+    int k, v;
+    while (in >> k >> v)
+      loader.push_back(k, v);
+    auto m = loader.finish();
+    assert(m.find(n - 1)->second == 3 * (n - 1));
+  });
+
+  timed("rb_map<int, int> insert, 5M lines from a file", [&] {
+    std::ifstream in(path);
+    auto m = pst::map::rb_map<int, int>::empty_map();
+    int k, v;
+    while (in >> k >> v)
+      m = m.insert(k, v);
+    assert(m.find(n - 1)->second == 3 * (n - 1));
+  });
+
+  std::remove(path);
+}
@@ -1,8 +1,9 @@
-#pragma once
-
-#ifndef PST_TEST_MAPS_H__
-#define PST_TEST_MAPS_H__
-
-void test_rb_map();
-
-#endif // PST_TEST_MAPS_H__
+#pragma once
+
+#ifndef PST_TEST_MAPS_H__
+#define PST_TEST_MAPS_H__
+
+void test_rb_map();
+void time_sorted_load();
+
+#endif // PST_TEST_MAPS_H__
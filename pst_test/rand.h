@@ -1,9 +1,9 @@
-#pragma once
-
-#ifndef PST_TEST_RAND_H__
-#define PST_TEST_RAND_H__
-
-void init_rand();
-int rand_int();
-
-#endif // PST_TEST_RAND_H__
+#pragma once
+
+#ifndef PST_TEST_RAND_H__
+#define PST_TEST_RAND_H__
+
+void init_rand();
+int rand_int();
+
+#endif // PST_TEST_RAND_H__
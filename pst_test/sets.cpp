@@ -1,32 +1,105 @@
-#include "sets.h"
-#include <pst/set.h>
-#include <cassert>
-
-void test_rb_set()
-{
-  auto s = pst::set::rb_set<int>::from({1, 3, 5, 7, 9 });
-
-  assert(!s.empty());
-
-  assert(s.member(5));
-  assert(!s.member(4));
-  assert(s.member(3));
-
-  auto vals = { 2, 4, 8 };
-  s = s.insert(begin(vals), end(vals));
-  s = s.insert(6);
-
-  assert(s.member(4));
-  assert(s.member(6));
-
-  s = s.erase(6);
-
-  assert(!s.member(6));
-
-  auto vals2 = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
-
-  s = s.erase(begin(vals2), end(vals2));
-
-  assert(!s.member(2));
-  assert(s.empty());
-}
+#include "sets.h"
+#include <pst/set.h>
+#include <cassert>
+#include <unordered_map>
+
+void test_rb_set()
+{
+  auto s = pst::set::rb_set<int>::from({1, 3, 5, 7, 9 });
+
+  assert(!s.empty());
+
+  assert(s.member(5));
+  assert(!s.member(4));
+  assert(s.member(3));
+
+  auto vals = { 2, 4, 8 };
+  s = s.insert(begin(vals), end(vals));
+  s = s.insert(6);
+
+  assert(s.member(4));
+  assert(s.member(6));
+
+  s = s.erase(6);
+
+  assert(!s.member(6));
+
+  auto vals2 = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+
+  s = s.erase(begin(vals2), end(vals2));
+
+  assert(!s.member(2));
+  assert(s.empty());
+
+  auto local = pst::set::rb_set<int, std::less<int>, std::allocator<int>, pst::local_refcount>::from({ 1, 2, 3 });
+  local = local.erase(2);
+
+  assert(local.member(1));
+  assert(!local.member(2));
+
+  decltype(local)::transient tr(local);
+  tr.insert(10);
+  tr.erase(1);
+  auto edited = tr.persistent();
+
+  assert(edited.member(10) && !edited.member(1));
+  assert(local.member(1) && !local.member(10));
+
+  auto odd = pst::set::rb_set<int>::from({ 1, 3, 5, 7, 9 });
+  auto low = pst::set::rb_set<int>::from({ 1, 2, 3, 4, 5 });
+
+  auto all = odd.union_with(low);
+  auto both = odd.intersection_with(low);
+  auto high_odd = odd.difference_with(low);
+
+  for (int i = 1; i <= 9; ++i)
+  {
+    assert(all.member(i) == (i % 2 == 1 || i <= 5));
+    assert(both.member(i) == (i % 2 == 1 && i <= 5));
+    assert(high_odd.member(i) == (i % 2 == 1 && i > 5));
+  }
+
+  pst::parallel::work_stealing_pool pool(2);
+  auto more = odd.insert_parallel({ 11, 2, 13, 2 }, pool, 1);
+  auto fewer = more.erase_parallel({ 1, 13, 100 }, pool, 1);
+
+  assert(more.member(2) && more.member(11) && more.member(13) && more.member(1));
+  assert(fewer.member(2) && fewer.member(11) && !fewer.member(13) && !fewer.member(1));
+  assert(odd.union_with(low, pool, 1).member(4));
+
+  typedef pst::set::rb_set<int, std::less<int>, std::allocator<int>, pst::atomic_refcount, pst::inline_payload, pst::size_augment> sized_set;
+  auto sized = sized_set::from({ 10, 20, 30, 40, 50 });
+
+  assert(sized.size() == 5);
+  assert(sized.rank(30) == 2 && sized.rank(35) == 3);
+  assert(*sized.select(4) == 50 && !sized.select(5));
+  assert(sized.count_range(15, 45) == 3);
+
+  // sets as keys of a cache, hashed by content in O(1)
+  typedef pst::set::rb_set<int, std::less<int>, std::allocator<int>, pst::atomic_refcount, pst::inline_payload, pst::hash_augment<>> hashed_set;
+  std::unordered_map<hashed_set, int> cache;
+  cache[hashed_set::from({ 1, 2, 3 })] = 6;
+  cache[hashed_set::from({ 4, 5 })] = 9;
+
+  assert(cache.count(hashed_set::from({ 3, 1, 2 })) == 1 && cache[hashed_set::from({ 2, 3, 1 })] == 6);
+  assert(cache.count(hashed_set::from({ 1, 2 })) == 0);
+  assert(hashed_set::from({ 1, 2 }).insert(3) == hashed_set::from({ 3, 2, 1 }));
+  assert(hashed_set::from({ 1, 2, 3 }).erase(2) != hashed_set::from({ 1, 2, 3 }));
+  assert(pst::set::rb_set<int>::from({ 1, 2 }) == pst::set::rb_set<int>::from({ 2, 1 }));
+
+  // nearest elements, and a scan from the middle
+  assert(*odd.floor(6) == 5 && *odd.ceiling(6) == 7 && *odd.upper_bound(7) == 9);
+  assert(odd.floor(0) == odd.end() && odd.ceiling(10) == odd.end());
+  assert(odd.equal_range(4).first == odd.equal_range(4).second);
+
+  int scanned = 0;
+  for (auto it = odd.lower_bound(4); it != odd.upper_bound(8); ++it)
+    scanned += *it;
+  assert(scanned == 5 + 7);
+
+  pst::set::rb_set<int>::finger f(odd);
+  int members = 0;
+  for (int i = 0; i < 12; ++i)
+    members += f.member(i) ? 1 : 0;
+  assert(members == 5 && f.member(3) && !f.member(4));
+}
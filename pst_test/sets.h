@@ -1,8 +1,8 @@
-#pragma once
-
-#ifndef PST_TEST_SETS_H__
-#define PST_TEST_SETS_H__
-
-void test_rb_set();
-
-#endif // PST_TEST_SETS_H__
+#pragma once
+
+#ifndef PST_TEST_SETS_H__
+#define PST_TEST_SETS_H__
+
+void test_rb_set();
+
+#endif // PST_TEST_SETS_H__
@@ -0,0 +1,19 @@
+#pragma once
+
+#ifndef PST_TEST_TIMER_H__
+#define PST_TEST_TIMER_H__
+
+#include <chrono>
+#include <iostream>
+
+// Runs f once and reports its wall time.
+template <typename F>
+void timed(char const* what, F f)
+{
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << what << ": " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms" << std::endl;
+}
+
+#endif // PST_TEST_TIMER_H__
@@ -1,235 +1,1502 @@
-#include "trees.h"
-#include "rand.h"
-#include "tracer.h"
-#include <pst/tree.h>
-#include <pst/tree_iterator.h>
-#include <pst/tree_io.h>
-#include <pst/tree_sane.h>
-#include <set>
-#include <map>
-//#include <boost/pool/pool_alloc.hpp>
-#include <allocators>
-#include <cmath>
-#include <vector>
-#include <numeric>
-#include <algorithm>
-#include <iostream>
-
-namespace
-{
-  template <typename IntTree>
-  void tree_rand_test()
-  {
-    auto t = IntTree::empty_tree();
-    std::set<int> ints;
-
-    for (int i = 0; i < 1000; ++i)
-    {
-      int r = rand_int();
-
-      auto prev = t;
-
-      ints.insert(r);
-      t = t.insert(r);
-
-      assert(ints.size() == t.size());
-      assert(check(t));
-    }
-
-    for (auto i = begin(ints); i != end(ints); ++i)
-    {
-      auto tv = t.find(*i); tv;
-      assert(tv);
-      assert(*tv == *i);
-    }
-  }
-
-  template <typename IntTree>
-  void tree_eq_insert_test()
-  {
-    auto t = IntTree::empty_tree();
-    t = t.insert(1);
-    t = t.insert(1);
-
-    t.find(1);
-  }
-
-  template <typename IntTree>
-  void tree_simple_erase_test()
-  {
-    auto t = IntTree::empty_tree();
-
-    t = t.insert(3);
-    t = t.erase(3);
-
-    assert(t.empty());
-
-    t = t.insert(3);
-    t = t.insert(5);
-
-    t = t.erase(3);
-
-    assert(!t.find(3));
-    assert(t.find(5));
-  }
-
-  template <typename IntTree>
-  void tree_rand_erase_test()
-  {
-    auto t = IntTree::empty_tree();
-
-    std::set<int> ints;
-
-    for (int i = 0; i < 1000; ++i)
-    {
-      int r = rand_int();
-      ints.insert(r);
-      t = t.insert(r);
-    }
-
-    for (int i = 0; i < 2000; ++i)
-    {
-      auto prev = t;
-      int r = rand_int();
-      ints.erase(r);
-      t = t.erase(r);
-
-      assert(ints.size() == t.size());
-      assert(check(t));
-    }
-  }
-
-  template <typename IntTree>
-  void tree_insert_perf_test(int n)
-  {
-    auto t = IntTree::empty_tree();
-
-    for (int i = 0; i < n; ++i)
-    {
-      auto r = rand_int();
-      typename IntTree::key_value_type v = r;
-      t = t.insert(std::move(v));
-    }
-  }
-
-  template <typename IntTree>
-  void tree_insert_erase_perf_test(int n)
-  {
-    auto t = IntTree::empty_tree();
-
-    for (int i = 0; i < n; ++i)
-    {
-      t = t.insert(rand_int());
-    }
-
-    for (int i = 0; i < n; ++i)
-    {
-      t = t.erase(rand_int());
-    }
-  }
-
-  template <class T, class A = std::allocator<T> > struct mk_rb_tree_type {
-    typedef pst::tree::rb_tree<T, std::less<T>, A> type;  
-  };
-
-  template <class T, class A = std::allocator<T> > struct mk_bs_tree_type {
-    typedef pst::tree::bs_tree<T, std::less<T>, A> type;  
-  };
-
-  void test_rb_tree_depth()
-  {
-    auto t = pst::tree::rb_tree<int>::empty_tree();
-
-    for (int i = 0; i < 2000; ++i)
-    {
-      t = t.insert(rand_int());
-      auto d = t.depth();
-      auto bd = t.bdepth();
-      assert(d < 2 * bd);
-      auto e = 1 + 2 * std::log2(t.size());
-      assert(d <= e);
-    }
-  }
-
-  template <typename IntTree>
-  void iterate_tree()
-  {
-    using namespace pst::tree;
-
-    auto t = IntTree::empty_tree();
-    std::vector<int> nums;
-    nums.resize(1000);
-    std::iota(begin(nums), end(nums), 0);
-    std::random_shuffle(begin(nums), end(nums));
-
-    for (auto i : nums)
-      t = t.insert(i);
-
-    std::sort(begin(nums), end(nums));
-
-    tree_iterator<IntTree> tbegin(t), tend;
-
-    auto mr = std::mismatch(begin(nums), end(nums),
-                            tbegin);
-
-    assert(mr.first == end(nums));    
-  }
-}
-
-void test_bs_tree()
-{
-  using namespace pst::tree;
-  tree_rand_test<bs_tree<int>>();
-  tree_eq_insert_test<bs_tree<int>>();
-  tree_rand_erase_test<rb_tree<int>>();
-  iterate_bs_tree();
-}
-
-void test_rb_tree()
-{
-  using namespace pst::tree;
-
-  tree_rand_test<rb_tree<int>>();
-  tree_eq_insert_test<bs_tree<int>>();
-  tree_rand_erase_test<rb_tree<int>>();
-  test_rb_tree_depth();
-  iterate_rb_tree();
-}
-
-void trace_rb_tree()
-{
-  using namespace pst::tree;
-
-  tree_rand_erase_test<rb_tree<tracer<int>>>();
-  tree_simple_erase_test<rb_tree<tracer<int>>>();
-  tree_rand_test<rb_tree<tracer<int>>>();
-
-  tracer<int>::report(std::cout);
-}
-
-void time_bs_tree()
-{
-  tree_insert_perf_test<mk_bs_tree_type<tracer<int>, std::allocator<int> >::type>(1000000);
-}
-
-void time_rb_tree()
-{
-  tree_insert_perf_test<mk_rb_tree_type<tracer<int>, std::allocator<int> >::type>(1000000);
-  //tree_insert_perf_test<mk_rb_tree_type<int, boost::fast_pool_allocator<int> >::type>(1000000);
-
-  tree_insert_erase_perf_test<mk_rb_tree_type<int, std::allocator<int> >::type>(1000000);
-  //tree_insert_erase_perf_test<mk_rb_tree_type<int, boost::fast_pool_allocator<int> >::type>(10000000);
-}
-
-void iterate_bs_tree()
-{
-  using namespace pst::tree;
-  iterate_tree<bs_tree<int> >();
-}
-
-void iterate_rb_tree()
-{
-  using namespace pst::tree;
-  iterate_tree<rb_tree<int> >();  
-}
-
+#include "trees.h"
+#include "rand.h"
+#include "tracer.h"
+#include "timer.h"
+#include <pst/tree.h>
+#include <pst/tree_iterator.h>
+#include <pst/tree_io.h>
+#include <pst/tree_sane.h>
+#include <pst/pool_allocator.h>
+#include <pst/slab_allocator.h>
+#include <pst/set.h>
+#include <set>
+#include <map>
+#include <allocators>
+#include <cmath>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+  template <typename IntTree>
+  void tree_rand_test()
+  {
+    auto t = IntTree::empty_tree();
+    std::set<int> ints;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+      int r = rand_int();
+
+      auto prev = t;
+
+      ints.insert(r);
+      t = t.insert(r);
+
+      assert(ints.size() == t.size());
+      assert(check(t));
+    }
+
+    for (auto i = begin(ints); i != end(ints); ++i)
+    {
+      auto tv = t.find(*i); tv;
+      assert(tv);
+      assert(*tv == *i);
+    }
+  }
+
+  template <typename IntTree>
+  void tree_eq_insert_test()
+  {
+    auto t = IntTree::empty_tree();
+    t = t.insert(1);
+    t = t.insert(1);
+
+    t.find(1);
+  }
+
+  template <typename IntTree>
+  void tree_simple_erase_test()
+  {
+    auto t = IntTree::empty_tree();
+
+    t = t.insert(3);
+    t = t.erase(3);
+
+    assert(t.empty());
+
+    t = t.insert(3);
+    t = t.insert(5);
+
+    t = t.erase(3);
+
+    assert(!t.find(3));
+    assert(t.find(5));
+  }
+
+  template <typename IntTree>
+  void tree_rand_erase_test()
+  {
+    auto t = IntTree::empty_tree();
+
+    std::set<int> ints;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+      int r = rand_int();
+      ints.insert(r);
+      t = t.insert(r);
+    }
+
+    for (int i = 0; i < 2000; ++i)
+    {
+      auto prev = t;
+      int r = rand_int();
+      ints.erase(r);
+      t = t.erase(r);
+
+      assert(ints.size() == t.size());
+      assert(check(t));
+    }
+  }
+
+  template <typename IntTree>
+  void tree_persistence_test()
+  {
+    auto t = IntTree::empty_tree();
+    std::vector<IntTree> versions;
+    std::vector<std::set<int> > contents;
+    std::set<int> ints;
+
+    for (int i = 0; i < 500; ++i)
+    {
+      int r = rand_int() % 1000;
+
+      if (i % 3 == 2) {
+        ints.erase(r);
+        t = t.erase(r);
+      }
+      else {
+        ints.insert(r);
+        t = t.insert(r);
+      }
+
+      versions.push_back(t);
+      contents.push_back(ints);
+    }
+
+    // drop every other version, the others must be unaffected
+    for (std::size_t i = 0; i < versions.size(); i += 2)
+      versions[i] = IntTree::empty_tree();
+
+    for (std::size_t i = 1; i < versions.size(); i += 2)
+    {
+      assert(versions[i].size() == contents[i].size());
+      assert(check(versions[i]));
+
+      for (auto j = begin(contents[i]); j != end(contents[i]); ++j)
+        assert(versions[i].find(*j));
+    }
+  }
+
+  // the source of an assignment can live in a node the assignment frees
+  template <typename IntTree>
+  void tree_assignment_test()
+  {
+    auto t = IntTree::empty_tree();
+    for (int i = 0; i < 100; ++i)
+      t = t.insert(i);
+
+    auto& self = t;
+    t = self;
+    assert(t.size() == 100);
+    assert(check(t));
+
+    auto const left_size = t.left().size();
+    t = t.left();
+    assert(t.size() == left_size);
+    assert(check(t));
+  }
+
+  template <typename IntTree>
+  void tree_transient_test()
+  {
+    typename IntTree::transient tr;
+    std::set<int> ints;
+    std::vector<IntTree> versions;
+    std::vector<std::set<int> > contents;
+
+    for (int i = 0; i < 5000; ++i)
+    {
+      int r = rand_int() % 2000;
+
+      if (i % 3 == 2) {
+        ints.erase(r);
+        tr.erase(r);
+      }
+      else {
+        ints.insert(r);
+        tr.insert(r);
+      }
+
+      if (i % 250 == 0) {
+        versions.push_back(tr.persistent());
+        contents.push_back(ints);
+        assert(check(versions.back()));
+      }
+    }
+
+    auto t = tr.persistent();
+    assert(check(t));
+    assert(t.size() == ints.size());
+
+    for (auto i = begin(ints); i != end(ints); ++i)
+      assert(t.find(*i));
+
+    // the snapshots did not see the later edits
+    for (std::size_t i = 0; i < versions.size(); ++i)
+    {
+      assert(versions[i].size() == contents[i].size());
+      assert(check(versions[i]));
+
+      for (auto j = begin(contents[i]); j != end(contents[i]); ++j)
+        assert(versions[i].find(*j));
+    }
+
+    // erasing everything through a transient leaves the source alone
+    typename IntTree::transient drain(t);
+    for (auto i = begin(ints); i != end(ints); ++i)
+      drain.erase(*i);
+    assert(drain.empty() && check(drain.persistent()));
+    assert(t.size() == ints.size());
+  }
+
+  template <typename IntTree>
+  void tree_transient_perf_test(int n)
+  {
+    typename IntTree::transient t;
+
+    for (int i = 0; i < n; ++i)
+    {
+      t.insert(rand_int());
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+      t.erase(rand_int());
+    }
+  }
+
+  template <typename IntTree>
+  void tree_from_sorted_test()
+  {
+    for (int n = 0; n < 300; ++n)
+    {
+      std::vector<int> ints(n);
+      std::iota(begin(ints), end(ints), 0);
+
+      auto t = IntTree::from_sorted(begin(ints), end(ints));
+      assert(check(t));
+      assert(t.size() == ints.size());
+
+      for (auto i = begin(ints); i != end(ints); ++i)
+        assert(t.find(*i));
+
+      // still a valid starting point for updates
+      t = t.insert(n).erase(0);
+      assert(check(t));
+    }
+  }
+
+  template <typename IntTree>
+  void tree_sorted_stream_test()
+  {
+    for (int n = 0; n < 300; ++n)
+    {
+      std::stringstream in;
+      for (int i = 0; i < n; ++i)
+        in << i << ' ';
+
+      // an input iterator, read once without knowing n
+      auto t = IntTree::from_sorted(std::istream_iterator<int>(in), std::istream_iterator<int>());
+      assert(check(t));
+      assert(t.size() == static_cast<std::size_t>(n));
+
+      for (int i = 0; i < n; ++i)
+        assert(t.find(i));
+
+      t = t.insert(n).erase(0);
+      assert(check(t));
+    }
+  }
+
+  template <typename IntTree>
+  void tree_join_test()
+  {
+    for (int l = 0; l < 70; ++l)
+    {
+      for (int r = 0; r < 70; r += 3)
+      {
+        std::vector<int> left(l), right(r);
+        std::iota(begin(left), end(left), 0);
+        std::iota(begin(right), end(right), l + 1);
+
+        auto t = IntTree::join(IntTree::from_sorted(begin(left), end(left)), l, IntTree::from_sorted(begin(right), end(right)));
+        assert(check(t));
+        assert(t.size() == static_cast<std::size_t>(l + r + 1));
+
+        for (int i = 0; i <= l + r; ++i)
+          assert(t.find(i));
+      }
+    }
+  }
+
+  template <typename IntTree>
+  void tree_split_test()
+  {
+    std::vector<int> ints;
+    for (int i = 0; i < 200; ++i)
+      ints.push_back(2 * i);
+
+    auto t = IntTree::from_sorted(begin(ints), end(ints));
+
+    for (int k = -1; k <= 400; ++k)
+    {
+      auto s = t.split(k);
+      assert(check(s.left) && check(s.right));
+      assert(s.found.empty() == (k % 2 != 0 || k < 0 || k >= 400));
+      assert(s.found.empty() || s.found.keyval() == k);
+      assert(s.left.size() == static_cast<std::size_t>(k < 0 ? 0 : (std::min(k, 400) + 1) / 2));
+      assert(s.left.size() + s.right.size() + (s.found.empty() ? 0 : 1) == t.size());
+      assert(s.left.empty() || *s.left.find_max() < k);
+      assert(s.right.empty() || *s.right.find_min() > k);
+
+      auto back = s.found.empty() ? IntTree::join(s.left, s.right) : IntTree::join(s.left, k, s.right);
+      assert(check(back));
+      assert(back.size() == t.size());
+    }
+  }
+
+  template <typename IntTree>
+  void tree_set_algebra_test()
+  {
+    for (int m : { 0, 1, 10, 100, 1000 })
+    {
+      for (int n : { 0, 1, 7, 1000, 5000 })
+      {
+        std::set<int> a, b;
+        for (int i = 0; i < m; ++i)
+          a.insert(rand_int() % 3000);
+        for (int i = 0; i < n; ++i)
+          b.insert(rand_int() % 3000);
+
+        auto ta = IntTree::from_sorted(begin(a), end(a));
+        auto tb = IntTree::from_sorted(begin(b), end(b));
+
+        std::vector<int> expected;
+        std::set_union(begin(a), end(a), begin(b), end(b), std::back_inserter(expected));
+        auto u = IntTree::set_union(ta, tb);
+        assert(check(u) && u.size() == expected.size());
+        for (int i : expected)
+          assert(u.find(i));
+
+        expected.clear();
+        std::set_intersection(begin(a), end(a), begin(b), end(b), std::back_inserter(expected));
+        auto x = IntTree::set_intersection(ta, tb);
+        assert(check(x) && x.size() == expected.size());
+        for (int i : expected)
+          assert(x.find(i));
+
+        expected.clear();
+        std::set_difference(begin(a), end(a), begin(b), end(b), std::back_inserter(expected));
+        auto d = IntTree::set_difference(ta, tb);
+        assert(check(d) && d.size() == expected.size());
+        for (int i : expected)
+          assert(d.find(i));
+      }
+    }
+
+    // nothing to do, nothing copied
+    std::vector<int> ints(100);
+    std::iota(begin(ints), end(ints), 0);
+    auto t = IntTree::from_sorted(begin(ints), end(ints));
+    assert(&IntTree::set_union(t, IntTree::empty_tree()).keyval() == &t.keyval());
+    assert(&IntTree::set_difference(t, IntTree::empty_tree()).keyval() == &t.keyval());
+  }
+
+  template <typename IntTree>
+  void tree_parallel_set_algebra_test()
+  {
+    for (unsigned threads : { 1u, 3u })
+    {
+      pst::parallel::work_stealing_pool pool(threads);
+
+      for (int n : { 0, 100, 20000 })
+      {
+        std::vector<int> a, b;
+        for (int i = 0; i < n; ++i)
+        {
+          a.push_back(rand_int() % (2 * n + 1));
+          b.push_back(rand_int() % (2 * n + 1));
+        }
+
+        auto ta = IntTree::from_unsorted_parallel(a, threads);
+        auto tb = IntTree::from_unsorted_parallel(b, threads);
+
+        for (std::size_t grain : { std::size_t(1), pst::parallel::default_grain })
+        {
+          auto u = IntTree::set_union_parallel(ta, tb, pool, grain);
+          auto x = IntTree::set_intersection_parallel(ta, tb, pool, grain);
+          auto d = IntTree::set_difference_parallel(ta, tb, pool, grain);
+
+          assert(check(u) && check(x) && check(d));
+          assert(u.size() == IntTree::set_union(ta, tb).size());
+          assert(x.size() == IntTree::set_intersection(ta, tb).size());
+          assert(d.size() == IntTree::set_difference(ta, tb).size());
+
+          for (int i : a)
+            assert(u.find(i) && !!x.find(i) == !!tb.find(i) && !!d.find(i) == !tb.find(i));
+        }
+      }
+
+      // an exception from either side reaches the caller once both are done
+      bool caught = false;
+      try
+      {
+        pool.fork_join([] {}, [] { throw std::runtime_error("forked"); });
+      }
+      catch (std::runtime_error const&)
+      {
+        caught = true;
+      }
+      assert(caught);
+    }
+  }
+
+  template <typename IntTree>
+  void tree_batch_test()
+  {
+    auto t = IntTree::empty_tree();
+    std::set<int> expected;
+
+    for (int round = 0; round < 50; ++round)
+    {
+      std::vector<int> ins, del;
+      for (int i = rand_int() % 300; i > 0; --i)
+        ins.push_back(rand_int() % 2000);
+      for (int i = rand_int() % 300; i > 0; --i)
+        del.push_back(rand_int() % 2000);
+
+      t = t.insert_batch(ins);
+      expected.insert(begin(ins), end(ins));
+      assert(check(t) && t.size() == expected.size());
+
+      t = t.erase_batch(del);
+      for (int i : del)
+        expected.erase(i);
+      assert(check(t) && t.size() == expected.size());
+
+      for (int i : expected)
+        assert(t.find(i));
+    }
+  }
+
+  template <typename IntTree>
+  void tree_range_test()
+  {
+    std::vector<int> ints;
+    for (int i = 0; i < 100; ++i)
+      ints.push_back(2 * i);
+    auto const t = IntTree::from_sorted(begin(ints), end(ints));
+
+    for (int lo = -1; lo <= 200; lo += 3)
+    {
+      for (int hi = lo; hi <= 201; hi += 7)
+      {
+        auto parts = t.extract_range(lo, hi);
+        assert(check(parts.first) && check(parts.second));
+
+        std::size_t inside = 0;
+        for (int i : ints)
+        {
+          bool const in_range = lo <= i && i < hi;
+          inside += in_range ? 1 : 0;
+          assert(!!parts.first.find(i) != in_range);
+          assert(!!parts.second.find(i) == in_range);
+        }
+        assert(parts.second.size() == inside);
+        assert(parts.first.size() == t.size() - inside);
+        assert(t.erase_range(lo, hi).size() == parts.first.size());
+      }
+    }
+  }
+
+  template <typename IntTree>
+  void tree_bounds_test()
+  {
+    auto t = IntTree::empty_tree();
+    std::set<int> expected;
+    for (int i = 0; i < 300; ++i)
+    {
+      int const v = 3 * (i * 7 % 300);
+      t = t.insert(v);
+      expected.insert(v);
+    }
+
+    for (int k = -2; k <= 900; ++k)
+    {
+      auto const lower = expected.lower_bound(k);
+      auto const upper = expected.upper_bound(k);
+
+      auto const lb = t.lower_bound(k);
+      assert(lower == end(expected) ? lb == t.end() : *lb == *lower);
+      assert(t.ceiling(k) == lb);
+
+      auto const ub = t.upper_bound(k);
+      assert(upper == end(expected) ? ub == t.end() : *ub == *upper);
+
+      auto const fl = t.floor(k);
+      assert(upper == begin(expected) ? fl == t.end() : *fl == *std::prev(upper));
+
+      auto const range = t.equal_range(k);
+      assert(range.first == lb && range.second == ub);
+
+      // a scan goes on from where the lookup left off
+      if (lower != end(expected))
+      {
+        auto it = lb;
+        for (int i = 0; i < 5 && it != t.end(); ++i, ++it)
+          assert(*it == *std::next(lower, i));
+      }
+    }
+
+    assert(IntTree::empty_tree().lower_bound(0) == IntTree::empty_tree().end());
+    assert(IntTree::empty_tree().floor(0) == IntTree::empty_tree().end());
+  }
+
+  // Ascending inserts make a bs_tree a list. Iterators and fingers walk
+  // it up to max_depth values deep and throw past that.
+  void bs_tree_depth_test()
+  {
+    typedef pst::tree::bs_tree<int> list_tree;
+    int const max_depth = static_cast<int>(list_tree::iterator::max_depth);
+
+    auto t = list_tree::empty_tree();
+    for (int i = 0; i < max_depth; ++i)
+      t = t.insert(i);
+    assert(check(t));
+    assert(std::distance(t.begin(), t.end()) == max_depth);
+    assert(*t.lower_bound(max_depth - 1) == max_depth - 1);
+    assert(*std::prev(t.end()) == max_depth - 1);
+
+    for (int i = max_depth; i < 300; ++i)
+      t = t.insert(i);
+    assert(check(t));
+
+    auto const too_deep = [](std::function<void()> const& walk) {
+      try
+      {
+        walk();
+      }
+      catch (std::length_error const&)
+      {
+        return true;
+      }
+      return false;
+    };
+    assert(too_deep([&t] { std::distance(t.begin(), t.end()); }));
+    assert(too_deep([&t] { t.lower_bound(299); }));
+    assert(too_deep([&t] { std::prev(t.end()); }));
+
+    // the first values are still in reach of the iterator and the finger
+    auto const first = t.lower_bound(0);
+    assert(*first == 0 && *std::next(first, 10) == 10);
+
+    list_tree::finger f(t);
+    assert(*f.find(max_depth - 1) == max_depth - 1);
+    assert(too_deep([&f, max_depth] { f.find(max_depth); }));
+    assert(too_deep([&f] { f.find(299); }));
+    assert(*f.find(5) == 5);
+  }
+
+  // A tree after 2000 random inserts and erases of keys in [0, 5000),
+  // which are mirrored in expected; each(t) checks every step.
+  template <typename IntTree, typename F>
+  IntTree random_edits(std::set<int>& expected, F each)
+  {
+    auto t = IntTree::empty_tree();
+    for (int i = 0; i < 2000; ++i)
+    {
+      int const r = rand_int() % 5000;
+      if (rand_int() % 3 == 0)
+      {
+        t = t.erase(r);
+        expected.erase(r);
+      }
+      else
+      {
+        t = t.insert(r);
+        expected.insert(r);
+      }
+      each(t);
+    }
+    return t;
+  }
+
+  // calls f(lo, hi) for ranges across the keys of random_edits, empty,
+  // reversed and past either end included
+  template <typename F>
+  void for_each_range(F f)
+  {
+    for (int lo = -10; lo < 5010; lo += 97)
+      for (int hi = lo - 50; hi < 5010; hi += 301)
+        f(lo, hi);
+  }
+
+  template <typename IntTree>
+  void tree_order_statistics_test()
+  {
+    std::set<int> expected;
+    auto const t = random_edits<IntTree>(expected, [&expected](IntTree const& u) {
+      assert(u.size() == expected.size());
+    });
+    assert(check(t));
+
+    std::vector<int> const sorted(begin(expected), end(expected));
+    for (std::size_t i = 0; i < sorted.size(); ++i)
+    {
+      assert(*t.select(i) == sorted[i]);
+      assert(t.rank(sorted[i]) == i);
+    }
+    assert(!t.select(sorted.size()));
+
+    for_each_range([&t, &sorted](int lo, int hi) {
+      std::size_t inside = 0;
+      for (int i : sorted)
+        inside += lo <= i && i < hi ? 1 : 0;
+      assert(t.count_range(lo, hi) == inside);
+    });
+
+    // the 99th percentile
+    auto const p99 = t.select(t.size() * 99 / 100);
+    assert(p99 && *p99 == sorted[sorted.size() * 99 / 100]);
+  }
+
+  // IntTree folds the keys with sum_monoid
+  template <typename IntTree>
+  void tree_aggregate_test()
+  {
+    std::set<int> expected;
+    auto const t = random_edits<IntTree>(expected, [&expected](IntTree const& u) {
+      assert(u.summary() == std::accumulate(begin(expected), end(expected), 0ll));
+    });
+    assert(check(t));
+
+    for_each_range([&t, &expected](int lo, int hi) {
+      long long sum = 0;
+      for (auto i = expected.lower_bound(lo); i != end(expected) && *i < hi; ++i)
+        sum += *i;
+      assert(t.aggregate(lo, hi) == sum);
+    });
+  }
+
+  // equal contents built in different orders, and so shapes, compare
+  // equal; with a content hash they also hash alike
+  template <typename IntTree>
+  void tree_equal_content_test()
+  {
+    std::vector<int> ints;
+    for (int i = 0; i < 500; ++i)
+      ints.push_back(rand_int() % 2000);
+
+    auto a = IntTree::empty_tree();
+    for (int i : ints)
+      a = a.insert(i);
+
+    std::random_shuffle(begin(ints), end(ints));
+    auto b = IntTree::empty_tree();
+    for (int i : ints)
+      b = b.insert(i);
+    std::sort(begin(ints), end(ints));
+    auto const c = IntTree::from_sorted(begin(ints), std::unique(begin(ints), end(ints)));
+
+    assert(check(a) && check(b));
+    assert(IntTree::equal_content(a, b) && IntTree::equal_content(b, c));
+    assert(IntTree::equal_content(IntTree::empty_tree(), IntTree::empty_tree()));
+
+    for (int i = 0; i < 50; ++i)
+    {
+      int const r = ints[static_cast<std::size_t>(rand_int()) % ints.size()];
+      auto const fewer = a.erase(r);
+      auto const more = a.insert(2000 + i);
+      assert(!IntTree::equal_content(a, fewer) && !IntTree::equal_content(fewer, a));
+      assert(!IntTree::equal_content(a, more));
+      assert(IntTree::equal_content(more.erase(2000 + i), b));
+      assert(IntTree::equal_content(fewer.insert(r), c));
+    }
+  }
+
+  template <typename IntTree>
+  void tree_diff_test()
+  {
+    std::vector<int> ints;
+    for (int i = 0; i < 2000; ++i)
+      ints.push_back(3 * i);
+    auto const base = IntTree::from_sorted(begin(ints), end(ints));
+
+    for (int edits : { 0, 1, 5, 50, 500, 5000 })
+    {
+      auto t = base;
+      std::set<int> expected(begin(ints), end(ints));
+      for (int i = 0; i < edits; ++i)
+      {
+        int const r = rand_int() % 6500;
+        if (rand_int() % 2)
+        {
+          t = t.insert(r);
+          expected.insert(r);
+        }
+        else
+        {
+          t = t.erase(r);
+          expected.erase(r);
+        }
+      }
+
+      std::vector<int> removed, added;
+      std::set_difference(begin(ints), end(ints), begin(expected), end(expected), std::back_inserter(removed));
+      std::set_difference(begin(expected), end(expected), begin(ints), end(ints), std::back_inserter(added));
+
+      std::vector<int> seen_removed, seen_added;
+      IntTree::for_each_difference(base, t, [&](int const* before, int const* after) {
+        assert(!before != !after);
+        if (before)
+          seen_removed.push_back(*before);
+        else
+          seen_added.push_back(*after);
+      });
+      assert(seen_removed == removed && seen_added == added);
+
+      std::size_t backwards = 0;
+      IntTree::for_each_difference(t, base, [&](int const*, int const*) { ++backwards; });
+      assert(backwards == removed.size() + added.size());
+    }
+
+    IntTree::for_each_difference(IntTree::empty_tree(), base, [](int const* before, int const* after) {
+      assert(!before && after);
+    });
+  }
+
+  // every value hashes alike, so trees of the same size collide
+  struct colliding_hash
+  {
+    std::size_t operator()(int) const { return 7; }
+  };
+
+  // a hash collision must not pass for equal content
+  void tree_hash_collision_test()
+  {
+    typedef pst::tree::rb_tree<int, std::less<int>, std::allocator<int>, pst::atomic_refcount, pst::inline_payload, pst::hash_augment<colliding_hash>> colliding_tree;
+    std::vector<int> const ones = { 1, 2, 3 }, others = { 1, 2, 4 };
+    auto const a = colliding_tree::from_sorted(begin(ones), end(ones));
+    auto const b = colliding_tree::from_sorted(begin(others), end(others));
+
+    assert(a.summary() == b.summary());
+    assert(!colliding_tree::equal_content(a, b));
+    assert(colliding_tree::equal_content(a, b.erase(4).insert(3)));
+    assert(!colliding_tree::equal_content(a, a.erase(2)));
+  }
+
+  template <typename IntTree>
+  void tree_parallel_build_test()
+  {
+    for (int n : { 0, 1, 5000, 100000 })
+    {
+      std::vector<int> ints;
+      for (int i = 0; i < n; ++i)
+        ints.push_back(rand_int() % (n + 1));
+
+      for (unsigned threads : { 1u, 2u, 3u, 8u })
+      {
+        auto t = IntTree::from_unsorted_parallel(ints, threads);
+        std::set<int> expected(begin(ints), end(ints));
+
+        assert(check(t));
+        assert(t.size() == expected.size());
+
+        for (auto i = begin(expected); i != end(expected); ++i)
+          assert(t.find(*i));
+      }
+    }
+  }
+
+  // the values of t in order
+  template <typename Tree>
+  void flatten(Tree const& t, std::vector<typename Tree::key_value_type>& out)
+  {
+    if (!t.empty())
+    {
+      flatten(t.left(), out);
+      out.push_back(t.keyval());
+      flatten(t.right(), out);
+    }
+  }
+
+  // the n keys 0, step, 2 * step, ... built in linear time
+  template <typename Tree>
+  Tree sorted_tree(std::size_t n, int step)
+  {
+    std::vector<int> keys(n);
+    for (std::size_t i = 0; i < n; ++i)
+      keys[i] = static_cast<int>(i) * step;
+    return Tree::from_sorted(begin(keys), end(keys));
+  }
+
+  template <typename IntTree>
+  void tree_insert_perf_test(int n)
+  {
+    auto t = IntTree::empty_tree();
+
+    for (int i = 0; i < n; ++i)
+    {
+      auto r = rand_int();
+      typename IntTree::key_value_type v = r;
+      t = t.insert(std::move(v));
+    }
+  }
+
+  template <typename IntTree>
+  void tree_insert_erase_perf_test(int n)
+  {
+    auto t = IntTree::empty_tree();
+
+    for (int i = 0; i < n; ++i)
+    {
+      t = t.insert(rand_int());
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+      t = t.erase(rand_int());
+    }
+  }
+
+  template <class T, class A = std::allocator<T>, class R = pst::atomic_refcount, class S = pst::inline_payload> struct mk_rb_tree_type {
+    typedef pst::tree::rb_tree<T, std::less<T>, A, R, S> type;  
+  };
+
+  template <class T, class A = std::allocator<T>, class R = pst::atomic_refcount> struct mk_bs_tree_type {
+    typedef pst::tree::bs_tree<T, std::less<T>, A, R> type;  
+  };
+
+  // copies of keys made while inserting n distinct keys and erasing them again
+  template <typename Storage>
+  int payload_copies(int n)
+  {
+    auto t = mk_rb_tree_type<tracer<int>, std::allocator<int>, pst::atomic_refcount, Storage>::type::empty_tree();
+
+    tracer<int>::reset();
+
+    for (int i = 0; i < n; ++i)
+      t = t.insert(tracer<int>((i * 7919) % n));
+
+    int copies = tracer<int>::lref_constr;
+
+    for (int i = 0; i < n; ++i)
+      t = t.erase(tracer<int>(i));
+
+    assert(t.empty());
+    return copies;
+  }
+
+  // a comparator for tracers that compares three ways
+  struct traced_three_way
+  {
+    bool operator()(tracer<int> const& lhs, tracer<int> const& rhs) const { return lhs < rhs; }
+    int compare(tracer<int> const& lhs, tracer<int> const& rhs) const { return three_way(lhs, rhs); }
+  };
+
+  // comparator calls made inserting keys into a Tree, looking them up and
+  // erasing them again
+  template <typename Tree>
+  int comparisons(std::vector<int> const& keys)
+  {
+    auto t = Tree::empty_tree();
+
+    tracer<int>::reset();
+
+    for (int k : keys)
+      t = t.insert(tracer<int>(k));
+
+    for (int k : keys)
+      assert(t.find(tracer<int>(k)));
+
+    typename Tree::transient tr(t);
+    for (int k : keys)
+      tr.erase(tracer<int>(k));
+
+    assert(tr.empty());
+    return tracer<int>::lt + tracer<int>::cmp;
+  }
+
+  void comparisons_test()
+  {
+    std::vector<int> keys;
+    for (int i = 0; i < 2000; ++i)
+      keys.push_back(rand_int());
+
+    int const two_way = comparisons<pst::tree::rb_tree<tracer<int>>>(keys);
+    int const three_way = comparisons<pst::tree::rb_tree<tracer<int>, traced_three_way>>(keys);
+
+    // up to two calls per level become one
+    assert(4 * three_way < 3 * two_way);
+  }
+
+  // a finger finds what find does, wherever the last search left it
+  template <typename IntTree>
+  void tree_finger_test()
+  {
+    auto t = IntTree::empty_tree();
+    for (int i = 0; i < 3000; ++i)
+      t = t.insert(rand_int() % 10000);
+
+    typename IntTree::finger f(t);
+    int k = 0;
+    for (int i = 0; i < 20000; ++i)
+    {
+      k = i % 100 == 0 ? rand_int() % 10100 - 50 : k + rand_int() % 21 - 10;
+      assert(f.find(k) == t.find(k));
+    }
+
+    auto const empty = IntTree::empty_tree();
+    typename IntTree::finger none(empty);
+    assert(!none.find(0));
+  }
+
+  // edits through a zipper, mostly close together, match a std::set and
+  // leave a sane tree
+  template <typename IntTree>
+  void tree_zipper_test()
+  {
+    std::vector<int> evens;
+    for (int i = 0; i < 2000; ++i)
+      evens.push_back(2 * i);
+    auto const t = IntTree::from_sorted(begin(evens), end(evens));
+
+    // nothing edited, nothing rebuilt
+    {
+      typename IntTree::zipper z(t, 1001);
+      assert(z.find(1000) && !z.find(1001) && z.find(3998));
+      assert(z.close() == t);
+    }
+
+    for (int round = 0; round < 20; ++round)
+    {
+      std::set<int> expected(begin(evens), end(evens));
+      int k = rand_int() % 4000;
+      typename IntTree::zipper z(t, k);
+
+      for (int i = 0; i < 200; ++i)
+      {
+        k = i % 50 == 49 ? rand_int() % 4100 - 50 : k + rand_int() % 11 - 5;
+        if (rand_int() % 3 == 0)
+        {
+          z.erase(k);
+          expected.erase(k);
+        }
+        else
+        {
+          z.insert(k);
+          expected.insert(k);
+        }
+        int const probe = rand_int() % 4100 - 50;
+        assert(!!z.find(probe) == (expected.count(probe) == 1));
+      }
+
+      auto const edited = z.close();
+      assert(check(edited) && check(t));
+      assert(edited.size() == expected.size() && std::equal(edited.begin(), edited.end(), begin(expected)));
+      assert(t.size() == evens.size());
+
+      // the zipper goes on from the closed tree
+      z.insert(-1000);
+      assert(check(z.close()) && z.close().find(-1000) && !edited.find(-1000));
+    }
+
+    auto const empty = IntTree::empty_tree();
+    typename IntTree::zipper z(empty, 5);
+    z.insert(5);
+    z.insert(4);
+    z.erase(5);
+    assert(z.close().size() == 1 && *z.close().find_min() == 4);
+  }
+
+  // comparator calls looking up every key of a tree, and the key after
+  // it, in ascending order
+  template <typename Find>
+  int scan_comparisons(Find find)
+  {
+    tracer<int>::reset();
+    for (int k = 0; k < 8000; ++k)
+      assert(!!find(tracer<int>(k)) == (k % 2 == 0));
+    return tracer<int>::lt + tracer<int>::cmp;
+  }
+
+  void finger_comparisons_test()
+  {
+    typedef pst::tree::rb_tree<tracer<int>, traced_three_way> tree_type;
+    auto t = tree_type::empty_tree();
+    for (int k = 0; k < 8000; k += 2)
+      t = t.insert(tracer<int>(k));
+
+    tree_type::finger f(t);
+    int const from_root = scan_comparisons([&t](tracer<int> const& k) { return t.find(k); });
+    int const from_finger = scan_comparisons([&f](tracer<int> const& k) { return f.find(k); });
+
+    // a few per key rather than one per level
+    assert(3 * from_finger < from_root);
+  }
+
+  void payload_sharing_test()
+  {
+    // path copying shares the key/value of untouched nodes
+    assert(payload_copies<pst::shared_payload>(1000) == 0);
+    assert(payload_copies<pst::inline_payload>(1000) > 1000);
+  }
+
+  void test_rb_tree_depth()
+  {
+    auto t = pst::tree::rb_tree<int>::empty_tree();
+
+    for (int i = 0; i < 2000; ++i)
+    {
+      t = t.insert(rand_int());
+      auto d = t.depth();
+      auto bd = t.bdepth();
+      assert(d < 2 * bd);
+      auto e = 1 + 2 * std::log2(t.size());
+      assert(d <= e);
+    }
+  }
+
+  template <typename IntTree>
+  void iterate_tree()
+  {
+    using namespace pst::tree;
+
+    auto t = IntTree::empty_tree();
+    std::vector<int> nums;
+    nums.resize(1000);
+    std::iota(begin(nums), end(nums), 0);
+    std::random_shuffle(begin(nums), end(nums));
+
+    for (auto i : nums)
+      t = t.insert(i);
+
+    std::sort(begin(nums), end(nums));
+
+    tree_iterator<IntTree> tbegin(t), tend;
+
+    auto mr = std::mismatch(begin(nums), end(nums),
+                            tbegin);
+
+    assert(mr.first == end(nums));    
+    assert(std::equal(t.begin(), t.end(), begin(nums)));
+    assert(std::equal(t.rbegin(), t.rend(), nums.rbegin()));
+    assert(std::distance(t.begin(), t.end()) == static_cast<std::ptrdiff_t>(nums.size()));
+
+    // values by reference, both ways from anywhere
+    auto it = t.end();
+    for (int i = static_cast<int>(nums.size()) - 1; i >= 0; --i)
+    {
+      --it;
+      assert(*it == i && &*it == t.find(i));
+    }
+    assert(it == t.begin());
+    auto mid = t.lower_bound(500);
+    auto const before = std::prev(mid);
+    auto const after = std::next(mid);
+    assert(*before == 499 && *after == 501 && std::next(before) == mid && std::prev(after) == mid);
+
+    int next = 0;
+    for (int const& v : t)
+      assert(v == next++);
+
+    next = 0;
+    t.for_each([&next](int v) { assert(v == next++); });
+    assert(next == static_cast<int>(nums.size()));
+
+    auto const empty = IntTree::empty_tree();
+    assert(empty.begin() == empty.end() && empty.rbegin() == empty.rend());
+    empty.for_each([](int) { assert(false); });
+  }
+}
+
+void test_bs_tree()
+{
+  using namespace pst::tree;
+  tree_rand_test<bs_tree<int>>();
+  tree_eq_insert_test<bs_tree<int>>();
+  tree_rand_erase_test<rb_tree<int>>();
+  tree_persistence_test<bs_tree<int>>();
+  tree_assignment_test<bs_tree<int>>();
+  tree_bounds_test<bs_tree<int>>();
+  bs_tree_depth_test();
+  tree_finger_test<bs_tree<int>>();
+  iterate_bs_tree();
+}
+
+void test_rb_tree()
+{
+  using namespace pst::tree;
+
+  // a tree is a single (tagged) pointer to its root node
+  static_assert(sizeof(rb_tree<int>) == sizeof(void*), "rb_tree handle should be one word");
+  // ... or a 32-bit slab index
+  static_assert(sizeof(rb_tree<int, std::less<int>, pst::slab_allocator<int>>) == 4, "slab rb_tree handle should be 32 bits");
+
+  tree_rand_test<rb_tree<int>>();
+  tree_eq_insert_test<bs_tree<int>>();
+  tree_rand_erase_test<rb_tree<int>>();
+  tree_persistence_test<rb_tree<int>>();
+  tree_assignment_test<rb_tree<int>>();
+  tree_rand_erase_test<rb_tree<int, std::less<int>, std::allocator<int>, pst::local_refcount>>();
+  tree_persistence_test<rb_tree<int, std::less<int>, std::allocator<int>, pst::local_refcount>>();
+  tree_rand_erase_test<rb_tree<int, std::less<int>, pst::slab_allocator<int>>>();
+  tree_persistence_test<rb_tree<int, std::less<int>, pst::slab_allocator<int>>>();
+  tree_rand_erase_test<rb_tree<int, std::less<int>, std::allocator<int>, pst::atomic_refcount, pst::shared_payload>>();
+  tree_persistence_test<rb_tree<int, std::less<int>, std::allocator<int>, pst::atomic_refcount, pst::shared_payload>>();
+  payload_sharing_test();
+  comparisons_test();
+  finger_comparisons_test();
+  tree_from_sorted_test<rb_tree<int>>();
+  tree_sorted_stream_test<rb_tree<int>>();
+  tree_join_test<rb_tree<int>>();
+  tree_split_test<rb_tree<int>>();
+  tree_set_algebra_test<rb_tree<int>>();
+  tree_batch_test<rb_tree<int>>();
+  tree_range_test<rb_tree<int>>();
+  tree_bounds_test<rb_tree<int>>();
+  tree_finger_test<rb_tree<int>>();
+  tree_zipper_test<rb_tree<int>>();
+  tree_diff_test<rb_tree<int>>();
+  tree_parallel_set_algebra_test<rb_tree<int>>();
+  tree_parallel_build_test<rb_tree<int>>();
+  tree_parallel_build_test<rb_tree<int, std::less<int>, pst::slab_allocator<int>>>();
+
+  // the size augmentation is kept up by every kind of update
+  typedef rb_tree<int, std::less<int>, std::allocator<int>, pst::atomic_refcount, pst::inline_payload, pst::size_augment> sized_tree;
+  tree_order_statistics_test<sized_tree>();
+  tree_rand_erase_test<sized_tree>();
+  tree_persistence_test<sized_tree>();
+  tree_from_sorted_test<sized_tree>();
+  tree_sorted_stream_test<sized_tree>();
+  tree_join_test<sized_tree>();
+  tree_split_test<sized_tree>();
+  tree_set_algebra_test<sized_tree>();
+  tree_batch_test<sized_tree>();
+  tree_range_test<sized_tree>();
+  tree_parallel_set_algebra_test<sized_tree>();
+  tree_parallel_build_test<sized_tree>();
+  tree_transient_test<sized_tree>();
+  tree_zipper_test<sized_tree>();
+
+  // as is any other monoid, folded over key ranges
+  typedef rb_tree<int, std::less<int>, std::allocator<int>, pst::atomic_refcount, pst::inline_payload, pst::monoid_augment<pst::sum_monoid<long long>>> summed_tree;
+  tree_aggregate_test<summed_tree>();
+  tree_rand_erase_test<summed_tree>();
+  tree_join_test<summed_tree>();
+  tree_split_test<summed_tree>();
+  tree_set_algebra_test<summed_tree>();
+  tree_batch_test<summed_tree>();
+  tree_range_test<summed_tree>();
+  tree_transient_test<summed_tree>();
+  tree_zipper_test<summed_tree>();
+
+  // content hashes tell most versions apart in O(1)
+  typedef rb_tree<int, std::less<int>, std::allocator<int>, pst::atomic_refcount, pst::inline_payload, pst::hash_augment<>> hashed_tree;
+  tree_equal_content_test<hashed_tree>();
+  tree_equal_content_test<rb_tree<int>>();
+  tree_hash_collision_test();
+  tree_rand_erase_test<hashed_tree>();
+  tree_join_test<hashed_tree>();
+  tree_set_algebra_test<hashed_tree>();
+  tree_batch_test<hashed_tree>();
+  tree_transient_test<hashed_tree>();
+  tree_zipper_test<hashed_tree>();
+
+  tree_transient_test<rb_tree<int>>();
+  tree_transient_test<rb_tree<int, std::less<int>, std::allocator<int>, pst::local_refcount, pst::shared_payload>>();
+  tree_transient_test<rb_tree<int, std::less<int>, pst::slab_allocator<int>>>();
+  test_rb_tree_depth();
+  iterate_rb_tree();
+}
+
+void trace_rb_tree()
+{
+  using namespace pst::tree;
+
+  tree_rand_erase_test<rb_tree<tracer<int>>>();
+  tree_simple_erase_test<rb_tree<tracer<int>>>();
+  tree_rand_test<rb_tree<tracer<int>>>();
+
+  tracer<int>::report(std::cout);
+
+  tracer<int>::reset();
+  tree_rand_erase_test<mk_rb_tree_type<tracer<int>, std::allocator<int>, pst::atomic_refcount, pst::shared_payload>::type>();
+  tree_simple_erase_test<mk_rb_tree_type<tracer<int>, std::allocator<int>, pst::atomic_refcount, pst::shared_payload>::type>();
+  tree_rand_test<mk_rb_tree_type<tracer<int>, std::allocator<int>, pst::atomic_refcount, pst::shared_payload>::type>();
+
+  std::cout << "shared_payload:" << std::endl;
+  tracer<int>::report(std::cout);
+}
+
+void time_bs_tree()
+{
+  tree_insert_perf_test<mk_bs_tree_type<tracer<int>, std::allocator<int> >::type>(1000000);
+}
+
+void time_rb_tree()
+{
+  init_rand();
+  timed("rb_tree<tracer<int>> insert, std::allocator", [] {
+    tree_insert_perf_test<mk_rb_tree_type<tracer<int>, std::allocator<int> >::type>(1000000);
+  });
+  init_rand();
+  timed("rb_tree<tracer<int>> insert, pool_allocator", [] {
+    tree_insert_perf_test<mk_rb_tree_type<tracer<int>, pst::pool_allocator<int> >::type>(1000000);
+  });
+  init_rand();
+  timed("rb_tree<tracer<int>> insert, pool_allocator, shared_payload", [] {
+    tree_insert_perf_test<mk_rb_tree_type<tracer<int>, pst::pool_allocator<int>, pst::atomic_refcount, pst::shared_payload>::type>(1000000);
+  });
+
+  init_rand();
+  timed("rb_tree<int> insert/erase, std::allocator, atomic_refcount", [] {
+    tree_insert_erase_perf_test<mk_rb_tree_type<int, std::allocator<int>, pst::atomic_refcount>::type>(1000000);
+  });
+  init_rand();
+  timed("rb_tree<int> insert/erase, std::allocator, local_refcount", [] {
+    tree_insert_erase_perf_test<mk_rb_tree_type<int, std::allocator<int>, pst::local_refcount>::type>(1000000);
+  });
+  init_rand();
+  timed("rb_tree<int> insert/erase, pool_allocator, atomic_refcount", [] {
+    tree_insert_erase_perf_test<mk_rb_tree_type<int, pst::pool_allocator<int> >::type>(1000000);
+  });
+  init_rand();
+  timed("rb_tree<int> insert/erase, pool_allocator, local_refcount", [] {
+    tree_insert_erase_perf_test<mk_rb_tree_type<int, pst::pool_allocator<int>, pst::local_refcount>::type>(1000000);
+  });
+  init_rand();
+  timed("rb_tree<int> insert/erase, pool_allocator, transient", [] {
+    tree_transient_perf_test<mk_rb_tree_type<int, pst::pool_allocator<int> >::type>(1000000);
+  });
+  init_rand();
+  timed("rb_tree<int> insert/erase, slab_allocator, atomic_refcount", [] {
+    tree_insert_erase_perf_test<mk_rb_tree_type<int, pst::slab_allocator<int> >::type>(1000000);
+  });
+  init_rand();
+  timed("rb_tree<int> insert/erase, slab_allocator, local_refcount", [] {
+    tree_insert_erase_perf_test<mk_rb_tree_type<int, pst::slab_allocator<int>, pst::local_refcount>::type>(1000000);
+  });
+}
+
+void time_set_algebra()
+{
+  using namespace pst::tree;
+  typedef rb_tree<int, std::less<int>, pst::pool_allocator<int> > tree_type;
+
+  auto const t = sorted_tree<tree_type>(1000000, 1);
+
+  for (std::size_t m : { 1000, 100000 })
+  {
+    std::set<int> few;
+    init_rand();
+    while (few.size() < m)
+      few.insert(rand_int() % 2000000);
+    auto const small = tree_type::from_sorted(begin(few), end(few));
+    int const reps = static_cast<int>(100000 / m);
+
+    std::string what = "rb_tree<int> 1M union " + std::to_string(m) + ", x" + std::to_string(reps);
+    timed((what + ", insert one at a time").c_str(), [&] {
+      for (int i = 0; i < reps; ++i)
+      {
+        auto u = t;
+        for (int k : few)
+          u = u.insert(k);
+      }
+    });
+    timed((what + ", set_union").c_str(), [&] {
+      for (int i = 0; i < reps; ++i)
+        tree_type::set_union(t, small);
+    });
+
+    what = "rb_tree<int> 1M difference " + std::to_string(m) + ", x" + std::to_string(reps);
+    timed((what + ", erase one at a time").c_str(), [&] {
+      for (int i = 0; i < reps; ++i)
+      {
+        auto d = t;
+        for (int k : few)
+          d = d.erase(k);
+      }
+    });
+    timed((what + ", set_difference").c_str(), [&] {
+      for (int i = 0; i < reps; ++i)
+        tree_type::set_difference(t, small);
+    });
+  }
+}
+
+void time_parallel_set_algebra()
+{
+  typedef pst::set::rb_set<int, std::less<int>, pst::pool_allocator<int> > set_type;
+
+  std::vector<int> a, b;
+  init_rand();
+  for (int i = 0; i < 4000000; ++i)
+  {
+    a.push_back(rand_int());
+    b.push_back(rand_int());
+  }
+
+  auto const sa = set_type::from_parallel(a);
+  auto const sb = set_type::from_parallel(b);
+
+  for (unsigned threads = 1; threads <= 2 * pst::parallel::default_threads(); threads *= 2)
+  {
+    pst::parallel::work_stealing_pool pool(threads);
+    std::string const suffix = ", 4M and 4M, " + std::to_string(threads) + " thread(s)";
+
+    timed(("rb_set<int> union_with" + suffix).c_str(), [&] { sa.union_with(sb, pool); });
+    timed(("rb_set<int> intersection_with" + suffix).c_str(), [&] { sa.intersection_with(sb, pool); });
+    timed(("rb_set<int> difference_with" + suffix).c_str(), [&] { sa.difference_with(sb, pool); });
+    timed(("rb_set<int> insert_parallel" + suffix).c_str(), [&] { sa.insert_parallel(b, pool); });
+  }
+}
+
+void time_batch_update()
+{
+  typedef pst::tree::rb_tree<int, std::less<int>, pst::pool_allocator<int> > tree_type;
+
+  auto const t = sorted_tree<tree_type>(1000000, 2);
+
+  for (int k : { 1000, 100000 })
+  {
+    // odd keys, so all new, in one region of the tree
+    std::vector<int> batch;
+    for (int i = 0; i < k; ++i)
+      batch.push_back(500001 + 2 * i);
+    int const reps = 100000 / k;
+
+    std::string const what = "rb_tree<int> 1M insert " + std::to_string(k) + " sorted keys, x" + std::to_string(reps);
+    timed((what + ", one by one").c_str(), [&] {
+      for (int r = 0; r < reps; ++r)
+      {
+        auto u = t;
+        for (int i : batch)
+          u = u.insert(i);
+      }
+    });
+    timed((what + ", transient").c_str(), [&] {
+      for (int r = 0; r < reps; ++r)
+      {
+        tree_type::transient tr(t);
+        for (int i : batch)
+          tr.insert(i);
+      }
+    });
+    timed((what + ", zipper").c_str(), [&] {
+      for (int r = 0; r < reps; ++r)
+      {
+        tree_type::zipper z(t, batch.front());
+        for (int i : batch)
+          z.insert(i);
+        z.close();
+      }
+    });
+    timed((what + ", insert_batch").c_str(), [&] {
+      for (int r = 0; r < reps; ++r)
+        t.insert_batch(batch);
+    });
+  }
+}
+
+void time_diff()
+{
+  typedef pst::tree::rb_tree<int, std::less<int>, pst::pool_allocator<int> > tree_type;
+
+  auto const t = sorted_tree<tree_type>(1000000, 2);
+
+  for (int edits : { 1, 100, 10000 })
+  {
+    auto u = t;
+    for (int i = 0; i < edits; ++i)
+      u = u.insert(2 * (rand_int() % 1000000) + 1);
+
+    std::size_t changes = 0;
+    std::string const what = "rb_tree<int> 1M diff after " + std::to_string(edits) + " inserts";
+    timed((what + ", for_each_difference x100").c_str(), [&] {
+      for (int r = 0; r < 100; ++r)
+        tree_type::for_each_difference(t, u, [&](int const*, int const*) { ++changes; });
+    });
+    timed((what + ", both walked x100").c_str(), [&] {
+      for (int r = 0; r < 100; ++r)
+      {
+        std::vector<int> before, after, added;
+        flatten(t, before);
+        flatten(u, after);
+        std::set_difference(begin(after), end(after), begin(before), end(before), std::back_inserter(added));
+        changes += added.size();
+      }
+    });
+  }
+}
+
+void time_iteration()
+{
+  typedef pst::tree::rb_tree<std::pair<std::string, int>, pst::detail::pair_first_less<std::less<std::string>>, pst::pool_allocator<int>> tree_type;
+
+  std::vector<std::pair<std::string, int>> entries;
+  for (int i = 0; i < 1000000; ++i)
+    entries.push_back(std::make_pair("key " + std::to_string(1000000 + i), i));
+  auto const t = tree_type::from_sorted(begin(entries), end(entries));
+
+  long long sum = 0;
+  timed("rb_tree<pair<string, int>> 1M scan x10, copied out", [&] {
+    for (int r = 0; r < 10; ++r)
+    {
+      std::vector<std::pair<std::string, int>> all;
+      flatten(t, all);
+      for (auto const& kv : all)
+        sum += kv.second;
+    }
+  });
+  timed("rb_tree<pair<string, int>> 1M scan x10, iterator", [&] {
+    for (int r = 0; r < 10; ++r)
+      for (auto const& kv : t)
+        sum += kv.second;
+  });
+  timed("rb_tree<pair<string, int>> 1M scan x10, for_each", [&] {
+    for (int r = 0; r < 10; ++r)
+      t.for_each([&sum](std::pair<std::string, int> const& kv) { sum += kv.second; });
+  });
+  assert(sum == 3 * 10 * 1000000LL * 999999 / 2);
+}
+
+void time_finger()
+{
+  typedef pst::tree::rb_tree<int, std::less<int>, pst::pool_allocator<int> > tree_type;
+
+  auto const t = sorted_tree<tree_type>(1000000, 2);
+
+  // bursts of 64 lookups a few keys apart, from random places
+  std::vector<int> bursts;
+  for (int b = 0; b < 100000; ++b)
+  {
+    int k = rand_int() % 2000000;
+    for (int i = 0; i < 64; ++i)
+      bursts.push_back(k += rand_int() % 8);
+  }
+
+  std::size_t found = 0;
+  timed("rb_tree<int> 1M ascending lookups x10, find", [&] {
+    for (int r = 0; r < 10; ++r)
+      for (int k = 0; k < 2000000; k += 2)
+        found += t.find(k) ? 1 : 0;
+  });
+  timed("rb_tree<int> 1M ascending lookups x10, finger", [&] {
+    for (int r = 0; r < 10; ++r)
+    {
+      tree_type::finger f(t);
+      for (int k = 0; k < 2000000; k += 2)
+        found += f.find(k) ? 1 : 0;
+    }
+  });
+  timed("rb_tree<int> 6.4M lookups in bursts, find", [&] {
+    for (int k : bursts)
+      found += t.find(k) ? 1 : 0;
+  });
+  timed("rb_tree<int> 6.4M lookups in bursts, finger", [&] {
+    tree_type::finger f(t);
+    for (int k : bursts)
+      found += f.find(k) ? 1 : 0;
+  });
+  assert(found > 0);
+}
+
+void time_parallel_build()
+{
+  std::vector<int> ints;
+  init_rand();
+  for (int i = 0; i < 10000000; ++i)
+    ints.push_back(rand_int());
+
+  for (unsigned threads = 1; threads <= 2 * pst::parallel::default_threads(); threads *= 2)
+  {
+    std::vector<int> input = ints;
+    std::string what = "rb_tree<int> from_unsorted_parallel, 10M, " + std::to_string(threads) + " thread(s)";
+    timed(what.c_str(), [&] {
+      pst::tree::rb_tree<int, std::less<int>, pst::pool_allocator<int> >::from_unsorted_parallel(std::move(input), threads);
+    });
+  }
+}
+
+void iterate_bs_tree()
+{
+  using namespace pst::tree;
+  iterate_tree<bs_tree<int> >();
+}
+
+void iterate_rb_tree()
+{
+  using namespace pst::tree;
+  iterate_tree<rb_tree<int> >();  
+}
+
@@ -1,17 +1,24 @@
-#pragma once
-
-#ifndef PST_TEST_TREES_H__
-#define PST_TEST_TREES_H__
-
-void test_bs_tree();
-void test_rb_tree();
-
-void trace_rb_tree();
-
-void time_bs_tree();
-void time_rb_tree();
-
-void iterate_bs_tree();
-void iterate_rb_tree();
-
-#endif // PST_TEST_TREES_H__
+#pragma once
+
+#ifndef PST_TEST_TREES_H__
+#define PST_TEST_TREES_H__
+
+void test_bs_tree();
+void test_rb_tree();
+
+void trace_rb_tree();
+
+void time_bs_tree();
+void time_rb_tree();
+void time_parallel_build();
+void time_set_algebra();
+void time_parallel_set_algebra();
+void time_batch_update();
+void time_diff();
+void time_iteration();
+void time_finger();
+
+void iterate_bs_tree();
+void iterate_rb_tree();
+
+#endif // PST_TEST_TREES_H__